@@ -0,0 +1,113 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 08:31:03
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include <labraytracer/batchrenderer.h>
+#include <labraytracer/util.h>
+#include <inviwo/core/common/inviwoapplication.h>
+#include <inviwo/core/datastructures/image/layerram.h>
+#include <inviwo/core/io/datawriterexception.h>
+#include <inviwo/core/io/datawriterfactory.h>
+#include <inviwo/core/util/filesystem.h>
+
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+namespace inviwo
+{
+
+BatchRenderer::BatchRenderer(const TileScheduler& scheduler)
+    : numThreads_(scheduler.getNumThreads())
+    , tileSize_(scheduler.getTileSize())
+{
+}
+
+size_t BatchRenderer::getNumFramesInFlight(const size2_t& imageSize) const
+{
+    //Every thread should get at least four tiles of a frame, as in a full-size rendering
+    const size_t numTiles = ((imageSize.x + tileSize_ - 1) / tileSize_) * ((imageSize.y + tileSize_ - 1) / tileSize_);
+    return std::max(size_t(1), std::min(numThreads_, 4 * numThreads_ / std::max(numTiles, size_t(1))));
+}
+
+size_t BatchRenderer::render(const Scene& scene, const CameraPath& path, const size_t maxRecursiveDepth,
+                             const FrameCallback& onFrame, RenderCounters& counters,
+                             const std::atomic<bool>* cancelled) const
+{
+    const size_t numFrames = path.getNumFrames();
+    const size2_t imageSize(scene.getImageSize());
+    const size_t numWorkers = std::max(size_t(1), std::min(getNumFramesInFlight(imageSize), numFrames));
+
+    std::atomic<size_t> nextFrame(0);
+    std::atomic<size_t> numRendered(0);
+    std::vector<RenderCounters> workerCounters(numWorkers);
+
+    //Each worker renders one frame after the other with its own copy of the scene and its share of the threads
+    const auto work = [&](const size_t worker)
+    {
+        Scene frameScene(scene);
+        TileScheduler scheduler;
+        scheduler.setNumThreads(std::max(size_t(1), numThreads_ / numWorkers));
+        scheduler.setTileSize(tileSize_);
+        while (!(cancelled && *cancelled))
+        {
+            const size_t frame = nextFrame++;
+            if (frame >= numFrames) return;
+
+            const CameraPath::Camera camera = path.getCamera(frame);
+            frameScene.setCameraProperties(camera.lookFrom, camera.lookTo, camera.lookUp, camera.fovy);
+
+            auto image = std::make_shared<Image>(imageSize, DataVec4Float32::get());
+            auto lr = image->getColorLayer()->getEditableRepresentation<LayerRAM>();
+            if (!frameScene.renderPass(lr, maxRecursiveDepth, scheduler, 1, 0, imageSize.y,
+                                       workerCounters[worker], cancelled)) return;
+            if (frameScene.useAdaptiveAntiAliasing
+                && !frameScene.antiAliasingPass(lr, maxRecursiveDepth, scheduler, workerCounters[worker], cancelled)) return;
+            numRendered++;
+            if (onFrame) onFrame(frame, image);
+        }
+    };
+
+    //The calling thread is one of the workers and renders the frames of those the pool does not start
+    Util::runOnPool(numWorkers, work);
+
+    for (const auto& c : workerCounters) counters += c;
+    return numRendered;
+}
+
+std::string BatchRenderer::getFrameFilename(const std::string& filename, const size_t frame)
+{
+    const std::string extension = filesystem::getFileExtension(filename);
+    const std::string base = extension.empty() ? filename : filename.substr(0, filename.size() - extension.size() - 1);
+    std::ostringstream name;
+    name << base << "." << std::setw(5) << std::setfill('0') << frame;
+    if (!extension.empty()) name << "." << extension;
+    return name.str();
+}
+
+bool BatchRenderer::writeFrame(const Image& image, const std::string& filename)
+{
+    auto factory = InviwoApplication::getPtr()->getDataWriterFactory();
+    auto writer = factory->getWriterForTypeAndExtension<Layer>(filesystem::getFileExtension(filename));
+    if (!writer) return false;
+
+    try
+    {
+        writer->setOverwrite(true);
+        writer->writeData(image.getColorLayer(), filename);
+    }
+    catch (const DataWriterException& e)
+    {
+        LogWarn(e.getMessage());
+        return false;
+    }
+    return true;
+}
+
+}// namespace inviwo
@@ -0,0 +1,74 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 08:31:03
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <labraytracer/labraytracermoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <inviwo/core/datastructures/image/image.h>
+#include <labraytracer/camerapath.h>
+#include <labraytracer/renderstatistics.h>
+#include <labraytracer/scene.h>
+#include <labraytracer/tilescheduler.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace inviwo
+{
+
+/** \class BatchRenderer
+    \brief Renders the frames of an animation directly through a Scene
+
+    The scene is prepared once and only the camera changes between frames, so the
+    hierarchies stay warm. Small images do not have enough tiles to keep all threads
+    busy; then several frames are rendered at the same time, each with a share of the threads.
+*/
+class IVW_MODULE_LABRAYTRACER_API BatchRenderer
+{
+//Types
+public:
+    ///Receives every finished frame, in the thread that rendered it. Frames may finish out of order.
+    using FrameCallback = std::function<void(const size_t frame, std::shared_ptr<Image> image)>;
+
+//Construction / Deconstruction
+public:
+    ///Uses the thread count and tile size of the scheduler
+    BatchRenderer(const TileScheduler& scheduler);
+    virtual ~BatchRenderer() = default;
+
+//Methods
+public:
+    ///Number of frames rendered at the same time for the given image size
+    size_t getNumFramesInFlight(const size2_t& imageSize) const;
+
+    /** Renders all frames of the path. The scene needs to be prepared; its camera is ignored.
+        The counters of all frames are added to counters.
+        @returns the number of rendered frames, fewer than all if cancelled has been set.
+    */
+    size_t render(const Scene& scene, const CameraPath& path, const size_t maxRecursiveDepth,
+                  const FrameCallback& onFrame, RenderCounters& counters,
+                  const std::atomic<bool>* cancelled = nullptr) const;
+
+    ///Inserts the zero-padded frame number before the extension, e.g. Rotation.png becomes Rotation.00042.png
+    static std::string getFrameFilename(const std::string& filename, const size_t frame);
+
+    ///Writes the color layer with the image writer registered for the extension of the file
+    static bool writeFrame(const Image& image, const std::string& filename);
+
+//Attributes
+private:
+    size_t numThreads_;
+    size_t tileSize_;
+};
+
+}// namespace inviwo
@@ -2,102 +2,583 @@
 #include <inviwo/core/common/inviwo.h>
 #include <labraytracer/util.h>
 #include <labraytracer/bvhindexedtrianglemesh.h>
-#include <labraytracer/triangle.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
 
 namespace inviwo
 {
 
+namespace
+{
+///Identifies hierarchy cache files; the version changes with the file layout or the builder
+const char CacheMagic[8] = {'L', 'R', 'T', 'B', 'V', 'H', '\0', '\0'};
+constexpr uint32_t CacheVersion = 1;
+
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeSize;
+    uint64_t hash;
+    uint64_t numTriangles;
+};
+
+///FNV-1a on the 64-bit words of data, followed by a final mix
+uint64_t hashWords(const void* data, const size_t numWords, uint64_t hash)
+{
+    const char* bytes = static_cast<const char*>(data);
+    for (size_t i(0); i < numWords; i++)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes + i * sizeof(word), sizeof(word));
+        hash ^= word;
+        hash *= 0x100000001b3ull;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+///Elements hashed together; fixed, so that the hash does not depend on the number of threads
+constexpr size_t HashBlockSize = 1 << 16;
+
+///Temporary files older than this were left behind by a writer that did not finish
+constexpr std::chrono::hours StaleTempFileAge(1);
+
+///Name of a temporary file next to fileName that no other writer, in this or another process, uses
+std::string getTempFileName(const std::string& fileName)
+{
+    static const uint64_t ProcessId = (uint64_t(std::random_device()()) << 32) ^ std::random_device()() ^
+                                      uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+    static std::atomic<uint64_t> Counter(0);
+    std::ostringstream TempFileName;
+    TempFileName << fileName << "." << std::hex << ProcessId << "-" << Counter++ << ".tmp";
+    return TempFileName.str();
+}
+
+/** Deletes the least recently used hierarchies in the directory, except keep, until the rest take
+    at most maxBytes. Also deletes stale temporary files. Files that cannot be read or deleted,
+    e.g. because another process deleted them first, are skipped.
+*/
+void pruneCache(const std::string& directory, const std::string& keep, const uint64_t maxBytes)
+{
+    namespace fs = std::filesystem;
+    struct CacheFile
+    {
+        fs::path path;
+        fs::file_time_type time;
+        uint64_t size;
+    };
+    std::vector<CacheFile> Files;
+    uint64_t TotalBytes(0);
+    const fs::file_time_type Now = fs::file_time_type::clock::now();
+
+    std::error_code ListError;
+    for (fs::directory_iterator It(directory, ListError), End; !ListError && It != End; It.increment(ListError))
+    {
+        const fs::path& Path = It->path();
+        if (Path.filename().string().compare(0, 4, "bvh-") != 0) continue;
+
+        std::error_code Error;
+        const fs::file_time_type Time = fs::last_write_time(Path, Error);
+        const uint64_t Size = Error ? 0 : fs::file_size(Path, Error);
+        if (Error) continue;
+
+        if (Path.extension() == ".tmp")
+        {
+            if (Now - Time > StaleTempFileAge) fs::remove(Path, Error);
+            continue;
+        }
+        TotalBytes += Size;
+        if (Path.extension() == ".bin" && Path != fs::path(keep)) Files.push_back({Path, Time, Size});
+    }
+    if (TotalBytes <= maxBytes) return;
+
+    std::sort(Files.begin(), Files.end(), [](const CacheFile& a, const CacheFile& b) { return a.time < b.time; });
+    for (const CacheFile& File : Files)
+    {
+        if (TotalBytes <= maxBytes) break;
+        std::error_code Error;
+        if (fs::remove(File.path, Error)) TotalBytes -= File.size;
+    }
+}
+}
+
 BVHIndexedTriangleMesh::BVHIndexedTriangleMesh()
     : IndexedTriangleMesh()
+    , mNodeWidth(NodeWidth::Auto)
+    , mActiveNodeWidth(NodeWidth::Binary)
+    , mbHierarchyDirty(true)
+    , mBuiltGeometryVersion(0)
+    , mMaxCacheBytes(DefaultMaxCacheBytes)
+{
+}
+
+uint64_t BVHIndexedTriangleMesh::computeHierarchyHash() const
+{
+    const std::vector<int>& Indices = this->triangleIndices();
+    const size_t NumVertices = getNumVertices();
+    const size_t NumVertexBlocks = (NumVertices + HashBlockSize - 1) / HashBlockSize;
+    const size_t NumIndexBlocks = (Indices.size() + HashBlockSize - 1) / HashBlockSize;
+
+    //Hash blocks of vertices and indices in parallel, then the block hashes in order
+    std::vector<uint64_t> BlockHashes(NumVertexBlocks + NumIndexBlocks);
+    Util::forEachChunk(BlockHashes.size(), 1, [&](size_t begin, size_t end)
+    {
+        std::vector<dvec3> Positions;
+        for (size_t b(begin); b < end; b++)
+        {
+            if (b < NumVertexBlocks)
+            {
+                const size_t First = b * HashBlockSize;
+                Positions.resize(std::min(HashBlockSize, NumVertices - First));
+                for (size_t i(0); i < Positions.size(); i++) Positions[i] = getVertexPosition(First + i);
+                BlockHashes[b] = hashWords(Positions.data(), Positions.size() * 3, b);
+            }
+            else
+            {
+                const size_t First = (b - NumVertexBlocks) * HashBlockSize;
+                const size_t Count = std::min(HashBlockSize, Indices.size() - First);
+                //Pairs of indices; an odd one at the end is hashed on its own
+                uint64_t Hash = hashWords(Indices.data() + First, Count / 2, b);
+                if (Count % 2)
+                {
+                    const uint64_t Last = uint32_t(Indices[First + Count - 1]);
+                    Hash = hashWords(&Last, 1, Hash);
+                }
+                BlockHashes[b] = Hash;
+            }
+        }
+    });
+
+    const uint64_t Parameters[6] = {CacheVersion, sizeof(BVTree::Node), uint64_t(mBuildSettings.maxLeafSize),
+                                    uint64_t(mBuildSettings.numBins), NumVertices, Indices.size()};
+    const uint64_t Hash = hashWords(Parameters, 6, 0xcbf29ce484222325ull);
+    return hashWords(BlockHashes.data(), BlockHashes.size(), Hash);
+}
+
+std::string BVHIndexedTriangleMesh::getCacheFileName(const uint64_t hash) const
+{
+    std::ostringstream FileName;
+    FileName << mCacheDirectory << "/bvh-" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+    return FileName.str();
+}
+
+bool BVHIndexedTriangleMesh::loadHierarchy(const std::string& fileName, const uint64_t hash)
 {
+    std::ifstream In(fileName, std::ios::binary);
+    if (!In) return false;
+
+    CacheHeader Header;
+    if (!In.read(reinterpret_cast<char*>(&Header), sizeof(Header))) return false;
+    if (std::memcmp(Header.magic, CacheMagic, sizeof(CacheMagic)) != 0 || Header.version != CacheVersion
+        || Header.nodeSize != sizeof(BVTree::Node) || Header.hash != hash
+        || Header.numTriangles != triangleIndices().size() / 3)
+    {
+        LogWarn("Ignoring BVH cache file " << fileName << " from a different version or mesh.");
+        return false;
+    }
+
+    if (!mTree.read(In, triangleIndices().size() / 3))
+    {
+        LogWarn("Ignoring damaged BVH cache file " << fileName << ".");
+        return false;
+    }
+
+    //Marks the file as recently used, so that pruning the cache keeps it
+    std::error_code Error;
+    std::filesystem::last_write_time(fileName, std::filesystem::file_time_type::clock::now(), Error);
+    return true;
+}
+
+void BVHIndexedTriangleMesh::saveHierarchy(const std::string& fileName, const uint64_t hash) const
+{
+    //Write to a temporary file of this writer first, so that no one reads a half-written cache
+    const std::string TempFileName = getTempFileName(fileName);
+    {
+        std::ofstream Out(TempFileName, std::ios::binary | std::ios::trunc);
+        if (!Out)
+        {
+            LogWarn("Could not write BVH cache file " << fileName << ".");
+            return;
+        }
+
+        CacheHeader Header;
+        std::memcpy(Header.magic, CacheMagic, sizeof(CacheMagic));
+        Header.version = CacheVersion;
+        Header.nodeSize = sizeof(BVTree::Node);
+        Header.hash = hash;
+        Header.numTriangles = triangleIndices().size() / 3;
+        Out.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+        mTree.write(Out);
+        if (!Out)
+        {
+            LogWarn("Could not write BVH cache file " << fileName << ".");
+            Out.close();
+            std::remove(TempFileName.c_str());
+            return;
+        }
+    }
+
+    std::remove(fileName.c_str());
+    if (std::rename(TempFileName.c_str(), fileName.c_str()) != 0)
+    {
+        std::remove(TempFileName.c_str());
+        return;
+    }
+    pruneCache(mCacheDirectory, fileName, mMaxCacheBytes);
 }
 
 void BVHIndexedTriangleMesh::initialize()
 {
-    mTree.build(this->vertexPositions(), *((const std::vector<ivec3>*)(&this->triangleIndices())));
+    if (!mbHierarchyDirty && mBuiltGeometryVersion == getGeometryVersion()) return;
+    mbHierarchyDirty = false;
+    mBuiltGeometryVersion = getGeometryVersion();
+
+    //The vertices are read through the storage of the mesh, which may be compact or external
+    const std::vector<int>& Indices = this->triangleIndices();
+    const size_t NumTriangles = Indices.size() / 3;
+    //Read the binary hierarchy from the cache if possible, otherwise build and cache it
+    const uint64_t Hash = mCacheDirectory.empty() ? 0 : computeHierarchyHash();
+    const std::string CacheFileName = mCacheDirectory.empty() ? std::string() : getCacheFileName(Hash);
+    const bool bFromCache = !CacheFileName.empty() && loadHierarchy(CacheFileName, Hash);
+    if (!bFromCache)
+    {
+        mTree.build(NumTriangles, [&](size_t i, dvec3& v0, dvec3& v1, dvec3& v2)
+        {
+            v0 = getVertexPosition(Indices[3 * i + 0]);
+            v1 = getVertexPosition(Indices[3 * i + 1]);
+            v2 = getVertexPosition(Indices[3 * i + 2]);
+        }, mBuildSettings);
+        if (!CacheFileName.empty()) saveHierarchy(CacheFileName, Hash);
+    }
+
+    //Precompute edges and normals for the intersection tests, in parallel for large meshes
+    const bool bFloatEdges = getVertexStorage() != VertexStorage::Double;
+    mTriangleEdges.clear();
+    mTriangleEdges.shrink_to_fit();
+    mFloatTriangleEdges.clear();
+    mFloatTriangleEdges.shrink_to_fit();
+    if (bFloatEdges)
+    {
+        mFloatTriangleEdges.resize(NumTriangles);
+    }
+    else
+    {
+        mTriangleEdges.resize(NumTriangles);
+    }
+    Util::forEachChunk(NumTriangles, size_t(1) << 15, [&](size_t begin, size_t end)
+    {
+        for (size_t i(begin); i < end; i++)
+        {
+            const dvec3 p0 = getVertexPosition(Indices[3 * i + 0]);
+            const dvec3 p1 = getVertexPosition(Indices[3 * i + 1]);
+            const dvec3 p2 = getVertexPosition(Indices[3 * i + 2]);
+
+            if (bFloatEdges)
+            {
+                //The normal is taken from the rounded edges, so that the test sees one consistent triangle
+                TriangleEdges<vec3>& T = mFloatTriangleEdges[i];
+                T.p0 = vec3(p0);
+                T.e1 = vec3(p1 - p0);
+                T.e2 = vec3(p2 - p0);
+                T.n = vec3(cross(dvec3(T.e1), dvec3(T.e2)));
+            }
+            else
+            {
+                TriangleEdges<dvec3>& T = mTriangleEdges[i];
+                T.p0 = p0;
+                T.e1 = p1 - p0;
+                T.e2 = p2 - p0;
+                T.n = cross(T.e1, T.e2);
+            }
+        }
+    });
+
+    const size_t EdgeBytes = mTriangleEdges.size() * sizeof(TriangleEdges<dvec3>) +
+                             mFloatTriangleEdges.size() * sizeof(TriangleEdges<vec3>);
+    LogInfo("Mesh with " << getNumVertices() << " vertices in " << getStorageName(getVertexStorage())
+            << " storage and " << NumTriangles << " triangles: " << getMemoryUsage() / 1024
+            << " KiB of vertices and indices, " << getExternalMemoryUsage() / 1024 << " KiB referenced, "
+            << EdgeBytes / 1024 << " KiB of " << (bFloatEdges ? "float" : "double") << " triangle edges.");
+
+    LogInfo("BVH " << (bFromCache ? "read from " + CacheFileName : std::string("built")) << " with "
+                   << mTree.getNumNodes() << " nodes (" << mTree.getNumLeaves()
+                   << " leaves) at " << BVTree::getBytesPerNode() << " bytes per node, "
+                   << mTree.getMemoryUsage() / 1024 << " KiB in total. " << (bFromCache ? "Read" : "Build")
+                   << " time " << mTree.getBuildTime() << " s, SAH cost " << mTree.getSAHCost() << ".");
+
+    //Collapse into a wide hierarchy for traversal
+    mActiveNodeWidth = mNodeWidth;
+    if (mActiveNodeWidth == NodeWidth::Auto)
+    {
+        mActiveNodeWidth = widebvh::hasAVX() ? NodeWidth::Eight : NodeWidth::Four;
+    }
+
+    mTree4 = WideBVTree<4>();
+    mTree8 = WideBVTree<8>();
+    if (mActiveNodeWidth == NodeWidth::Four)
+    {
+        mTree4.build(mTree);
+        LogInfo("Collapsed to a 4-wide BVH with " << mTree4.getNumNodes() << " nodes at "
+                << WideBVTree<4>::getBytesPerNode() << " bytes per node, "
+                << mTree4.getMemoryUsage() / 1024 << " KiB in total, using "
+                << mTree4.getInstructionSet() << " box tests.");
+    }
+    else if (mActiveNodeWidth == NodeWidth::Eight)
+    {
+        mTree8.build(mTree);
+        LogInfo("Collapsed to an 8-wide BVH with " << mTree8.getNumNodes() << " nodes at "
+                << WideBVTree<8>::getBytesPerNode() << " bytes per node, "
+                << mTree8.getMemoryUsage() / 1024 << " KiB in total, using "
+                << mTree8.getInstructionSet() << " box tests.");
+    }
 }
 
-bool BVHIndexedTriangleMesh::closestIntersection(const Ray& ray, double maxLambda,
-                                                 RayIntersection& intersection) const
+
+inline bool BVHIndexedTriangleMesh::intersectTriangle(const size_t i, const dvec3& origin, const dvec3& direction,
+                                                      const double maxLambda, double& lambda, double& u,
+                                                      double& v) const
 {
-    const std::vector<int>& intersectionCandidates = mTree.intersectBoundingBoxes(ray, maxLambda);
+    if (!mFloatTriangleEdges.empty())
+    {
+        const TriangleEdges<vec3>& T = mFloatTriangleEdges[i];
+        return Util::intersectRayTriangle(origin, direction, dvec3(T.p0), dvec3(T.e1), dvec3(T.e2), dvec3(T.n),
+                                          maxLambda, lambda, u, v);
+    }
+    const TriangleEdges<dvec3>& T = mTriangleEdges[i];
+    return Util::intersectRayTriangle(origin, direction, T.p0, T.e1, T.e2, T.n, maxLambda, lambda, u, v);
+}
+
+dvec3 BVHIndexedTriangleMesh::getFaceNormal(const size_t i) const
+{
+    return mFloatTriangleEdges.empty() ? mTriangleEdges[i].n : dvec3(mFloatTriangleEdges[i].n);
+}
+
+
+template <typename Tree>
+int BVHIndexedTriangleMesh::findClosestTriangle(const Tree& tree, const Ray& ray, double& maxLambda,
+                                                double& u, double& v) const
+{
+    const dvec3& origin = ray.getOrigin();
+    const dvec3& direction = ray.getDirection();
 
-    double closestLambda = maxLambda;
     int closestTri = -1;
-    dvec3 closestbary(0);
-    for (size_t i = 0; i < intersectionCandidates.size(); ++i)
-    {
-        const int triangleIndex = intersectionCandidates[i];
-        const int idx0 = this->triangleIndices()[3 * triangleIndex + 0];
-        const int idx1 = this->triangleIndices()[3 * triangleIndex + 1];
-        const int idx2 = this->triangleIndices()[3 * triangleIndex + 2];
-
-        const dvec3& p0 = this->vertexPositions()[idx0];
-        const dvec3& p1 = this->vertexPositions()[idx1];
-        const dvec3& p2 = this->vertexPositions()[idx2];
-
-        std::shared_ptr<Triangle> T = std::make_shared<Triangle>(p0, p1, p2);
-        RayIntersection currIntersection;
-        const bool bIntersect = T->closestIntersection(ray, closestLambda, currIntersection);
-        if (bIntersect && currIntersection.getLambda() > 0 && currIntersection.getLambda() < closestLambda)
+    tree.traverse(ray, maxLambda, [&](const int triangleIndex, double& currentMaxLambda)
+    {
+        double lambda, triU, triV;
+        if (intersectTriangle(triangleIndex, origin, direction, currentMaxLambda, lambda, triU, triV))
         {
-            closestLambda = currIntersection.getLambda();
+            currentMaxLambda = lambda;
             closestTri = triangleIndex;
-            closestbary = currIntersection.getUVW();
+            u = triU;
+            v = triV;
         }
+        return false; //keep looking for closer ones
+    });
+
+    return closestTri;
+}
+
+
+template <typename Tree>
+int BVHIndexedTriangleMesh::findAnyTriangle(const Tree& tree, const Ray& ray, double maxLambda) const
+{
+    const dvec3& origin = ray.getOrigin();
+    const dvec3& direction = ray.getDirection();
+
+    int hitTri = -1;
+    tree.traverse(ray, maxLambda, [&](const int triangleIndex, double& currentMaxLambda)
+    {
+        double lambda, u, v;
+        if (!intersectTriangle(triangleIndex, origin, direction, currentMaxLambda, lambda, u, v))
+        {
+            return false;
+        }
+        hitTri = triangleIndex;
+        return true;
+    });
+    return hitTri;
+}
+
+int BVHIndexedTriangleMesh::findAnyTriangle(const Ray& ray, double maxLambda) const
+{
+    switch (mActiveNodeWidth)
+    {
+        case NodeWidth::Four:
+            return findAnyTriangle(mTree4, ray, maxLambda);
+        case NodeWidth::Eight:
+            return findAnyTriangle(mTree8, ray, maxLambda);
+        default:
+            return findAnyTriangle(mTree, ray, maxLambda);
     }
+}
+
+bool BVHIndexedTriangleMesh::closestIntersection(const Ray& ray, double maxLambda,
+                                                 RayIntersection& intersection) const
+{
+    HitRecord hit;
+    if (!closestHit(ray, maxLambda, hit)) return false;
 
-    if (closestTri >= 0)
+    //Only the final hit gets a full RayIntersection
+    intersection = makeIntersection(ray, hit);
+    return true;
+}
+
+bool BVHIndexedTriangleMesh::closestHit(const Ray& ray, double maxLambda, HitRecord& hit) const
+{
+    double closestLambda = maxLambda;
+    double closestU(0), closestV(0);
+    int closestTri;
+    switch (mActiveNodeWidth)
     {
-        const int i0 = this->triangleIndices()[3 * closestTri + 0];
-        const int i1 = this->triangleIndices()[3 * closestTri + 1];
-        const int i2 = this->triangleIndices()[3 * closestTri + 2];
+        case NodeWidth::Four:
+            closestTri = findClosestTriangle(mTree4, ray, closestLambda, closestU, closestV);
+            break;
+        case NodeWidth::Eight:
+            closestTri = findClosestTriangle(mTree8, ray, closestLambda, closestU, closestV);
+            break;
+        default:
+            closestTri = findClosestTriangle(mTree, ray, closestLambda, closestU, closestV);
+            break;
+    }
 
-        //const dvec3& p0 = this->vertexPositions()[i0];
-        //const dvec3& p1 = this->vertexPositions()[i1];
-        //const dvec3& p2 = this->vertexPositions()[i2];
+    if (closestTri < 0) return false;
 
-        assert(!vertexNormals().empty());
-        dvec3 n(vertexNormals()[i0] * closestbary[0] +
-                vertexNormals()[i1] * closestbary[1] +
-                vertexNormals()[i2] * closestbary[2]);
+    hit.renderable = this;
+    hit.primitive = uint32_t(closestTri);
+    hit.lambda = closestLambda;
+    hit.u = closestU;
+    hit.v = closestV;
+    return true;
+}
 
-        dvec3 uvw(0, 0, 0);
-        //if (!this->vertexTextureCoordinates().empty())
-        //    uvw = this->vertexTextureCoordinates()[i0] * closestbary[0] +
-        //          this->vertexTextureCoordinates()[i1] * closestbary[1] +
-        //          this->vertexTextureCoordinates()[i2] * closestbary[2];
 
-        intersection = RayIntersection(ray, shared_from_this(), closestLambda, normalize(n), uvw);
-        return true;
+RayIntersection BVHIndexedTriangleMesh::makeIntersection(const Ray& ray, const HitRecord& hit) const
+{
+    const uint32_t triangle = hit.primitive;
+    const int i0 = this->triangleIndices()[3 * triangle + 0];
+    const int i1 = this->triangleIndices()[3 * triangle + 1];
+    const int i2 = this->triangleIndices()[3 * triangle + 2];
+    const dvec3 bary(1.0 - hit.u - hit.v, hit.u, hit.v);
+
+    //Interpolated vertex normal, or the face normal if there are no vertex normals
+    dvec3 n = getFaceNormal(triangle);
+    if (hasVertexNormals())
+    {
+        const dvec3 Interpolated = getVertexNormal(i0) * bary[0] +
+                                   getVertexNormal(i1) * bary[1] +
+                                   getVertexNormal(i2) * bary[2];
+        if (dot(Interpolated, Interpolated) > 0) n = Interpolated;
     }
 
-    return false;
+    dvec3 uvw(0, 0, 0);
+    //if (!this->vertexTextureCoordinates().empty())
+    //    uvw = this->vertexTextureCoordinates()[i0] * bary[0] +
+    //          this->vertexTextureCoordinates()[i1] * bary[1] +
+    //          this->vertexTextureCoordinates()[i2] * bary[2];
+
+    return RayIntersection(ray, this, hit.lambda, normalize(n), uvw);
 }
 
 
 bool BVHIndexedTriangleMesh::anyIntersection(const Ray& ray, double maxLambda) const
 {
-    std::vector<int> intersectionCandidates = mTree.intersectBoundingBoxes(ray, maxLambda);
+    return findAnyTriangle(ray, maxLambda) >= 0;
+}
 
-    for (size_t i = 0; i < intersectionCandidates.size(); ++i)
-    {
-        const int triangleIndex = intersectionCandidates[i];
-        const int idx0 = this->triangleIndices()[3 * triangleIndex + 0];
-        const int idx1 = this->triangleIndices()[3 * triangleIndex + 1];
-        const int idx2 = this->triangleIndices()[3 * triangleIndex + 2];
+bool BVHIndexedTriangleMesh::anyHit(const Ray& ray, double maxLambda, HitRecord& hit) const
+{
+    const int hitTri = findAnyTriangle(ray, maxLambda);
+    if (hitTri < 0) return false;
+    hit.renderable = this;
+    hit.primitive = uint32_t(hitTri);
+    return true;
+}
 
-        const dvec3& p0 = this->vertexPositions()[idx0];
-        const dvec3& p1 = this->vertexPositions()[idx1];
-        const dvec3& p2 = this->vertexPositions()[idx2];
+bool BVHIndexedTriangleMesh::anyPrimitiveIntersection(const Ray& ray, double maxLambda,
+                                                      const uint32_t primitive) const
+{
+    if (primitive >= mTriangleEdges.size() + mFloatTriangleEdges.size()) return false;
+    double lambda, u, v;
+    return intersectTriangle(primitive, ray.getOrigin(), ray.getDirection(), maxLambda, lambda, u, v);
+}
 
-        std::shared_ptr<Triangle> T = std::make_shared<Triangle>(p0, p1, p2);
-        if (T->anyIntersection(ray, maxLambda)) return true;
-    }
 
-    return false;
+int BVHIndexedTriangleMesh::closestHit8(const RayPacket8& packet, const int activeMask, double* maxLambda,
+                                        HitRecord* hits) const
+{
+    int closestTri[RayPacket8::Size];
+    double closestU[RayPacket8::Size];
+    double closestV[RayPacket8::Size];
+    for (int lane = 0; lane < RayPacket8::Size; lane++) closestTri[lane] = -1;
+
+    mTree.traversePacket(packet, activeMask, maxLambda, [&](const int triangleIndex, const int laneMask)
+    {
+        for (int lane = 0; lane < RayPacket8::Size; lane++)
+        {
+            if (!(laneMask & (1 << lane))) continue;
+            const Ray& ray = packet.rays[lane];
+            double lambda, u, v;
+            if (intersectTriangle(triangleIndex, ray.getOrigin(), ray.getDirection(), maxLambda[lane],
+                                  lambda, u, v))
+            {
+                maxLambda[lane] = lambda;
+                closestTri[lane] = triangleIndex;
+                closestU[lane] = u;
+                closestV[lane] = v;
+            }
+        }
+        return 0; //keep looking for closer ones
+    });
+
+    int hitMask = 0;
+    for (int lane = 0; lane < RayPacket8::Size; lane++)
+    {
+        if (closestTri[lane] < 0) continue;
+        hits[lane].renderable = this;
+        hits[lane].primitive = uint32_t(closestTri[lane]);
+        hits[lane].lambda = maxLambda[lane];
+        hits[lane].u = closestU[lane];
+        hits[lane].v = closestV[lane];
+        hitMask |= (1 << lane);
+    }
+    return hitMask;
 }
 
+
+int BVHIndexedTriangleMesh::anyIntersection8(const RayPacket8& packet, const int activeMask,
+                                             const double* maxLambda) const
+{
+    int hitMask = 0;
+    mTree.traversePacket(packet, activeMask, maxLambda, [&](const int triangleIndex, const int laneMask)
+    {
+        int occluded = 0;
+        for (int lane = 0; lane < RayPacket8::Size; lane++)
+        {
+            if (!(laneMask & (1 << lane))) continue;
+            const Ray& ray = packet.rays[lane];
+            double lambda, u, v;
+            if (intersectTriangle(triangleIndex, ray.getOrigin(), ray.getDirection(), maxLambda[lane],
+                                  lambda, u, v))
+            {
+                occluded |= (1 << lane);
+            }
+        }
+        hitMask |= occluded;
+        return occluded; //these rays are done
+    });
+    return hitMask;
 }
 
+}
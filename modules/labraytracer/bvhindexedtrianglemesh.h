@@ -5,22 +5,140 @@
 #include <labraytracer/ray.h>
 #include <labraytracer/indexedtrianglemesh.h>
 #include <labraytracer/bvtree.h>
+#include <labraytracer/widebvtree.h>
+
+#include <string>
 
 namespace inviwo
 {
 class IVW_MODULE_LABRAYTRACER_API BVHIndexedTriangleMesh : public IndexedTriangleMesh
 {
 public:
+    ///Number of children per node of the hierarchy used for traversal
+    enum class NodeWidth
+    {
+        Binary,
+        Four,
+        Eight,
+        ///Eight if the processor supports AVX, otherwise four
+        Auto
+    };
+
     BVHIndexedTriangleMesh();
 
+    ///Builds the hierarchy. Does nothing if neither the geometry nor the settings changed since the last call.
     void initialize() override;
 
+    ///Settings for building the hierarchy; take effect with the next call to initialize()
+    void setBuildSettings(const BVTree::BuildSettings& settings)
+    {
+        if (settings.maxLeafSize == mBuildSettings.maxLeafSize && settings.numBins == mBuildSettings.numBins) return;
+        mBuildSettings = settings;
+        mbHierarchyDirty = true;
+    }
+    const BVTree::BuildSettings& getBuildSettings() const { return mBuildSettings; }
+
+    ///Node width of the hierarchy; takes effect with the next call to initialize()
+    void setNodeWidth(NodeWidth width)
+    {
+        if (width == mNodeWidth) return;
+        mNodeWidth = width;
+        mbHierarchyDirty = true;
+    }
+    NodeWidth getNodeWidth() const { return mNodeWidth; }
+
+    /** Directory for caching built hierarchies on disk; empty disables the cache (default).
+        The binary hierarchy is stored under a hash of the vertex positions, the triangles and
+        the build settings, and read back instead of building it when the same mesh is initialized
+        again. Files that do not match are rebuilt and overwritten.
+        After writing a file, the least recently used ones are deleted while the cache exceeds its size limit.
+    */
+    void setCacheDirectory(const std::string& directory) { mCacheDirectory = directory; }
+    const std::string& getCacheDirectory() const { return mCacheDirectory; }
+
+    ///Size limit of the files in the cache directory, see setCacheDirectory()
+    void setMaxCacheSize(const uint64_t maxBytes) { mMaxCacheBytes = maxBytes; }
+    uint64_t getMaxCacheSize() const { return mMaxCacheBytes; }
+    static constexpr uint64_t DefaultMaxCacheBytes = uint64_t(1) << 30;
+
+    ///Hash of everything the binary hierarchy depends on
+    uint64_t computeHierarchyHash() const;
+
     bool closestIntersection(const Ray& ray, double maxLambda,
                              RayIntersection& intersection) const override;
 
     bool anyIntersection(const Ray& ray, double maxLambda) const override;
 
+    ///Records the hit triangle and its barycentric coordinates
+    bool closestHit(const Ray& ray, double maxLambda, HitRecord& hit) const override;
+
+    ///Interpolates the vertex normals at the recorded hit
+    RayIntersection makeIntersection(const Ray& ray, const HitRecord& hit) const override;
+
+    ///Packet traversal of the binary hierarchy, regardless of the node width
+    int closestHit8(const RayPacket8& packet, const int activeMask, double* maxLambda,
+                    HitRecord* hits) const override;
+
+    int anyIntersection8(const RayPacket8& packet, const int activeMask,
+                         const double* maxLambda) const override;
+
+    ///Records the blocking triangle
+    bool anyHit(const Ray& ray, double maxLambda, HitRecord& hit) const override;
+
+    ///Tests the triangle with the given index only
+    bool anyPrimitiveIntersection(const Ray& ray, double maxLambda, const uint32_t primitive) const override;
+
 private:
+    ///Finds the closest hit in the given hierarchy. Returns the triangle index or -1.
+    template <typename Tree>
+    int findClosestTriangle(const Tree& tree, const Ray& ray, double& maxLambda, double& u, double& v) const;
+
+    ///Finds any hit in the given hierarchy. Returns the triangle index or -1.
+    template <typename Tree>
+    int findAnyTriangle(const Tree& tree, const Ray& ray, double maxLambda) const;
+
+    ///Any hit in the hierarchy of the active node width
+    int findAnyTriangle(const Ray& ray, double maxLambda) const;
+
+    ///Cache file of the hierarchy with the given hash
+    std::string getCacheFileName(const uint64_t hash) const;
+    ///Reads mTree from the cache file. Returns false if it is missing or does not match.
+    bool loadHierarchy(const std::string& fileName, const uint64_t hash);
+    void saveHierarchy(const std::string& fileName, const uint64_t hash) const;
+
+    ///Ray-triangle test with the precomputed edges of triangle i, in whichever precision they are kept
+    bool intersectTriangle(const size_t i, const dvec3& origin, const dvec3& direction, const double maxLambda,
+                           double& lambda, double& u, double& v) const;
+    ///Unnormalized face normal of triangle i
+    dvec3 getFaceNormal(const size_t i) const;
+
+    ///Precomputed per-triangle data for the ray-triangle test, see Util::intersectRayTriangle
+    template <typename Vec>
+    struct TriangleEdges
+    {
+        Vec p0;
+        Vec e1;
+        Vec e2;
+        Vec n;
+    };
+
+    BVTree::BuildSettings mBuildSettings;
+    NodeWidth mNodeWidth;
+    ///Width actually used after initialize(), never Auto
+    NodeWidth mActiveNodeWidth;
     BVTree mTree;
+    WideBVTree<4> mTree4;
+    WideBVTree<8> mTree8;
+    ///Set when the settings change; the geometry is tracked by its version
+    bool mbHierarchyDirty;
+    uint64_t mBuiltGeometryVersion;
+    std::string mCacheDirectory;
+    uint64_t mMaxCacheBytes;
+    /** Edges of the triangles with Double vertex storage, 96 bytes per triangle. The other storages
+        have float positions, so their edges are kept as float in mFloatTriangleEdges, 48 bytes per triangle.
+        Only one of the two is filled.
+    */
+    std::vector<TriangleEdges<dvec3>> mTriangleEdges;
+    std::vector<TriangleEdges<vec3>> mFloatTriangleEdges;
 };
 }
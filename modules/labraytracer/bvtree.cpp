@@ -1,332 +1,627 @@
 #include <labraytracer/bvtree.h>
+#include <labraytracer/performancetimer.h>
+#include <labraytracer/util.h>
 
-
-#if defined(_OPENMP)
-#include <omp.h>
-#endif
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <istream>
+#include <mutex>
+#include <ostream>
 
 namespace inviwo
 {
 
+namespace
+{
+//Rounds outwards, so that the single precision box encloses the double precision one
+vec3 roundDown(const dvec3& v)
+{
+    return vec3(std::nextafter(float(v[0]), -std::numeric_limits<float>::infinity()),
+                std::nextafter(float(v[1]), -std::numeric_limits<float>::infinity()),
+                std::nextafter(float(v[2]), -std::numeric_limits<float>::infinity()));
+}
 
-BVTree::BVTree()
+vec3 roundUp(const dvec3& v)
 {
-#if defined(_OPENMP)
-    mTempCandidates.resize(omp_get_max_threads());
-    mTempTraversalJobs.resize(omp_get_max_threads());
-#else
-    mTempCandidates.resize(1);
-    mTempTraversalJobs.resize(1);
-#endif
+    return vec3(std::nextafter(float(v[0]), std::numeric_limits<float>::infinity()),
+                std::nextafter(float(v[1]), std::numeric_limits<float>::infinity()),
+                std::nextafter(float(v[2]), std::numeric_limits<float>::infinity()));
 }
 
-const std::vector<int>& BVTree::intersectBoundingBoxes(const Ray& ray, const double maxLambda) const
+float computeArea(const vec3& bboxMin, const vec3& bboxMax)
 {
-#if defined(_OPENMP)
-    std::vector<int>& tempCandidates = mTempCandidates[omp_get_thread_num()];
-    std::stack<int>& tempTraversalJobs = mTempTraversalJobs[omp_get_thread_num()];
-#else
-    std::vector<int>& tempCandidates = mTempCandidates[0];
-    std::stack<int>& tempTraversalJobs = mTempTraversalJobs[0];
-#endif
+    const vec3 d = bboxMax - bboxMin;
+    if (d[0] < 0 || d[1] < 0 || d[2] < 0) return 0;
+    return 2 * (d[0] * d[1] + d[0] * d[2] + d[1] * d[2]);
+}
 
-    // int* jobs = (int*)alloca(sizeof(int)*100); //yields 25% better performance
+/** Binned SAH builder following Wald, "On fast Construction of SAH-based Bounding Volume
+    Hierarchies" (2007).
 
-    tempCandidates.clear();
-    tempTraversalJobs.push(0);
+    The primitive index list is partitioned in place. The top of the tree is split on the
+    calling thread (with parallel binning), the subtrees below it are built as independent
+    tasks on the thread pool. Each task writes its nodes in depth-first order into its own
+    array, the arrays are stitched together at the end.
+    Memory is bounded by the per-primitive bounds plus the final nodes, i.e. O(n).
+*/
+class BinnedSAHBuilder
+{
+public:
+    using Node = BVTree::Node;
+    static constexpr int MaxBins = 64;
+    ///Ranges smaller than this are binned on a single thread
+    static constexpr int ParallelBinningSize = 1 << 16;
+    ///Ranges smaller than this are not split up further for parallel building
+    static constexpr int MinSubtreeSize = 1 << 12;
+
+    BinnedSAHBuilder(const BVTree::BuildSettings& settings, const std::vector<vec3>& boundsMin,
+                     const std::vector<vec3>& boundsMax, std::vector<int>& primitiveIndices)
+        : mMaxLeafSize(std::max(1, settings.maxLeafSize))
+        , mNumBins(glm::clamp(settings.numBins, 2, MaxBins))
+        , mBoundsMin(boundsMin)
+        , mBoundsMax(boundsMax)
+        , mIndices(primitiveIndices)
+    {
+    }
 
-    while (!tempTraversalJobs.empty())
+    void build(std::vector<Node>& nodes)
     {
-        //take current job
-        int node = tempTraversalJobs.top();
-        tempTraversalJobs.pop();
+        const int n = int(mBoundsMin.size());
+        nodes.clear();
+        mIndices.resize(n);
+        if (n == 0) return;
 
-        //test ray vs. bounding box of node
-        if (mNodes[node].bbox.anyIntersection(ray, maxLambda))
+        mCentroids.resize(n);
+        Util::forEachChunk(size_t(n), ParallelBinningSize, [&](size_t begin, size_t end)
         {
-            if (mNodes[node].left <= 0 && mNodes[node].right == -1)// is a leaf node
+            for (size_t i = begin; i < end; i++)
             {
-                tempCandidates.push_back(-mNodes[node].left);
+                mIndices[i] = int(i);
+                mCentroids[i] = 0.5f * (mBoundsMin[i] + mBoundsMax[i]);
             }
-            else//is not a leaf
+        });
+
+        //Root range
+        Range root;
+        root.first = 0;
+        root.count = n;
+        root.depth = 0;
+        computeBounds(root, true);
+
+        //Split the top of the tree on this thread until the ranges are small enough to be
+        //distributed over the thread pool.
+        const size_t numThreads = Util::getNumPoolThreads();
+        const int subtreeSize = numThreads > 0 ? std::max(MinSubtreeSize, int(n / (8 * numThreads))) : n;
+
+        std::vector<TopNode> topNodes;
+        std::vector<Range> subtreeRanges;
+        topNodes.push_back({root, -1, -1, -1});
+        std::vector<int> open{0};
+        while (!open.empty())
+        {
+            const int current = open.back();
+            open.pop_back();
+            const Range range = topNodes[current].range;
+            Range left, right;
+            if (range.count <= subtreeSize || !split(range, true, left, right))
             {
-                tempTraversalJobs.push(mNodes[node].left);
-                tempTraversalJobs.push(mNodes[node].right);
+                topNodes[current].subtree = int(subtreeRanges.size());
+                subtreeRanges.push_back(range);
+                continue;
             }
+
+            topNodes[current].left = int(topNodes.size());
+            topNodes.push_back({left, -1, -1, -1});
+            topNodes[current].right = int(topNodes.size());
+            topNodes.push_back({right, -1, -1, -1});
+            open.push_back(topNodes[current].left);
+            open.push_back(topNodes[current].right);
         }
-    }
 
-    return tempCandidates;
-}
+        //Build the subtrees, in parallel where possible
+        std::vector<std::vector<Node>> subtrees(subtreeRanges.size());
+        if (numThreads > 0 && subtreeRanges.size() > 1)
+        {
+            //The calling thread builds subtrees as well, so that this can run within a pool task
+            std::atomic<size_t> nextSubtree(0);
+            Util::runOnPool(std::min(numThreads + 1, subtreeRanges.size()), [&](size_t)
+            {
+                for (size_t i = nextSubtree++; i < subtreeRanges.size(); i = nextSubtree++)
+                {
+                    buildSubtree(subtreeRanges[i], subtrees[i]);
+                }
+            });
+        }
+        else
+        {
+            for (size_t i(0); i < subtreeRanges.size(); i++) buildSubtree(subtreeRanges[i], subtrees[i]);
+        }
 
-void BVTree::createNodes(const std::vector<dvec3>& vertexPositions,
-                         const std::vector<ivec3>& triangleIndices)
-{
-    size_t n = triangleIndices.size();
-    mTempTriangleBoxes.resize(n);
+        //Stitch together in depth-first order
+        size_t numNodes = 0;
+        for (const auto& subtree : subtrees) numNodes += subtree.size();
+        for (const auto& top : topNodes) numNodes += (top.subtree < 0) ? 1 : 0;
+        nodes.reserve(numNodes);
+        appendTopNode(topNodes, 0, subtrees, nodes);
 
-    for (unsigned int i = 0; i < n; ++i)
-    {
-        const dvec3& v0 = vertexPositions[triangleIndices[i][0]];
-        const dvec3& v1 = vertexPositions[triangleIndices[i][1]];
-        const dvec3& v2 = vertexPositions[triangleIndices[i][2]];
+        std::vector<vec3>().swap(mCentroids);
+    }
 
-        dvec3 newMin, newMax;
-        for (unsigned int j = 0; j < 3; ++j)
+private:
+    struct Range
+    {
+        int first;
+        int count;
+        int depth;
+        vec3 bboxMin;
+        vec3 bboxMax;
+        vec3 centroidMin;
+        vec3 centroidMax;
+    };
+
+    struct TopNode
+    {
+        Range range;
+        int left;
+        int right;
+        ///Index of the subtree built below this node, or -1 for inner nodes of the top tree
+        int subtree;
+    };
+
+    ///Bounds and count of the primitives falling into one bin. Not initialized on construction,
+    ///so that only the bins in use need to be cleared.
+    struct Bin
+    {
+        void clear()
         {
-            newMin[j] = std::min(v0[j], std::min(v1[j], v2[j]));
-            newMax[j] = std::max(v0[j], std::max(v1[j], v2[j]));
+            bboxMin = vec3(std::numeric_limits<float>::infinity());
+            bboxMax = vec3(-std::numeric_limits<float>::infinity());
+            centroidMin = vec3(std::numeric_limits<float>::infinity());
+            centroidMax = vec3(-std::numeric_limits<float>::infinity());
+            count = 0;
         }
-        mTempTriangleBoxes[i].setMin(newMin);
-        mTempTriangleBoxes[i].setMax(newMax);
-    }
-}
 
-void BVTree::sortTriangles()
-{
-    const std::vector<BoundingBox>& triangleNodes = mTempTriangleBoxes;
-    size_t n = triangleNodes.size();
+        void add(const vec3& primMin, const vec3& primMax, const vec3& centroid)
+        {
+            bboxMin = glm::min(bboxMin, primMin);
+            bboxMax = glm::max(bboxMax, primMax);
+            centroidMin = glm::min(centroidMin, centroid);
+            centroidMax = glm::max(centroidMax, centroid);
+            count++;
+        }
 
-    mTempSortedTriangleIndices.resize(n);
+        void merge(const Bin& other)
+        {
+            bboxMin = glm::min(bboxMin, other.bboxMin);
+            bboxMax = glm::max(bboxMax, other.bboxMax);
+            centroidMin = glm::min(centroidMin, other.centroidMin);
+            centroidMax = glm::max(centroidMax, other.centroidMax);
+            count += other.count;
+        }
 
-    std::vector<int> permutation(n);
+        vec3 bboxMin;
+        vec3 bboxMax;
+        vec3 centroidMin;
+        vec3 centroidMax;
+        int count;
+    };
 
-    //init permutation
-    for (unsigned int i = 0; i < n; ++i)
-        permutation[i] = int(i);
+    using Bins = std::array<std::array<Bin, MaxBins>, 3>;
 
-    for (unsigned int dim = 0; dim < 3; ++dim)
+    static void clear(Bins& bins, const int numBins)
     {
-        //sort according to dim-coordinate of bounding box centers
-        std::sort(permutation.begin(), permutation.end(),
-                  [&triangleNodes, dim](int a, int b) -> bool {
-                      return (triangleNodes[a].max()[dim] + triangleNodes[a].min()[dim]) <
-                             (triangleNodes[b].max()[dim] + triangleNodes[b].min()[dim]);
-                  });
-
-        //copy permutation indices to result
-        for (unsigned int i = 0; i < n; ++i)
-            mTempSortedTriangleIndices[i][dim] = permutation[i];
+        for (auto& axisBins : bins)
+        {
+            for (int b(0); b < numBins; b++) axisBins[b].clear();
+        }
     }
-}
 
-void BVTree::build(const std::vector<dvec3>& vertexPositions,
-                   const std::vector<ivec3>& triangleIndices)
-{
-    //create bounding boxes for all triangles
-    this->createNodes(vertexPositions, triangleIndices);
-    unsigned n = unsigned(triangleIndices.size());
-    //sort triangles by x,y and z
-    //sortedTriangles now holds sorting permutations for orderings w.r.t x,y,z in the three components
-    this->sortTriangles();
-
-    mTempMarker.resize(n);
-    mTempBufferTriangleIndices.resize(n);
-    mTempAreasLeft.resize(n);
-    mTempAreasRight.resize(n);
-
-    //Create root node
+    static int getBin(const float centroid, const float centroidMin, const float scale, const int numBins)
     {
-        Node root;
-        BoundingBox nodeBox;
-        for (unsigned int i = 0; i < mTempTriangleBoxes.size(); ++i)
-            nodeBox.merge(mTempTriangleBoxes[i]);
-        root.bbox = nodeBox;
-        mNodes.push_back(root);
+        return glm::clamp(int((centroid - centroidMin) * scale), 0, numBins - 1);
     }
 
-    this->buildHierarchy(0, 0, n);
-
-    //clear temporary storage
-    std::vector<bool>().swap(mTempMarker);
-    std::vector<BoundingBox>().swap(mTempTriangleBoxes);
-    std::vector<ivec3>().swap(mTempSortedTriangleIndices);
-    std::vector<ivec3>().swap(mTempBufferTriangleIndices);
-    std::vector<dvec3>().swap(mTempAreasLeft);
-    std::vector<dvec3>().swap(mTempAreasRight);
-
-
-    //   std::cerr<<"created bvh tree with "<<mNodes.size()<<" nodes"<<std::endl;
-    //
-    //   //print leaf node indices
-    //   for(size_t i=0;i<mNodes.size();++i)
-    //   {
-    //     const Node& node=mNodes[i];
-    //     if(node.left<1) //either root or leaf
-    //     {
-    //       std::cerr<<"triangle index: "<<abs(node.left)<<std::endl;
-    //     }
-    //   }
-}
-void BVTree::printSortedIndicesStatus(unsigned int offset, unsigned int numTriangles)
-{
-    std::cerr << "Indices Status\nX:";
-    for (size_t i = offset; i < numTriangles + offset; ++i)
-        std::cerr << int(mTempMarker[mTempSortedTriangleIndices[i][0]]);
-    std::cerr << "\nY:";
-    for (size_t i = offset; i < numTriangles + offset; ++i)
-        std::cerr << int(mTempMarker[mTempSortedTriangleIndices[i][1]]);
-    std::cerr << "\nZ:";
-    for (size_t i = offset; i < numTriangles + offset; ++i)
-        std::cerr << int(mTempMarker[mTempSortedTriangleIndices[i][2]]);
-    std::cerr << std::endl;
-
-    std::cerr << "Indices Order\nX:";
-    for (size_t i = offset; i < numTriangles + offset; ++i)
-        std::cerr << int(mTempSortedTriangleIndices[i][0]) << ",";
-    std::cerr << "\nY:";
-    for (size_t i = offset; i < numTriangles + offset; ++i)
-        std::cerr << int(mTempSortedTriangleIndices[i][1]) << ",";
-    std::cerr << "\nZ:";
-    for (size_t i = offset; i < numTriangles + offset; ++i)
-        std::cerr << int(mTempSortedTriangleIndices[i][2]) << ",";
-    std::cerr << std::endl;
-}
-void BVTree::buildHierarchy(unsigned int rootNodeIndex, unsigned int offset,
-                            unsigned int numTriangles)
-{
-    //  std::cerr<<std::endl;
-    //  std::cerr<<"Num Triangles: "<<numTriangles<<std::endl;
-
-    //1. Find split axis: can be either x,y or z axis
-    unsigned int splitDimension = 0;
-    unsigned int splitIndex = 0;
-    double minCosts = std::numeric_limits<double>::max();
+    void computeBounds(Range& range, bool bParallel) const
+    {
+        Bin total;
+        total.clear();
+        const auto accumulate = [&](size_t begin, size_t end, Bin& bin)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                const int p = mIndices[range.first + i];
+                bin.add(mBoundsMin[p], mBoundsMax[p], mCentroids[p]);
+            }
+        };
 
-    //compute total area
-    double totalArea = mNodes[rootNodeIndex].bbox.computeArea();
+        if (bParallel && range.count >= ParallelBinningSize)
+        {
+            std::mutex mutex;
+            Util::forEachChunk(size_t(range.count), ParallelBinningSize / 4, [&](size_t begin, size_t end)
+            {
+                Bin chunk;
+                chunk.clear();
+                accumulate(begin, end, chunk);
+                std::lock_guard<std::mutex> lock(mutex);
+                total.merge(chunk);
+            });
+        }
+        else
+        {
+            accumulate(0, size_t(range.count), total);
+        }
 
-    // The split heuristics requires the computation of costs
-    this->computeBoundingBoxAreas(offset, numTriangles);
+        range.bboxMin = total.bboxMin;
+        range.bboxMax = total.bboxMax;
+        range.centroidMin = total.centroidMin;
+        range.centroidMax = total.centroidMax;
+    }
 
-    //now evaluate costs for each split axis
-    for (unsigned int dim = 0; dim < 3; ++dim)
+    void binRange(const Range& range, const vec3& scale, const int numBins, bool bParallel, Bins& bins) const
     {
-        //evaluate costs
-        for (unsigned int i = 0; i < numTriangles - 1; ++i)
+        const auto accumulate = [&](size_t begin, size_t end, Bins& b)
         {
-            double leftArea = mTempAreasLeft[i + offset][dim];
-            double rightArea = mTempAreasRight[i + offset][dim];
-            double splitCosts =
-                (leftArea * (i + 1) + rightArea * (numTriangles - 1 - i)) / totalArea;
-            if (splitCosts < minCosts)
+            for (size_t i = begin; i < end; i++)
             {
-                minCosts = splitCosts;
-                splitDimension = dim;
-                splitIndex = i;
+                const int p = mIndices[range.first + i];
+                const vec3& c = mCentroids[p];
+                for (int axis(0); axis < 3; axis++)
+                {
+                    b[axis][getBin(c[axis], range.centroidMin[axis], scale[axis], numBins)].add(mBoundsMin[p], mBoundsMax[p], c);
+                }
             }
+        };
+
+        if (bParallel && range.count >= ParallelBinningSize)
+        {
+            std::mutex mutex;
+            Util::forEachChunk(size_t(range.count), ParallelBinningSize / 4, [&](size_t begin, size_t end)
+            {
+                auto chunk = std::make_unique<Bins>();
+                clear(*chunk, numBins);
+                accumulate(begin, end, *chunk);
+                std::lock_guard<std::mutex> lock(mutex);
+                for (int axis(0); axis < 3; axis++)
+                {
+                    for (int b(0); b < numBins; b++) bins[axis][b].merge((*chunk)[axis][b]);
+                }
+            });
+        }
+        else
+        {
+            accumulate(0, size_t(range.count), bins);
         }
     }
 
-    //  std::cerr<<"Split Costs: "<<minCosts<<std::endl;
-    //  std::cerr<<"Split Dimension: "<<splitDimension<<std::endl;
-    //  std::cerr<<"Split Index: "<<splitIndex<<std::endl;
-
-    //now mark the first i triangles as left, the remaining as right
-    for (unsigned int i = 0; i <= splitIndex; ++i)
-        mTempMarker[mTempSortedTriangleIndices[i + offset][splitDimension]] = true;//TODO debug here, maybe splitIndex is not compatible with offset?!
-    for (unsigned int i = splitIndex + 1; i < numTriangles; ++i)
-        mTempMarker[mTempSortedTriangleIndices[i + offset][splitDimension]] = false;
-    //  this->printSortedIndicesStatus(offset,numTriangles);
-
-    //the indices in the remaining two dimensions must be put into left, right order
-    // Copy to temporary buffer
-    unsigned int leftCount, rightCount;
-    for (unsigned int dim = 0; dim < 3; ++dim)
+    ///Splits a range into two. Returns false if the range should become a leaf.
+    bool split(const Range& range, bool bParallel, Range& left, Range& right)
     {
-        if (dim == splitDimension) continue;
-        leftCount = 0;
-        rightCount = 0;
-        for (unsigned int i = 0; i < numTriangles; ++i)
+        if (range.count <= 1) return false;
+
+        left.depth = range.depth + 1;
+        right.depth = range.depth + 1;
+
+        //Fall back to a median split where the tree would otherwise outgrow the traversal stack
+        const bool bForceMedian = (range.depth + int(std::ceil(std::log2(double(range.count)))) >= BVTree::MaxDepth - 1);
+
+        const vec3 extent = range.centroidMax - range.centroidMin;
+        if (!bForceMedian && glm::compMax(extent) > 0)
         {
-            if (mTempMarker[mTempSortedTriangleIndices[i + offset][dim]])
-                mTempBufferTriangleIndices[offset + leftCount++][dim] =
-                    mTempSortedTriangleIndices[i + offset][dim];
-            else
-                mTempBufferTriangleIndices[offset + numTriangles - (++rightCount)][dim] =
-                    mTempSortedTriangleIndices[i + offset][dim];
+            //Small ranges do not need the full resolution
+            const int numBins = std::min(mNumBins, std::max(4, range.count));
+            vec3 scale(0);
+            for (int axis(0); axis < 3; axis++)
+            {
+                if (extent[axis] > 0) scale[axis] = float(numBins) / extent[axis];
+            }
+
+            Bins bins;
+            clear(bins, numBins);
+            binRange(range, scale, numBins, bParallel, bins);
+
+            //Sweep over the bins from both sides to evaluate all split planes
+            int bestAxis(-1), bestSplit(-1);
+            float bestCost = std::numeric_limits<float>::infinity();
+            for (int axis(0); axis < 3; axis++)
+            {
+                if (extent[axis] <= 0) continue;
+
+                std::array<float, MaxBins> rightArea;
+                std::array<int, MaxBins> rightCount;
+                Bin accumulated;
+                accumulated.clear();
+                for (int b = numBins - 1; b > 0; b--)
+                {
+                    accumulated.merge(bins[axis][b]);
+                    rightArea[b] = computeArea(accumulated.bboxMin, accumulated.bboxMax);
+                    rightCount[b] = accumulated.count;
+                }
+
+                accumulated.clear();
+                for (int b = 0; b < numBins - 1; b++)
+                {
+                    accumulated.merge(bins[axis][b]);
+                    if (accumulated.count == 0 || rightCount[b + 1] == 0) continue;
+                    const float cost = computeArea(accumulated.bboxMin, accumulated.bboxMax) * accumulated.count +
+                                       rightArea[b + 1] * rightCount[b + 1];
+                    if (cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestSplit = b + 1;
+                    }
+                }
+            }
+
+            if (bestAxis >= 0)
+            {
+                //Compare with the cost of a leaf; traversal step and triangle test are assumed to cost the same
+                const float splitCost = 1.0f + bestCost / computeArea(range.bboxMin, range.bboxMax);
+                if (range.count <= mMaxLeafSize && splitCost >= float(range.count)) return false;
+
+                //Partition the primitives and gather the child bounds from the bins
+                const float centroidMin = range.centroidMin[bestAxis];
+                const float axisScale = scale[bestAxis];
+                int* const begin = mIndices.data() + range.first;
+                int* const middle = std::partition(begin, begin + range.count, [&](const int p)
+                {
+                    return getBin(mCentroids[p][bestAxis], centroidMin, axisScale, numBins) < bestSplit;
+                });
+
+                Bin leftBin, rightBin;
+                leftBin.clear();
+                rightBin.clear();
+                for (int b = 0; b < bestSplit; b++) leftBin.merge(bins[bestAxis][b]);
+                for (int b = bestSplit; b < numBins; b++) rightBin.merge(bins[bestAxis][b]);
+                setRange(left, range.first, int(middle - begin), leftBin);
+                setRange(right, left.first + left.count, range.count - left.count, rightBin);
+                return true;
+            }
         }
+
+        //All centroids coincide (or the depth is exhausted): split in the middle of the list
+        if (!bForceMedian && range.count <= mMaxLeafSize) return false;
+
+        int axis = 0;
+        if (extent[1] > extent[axis]) axis = 1;
+        if (extent[2] > extent[axis]) axis = 2;
+        int* const begin = mIndices.data() + range.first;
+        const int half = range.count / 2;
+        std::nth_element(begin, begin + half, begin + range.count, [&](const int a, const int b)
+        {
+            return mCentroids[a][axis] < mCentroids[b][axis];
+        });
+
+        left.first = range.first;
+        left.count = half;
+        right.first = range.first + half;
+        right.count = range.count - half;
+        computeBounds(left, bParallel);
+        computeBounds(right, bParallel);
+        return true;
     }
 
-    // Copy from temp buffer into workspace array
-    for (unsigned int dim = 0; dim < 3; ++dim)
+    static void setRange(Range& range, int first, int count, const Bin& bin)
     {
-        if (dim == splitDimension) continue;
-        for (unsigned int i = 0; i < leftCount; ++i)
-            mTempSortedTriangleIndices[i + offset][dim] =
-                mTempBufferTriangleIndices[offset + i][dim];
-        for (unsigned int i = 0; i < rightCount; ++i)
-            mTempSortedTriangleIndices[offset + leftCount + i][dim] =
-                mTempBufferTriangleIndices[offset + numTriangles - 1 - i][dim];
+        range.first = first;
+        range.count = count;
+        range.bboxMin = bin.bboxMin;
+        range.bboxMax = bin.bboxMax;
+        range.centroidMin = bin.centroidMin;
+        range.centroidMax = bin.centroidMax;
     }
 
-    //  this->printSortedIndicesStatus(offset,numTriangles);
-
-    //create nodes and prepare for recursive call
-    Node nodeLeft;
-    BoundingBox leftBox;
-    for (unsigned int i = 0; i <= splitIndex; ++i)
-        leftBox.merge(mTempTriangleBoxes[mTempSortedTriangleIndices[i + offset][splitDimension]]);
-    nodeLeft.bbox = leftBox;
-    mNodes.push_back(nodeLeft);
-    unsigned idxLeft = unsigned(mNodes.size()) - 1;
-    mNodes[rootNodeIndex].left = int(idxLeft);
-
-
-    Node nodeRight;
-    BoundingBox rightBox;
-    for (unsigned int i = splitIndex + 1; i < numTriangles; ++i)
-        rightBox.merge(mTempTriangleBoxes[mTempSortedTriangleIndices[i + offset][splitDimension]]);
-    nodeRight.bbox = rightBox;
-    mNodes.push_back(nodeRight);
-    unsigned idxRight = unsigned(mNodes.size()) - 1;
-    mNodes[rootNodeIndex].right = int(idxRight);
-
-    if (splitIndex == 0)//left count == 1  -> left child is a leaf
+    ///Builds the subtree of a range in depth-first order. The left child directly follows its parent.
+    void buildSubtree(const Range& range, std::vector<Node>& nodes)
     {
-        mNodes[idxLeft].left = -mTempSortedTriangleIndices[0 + offset][splitDimension];
-        mNodes[idxLeft].right = -1;
+        const int nodeIndex = int(nodes.size());
+        Node node;
+        node.bboxMin = range.bboxMin;
+        node.bboxMax = range.bboxMax;
+        node.rightOrFirst = range.first;
+        node.numPrimitives = range.count;
+        nodes.push_back(node);
+
+        Range left, right;
+        if (!split(range, false, left, right)) return;
+
+        nodes[nodeIndex].numPrimitives = 0;
+        buildSubtree(left, nodes);
+        nodes[nodeIndex].rightOrFirst = int(nodes.size());
+        buildSubtree(right, nodes);
     }
-    else
-        this->buildHierarchy(idxLeft, offset, splitIndex + 1);
 
-    if (splitIndex == numTriangles - 2)//right count == 1 -> right child is a leaf
+    void appendTopNode(const std::vector<TopNode>& topNodes, int current,
+                       const std::vector<std::vector<Node>>& subtrees, std::vector<Node>& nodes) const
     {
-        mNodes[idxRight].left =
-            -mTempSortedTriangleIndices[numTriangles + offset - 1][splitDimension];
-        mNodes[idxRight].right = -1;
+        const TopNode& top = topNodes[current];
+        if (top.subtree >= 0)
+        {
+            //Copy the subtree, shifting its child references
+            const int offset = int(nodes.size());
+            for (Node node : subtrees[top.subtree])
+            {
+                if (!node.isLeaf()) node.rightOrFirst += offset;
+                nodes.push_back(node);
+            }
+            return;
+        }
+
+        const int nodeIndex = int(nodes.size());
+        Node node;
+        node.bboxMin = top.range.bboxMin;
+        node.bboxMax = top.range.bboxMax;
+        node.rightOrFirst = 0;
+        node.numPrimitives = 0;
+        nodes.push_back(node);
+
+        appendTopNode(topNodes, top.left, subtrees, nodes);
+        nodes[nodeIndex].rightOrFirst = int(nodes.size());
+        appendTopNode(topNodes, top.right, subtrees, nodes);
     }
-    else
+
+    const int mMaxLeafSize;
+    const int mNumBins;
+    const std::vector<vec3>& mBoundsMin;
+    const std::vector<vec3>& mBoundsMax;
+    std::vector<int>& mIndices;
+    std::vector<vec3> mCentroids;
+};
+
+}
+
+
+BVTree::BVTree()
+    : mNumLeaves(0)
+    , mBuildTime(0)
+    , mSAHCost(0)
+{
+    static_assert(sizeof(Node) == 32, "BVTree::Node is expected to be 32 bytes");
+}
+
+void BVTree::build(const std::vector<dvec3>& vertexPositions,
+                   const std::vector<ivec3>& triangleIndices,
+                   const BuildSettings& settings)
+{
+    build(triangleIndices.size(), [&](size_t i, dvec3& v0, dvec3& v1, dvec3& v2)
+    {
+        v0 = vertexPositions[triangleIndices[i][0]];
+        v1 = vertexPositions[triangleIndices[i][1]];
+        v2 = vertexPositions[triangleIndices[i][2]];
+    }, settings);
+}
+
+void BVTree::build(const size_t numTriangles,
+                   const std::function<void(size_t, dvec3&, dvec3&, dvec3&)>& corners,
+                   const BuildSettings& settings)
+{
+    PerformanceTimer timer;
+
+    //create conservative bounding boxes for all triangles
+    const size_t n = numTriangles;
+    std::vector<vec3> boundsMin(n);
+    std::vector<vec3> boundsMax(n);
+    Util::forEachChunk(n, BinnedSAHBuilder::ParallelBinningSize, [&](size_t begin, size_t end)
     {
-        unsigned int offsetNew = offset + splitIndex + 1;
-        this->buildHierarchy(idxRight, offsetNew, numTriangles - 1 - splitIndex);
+        dvec3 v0, v1, v2;
+        for (size_t i = begin; i < end; ++i)
+        {
+            corners(i, v0, v1, v2);
+            boundsMin[i] = roundDown(glm::min(v0, glm::min(v1, v2)));
+            boundsMax[i] = roundUp(glm::max(v0, glm::max(v1, v2)));
+        }
+    });
+
+    buildFromBounds(boundsMin, boundsMax, settings);
+    mBuildTime = timer.ElapsedTime();
+}
+
+void BVTree::build(const std::vector<BoundingBox>& boxes, const BuildSettings& settings)
+{
+    PerformanceTimer timer;
+
+    std::vector<vec3> boundsMin(boxes.size());
+    std::vector<vec3> boundsMax(boxes.size());
+    for (size_t i(0); i < boxes.size(); i++)
+    {
+        boundsMin[i] = roundDown(boxes[i].min());
+        boundsMax[i] = roundUp(boxes[i].max());
     }
+
+    buildFromBounds(boundsMin, boundsMax, settings);
+    mBuildTime = timer.ElapsedTime();
 }
 
-void BVTree::computeBoundingBoxAreas(unsigned int offset, unsigned int numTriangles)
+void BVTree::buildFromBounds(const std::vector<vec3>& boundsMin, const std::vector<vec3>& boundsMax,
+                             const BuildSettings& settings)
 {
-    //Left areas
-    for (unsigned int dim = 0; dim < 3; ++dim)
+    BinnedSAHBuilder builder(settings, boundsMin, boundsMax, mPrimitiveIndices);
+    builder.build(mNodes);
+
+    //Statistics
+    mNumLeaves = 0;
+    mSAHCost = 0;
+    if (!mNodes.empty())
     {
-        BoundingBox boxLeft;
-        for (unsigned int i = offset; i < numTriangles + offset; ++i)
+        const double rootArea = std::max(double(computeArea(mNodes[0].bboxMin, mNodes[0].bboxMax)),
+                                         std::numeric_limits<double>::min());
+        for (const Node& node : mNodes)
         {
-            boxLeft.merge(
-                mTempTriangleBoxes[mTempSortedTriangleIndices[i][dim]]);//expand from left to right
-            mTempAreasLeft[i][dim] = boxLeft.computeArea();
+            const double relativeArea = computeArea(node.bboxMin, node.bboxMax) / rootArea;
+            if (node.isLeaf())
+            {
+                mNumLeaves++;
+                mSAHCost += relativeArea * node.numPrimitives;
+            }
+            else
+            {
+                mSAHCost += relativeArea;
+            }
         }
     }
+}
+
+void BVTree::write(std::ostream& out) const
+{
+    const uint64_t Sizes[3] = {mNodes.size(), mPrimitiveIndices.size(), mNumLeaves};
+    out.write(reinterpret_cast<const char*>(Sizes), sizeof(Sizes));
+    out.write(reinterpret_cast<const char*>(&mSAHCost), sizeof(mSAHCost));
+    out.write(reinterpret_cast<const char*>(mNodes.data()), std::streamsize(mNodes.size() * sizeof(Node)));
+    out.write(reinterpret_cast<const char*>(mPrimitiveIndices.data()),
+              std::streamsize(mPrimitiveIndices.size() * sizeof(int)));
+}
 
-    //Right areas
-    for (unsigned int dim = 0; dim < 3; ++dim)
+bool BVTree::read(std::istream& in, const size_t numPrimitives)
+{
+    PerformanceTimer timer;
+    mNodes.clear();
+    mPrimitiveIndices.clear();
+    mNumLeaves = 0;
+    mSAHCost = 0;
+
+    uint64_t Sizes[3];
+    double SAHCost;
+    if (!in.read(reinterpret_cast<char*>(Sizes), sizeof(Sizes))) return false;
+    if (!in.read(reinterpret_cast<char*>(&SAHCost), sizeof(SAHCost))) return false;
+    if (Sizes[1] != numPrimitives || Sizes[0] > 2 * numPrimitives || (Sizes[0] == 0) != (numPrimitives == 0)) return false;
+
+    std::vector<Node> Nodes(Sizes[0]);
+    std::vector<int> Indices(Sizes[1]);
+    if (!in.read(reinterpret_cast<char*>(Nodes.data()), std::streamsize(Nodes.size() * sizeof(Node)))) return false;
+    if (!in.read(reinterpret_cast<char*>(Indices.data()), std::streamsize(Indices.size() * sizeof(int)))) return false;
+
+    //Nodes come in depth-first order, so the depth of both children is known when reaching their parent
+    std::vector<int> Depth(Nodes.size(), 0);
+    for (size_t i(0); i < Nodes.size(); i++)
     {
-        BoundingBox boxRight;
-        for (unsigned int i = numTriangles + offset - 1; i > offset; --i)
+        const Node& node = Nodes[i];
+        if (node.isLeaf())
         {
-            boxRight.merge(
-                mTempTriangleBoxes[mTempSortedTriangleIndices[i][dim]]);//expand from left to right
-            mTempAreasRight[i - 1][dim] = boxRight.computeArea();
+            if (node.rightOrFirst < 0 || uint64_t(node.rightOrFirst) + node.numPrimitives > Indices.size()) return false;
+        }
+        else
+        {
+            if (node.numPrimitives < 0 || node.rightOrFirst <= int64_t(i) + 1
+                || uint64_t(node.rightOrFirst) >= Nodes.size() || Depth[i] + 1 >= MaxDepth)
+            {
+                return false;
+            }
+            Depth[i + 1] = Depth[i] + 1;
+            Depth[node.rightOrFirst] = Depth[i] + 1;
         }
     }
+    for (const int index : Indices)
+    {
+        if (index < 0 || size_t(index) >= numPrimitives) return false;
+    }
+
+    mNodes.swap(Nodes);
+    mPrimitiveIndices.swap(Indices);
+    mNumLeaves = size_t(Sizes[2]);
+    mSAHCost = SAHCost;
+    mBuildTime = timer.ElapsedTime();
+    return true;
 }
+
 }//namespace inviwo
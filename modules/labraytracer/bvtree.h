@@ -3,9 +3,12 @@
 #include <labraytracer/labraytracermoduledefine.h>
 #include <inviwo/core/common/inviwo.h>
 #include <labraytracer/boundingbox.h>
+#include <labraytracer/raypacket.h>
 
+#include <functional>
+#include <iosfwd>
 #include <vector>
-#include <stack>
+#include <cstdint>
 
 namespace inviwo
 {
@@ -13,45 +16,344 @@ namespace inviwo
 class IVW_MODULE_LABRAYTRACER_API BVTree
 {
 public:
+    /**
+     * Flattened node, 32 bytes. Nodes are stored in depth-first order,
+     * so the left child of an inner node is always the next node in the array.
+     * The bounding box is stored in single precision and rounded outwards.
+     */
+    struct alignas(32) Node
+    {
+        vec3 bboxMin;
+        ///Inner node: index of the right child. Leaf: offset into the primitive index list.
+        int32_t rightOrFirst;
+        vec3 bboxMax;
+        ///Leaf: number of triangles. Inner node: 0.
+        int32_t numPrimitives;
+
+        bool isLeaf() const { return numPrimitives > 0; }
+    };
+
+    ///Parameters of the binned SAH builder
+    struct BuildSettings
+    {
+        BuildSettings()
+            : maxLeafSize(4)
+            , numBins(16)
+        {
+        }
+
+        ///Leaves hold at most this many triangles
+        int maxLeafSize;
+        ///Number of bins per axis for evaluating split candidates
+        int numBins;
+    };
+
+    ///Maximum depth of the tree, and thereby the size of the traversal stack.
+    static constexpr int MaxDepth = 64;
+
     BVTree();
 
     //build from indexed triangle set
     void build(const std::vector<dvec3>& vertexPositions,
-               const std::vector<ivec3>& triangleIndices);
+               const std::vector<ivec3>& triangleIndices,
+               const BuildSettings& settings = BuildSettings());
+
+    //build from triangles given by their corners; corners(i, v0, v1, v2) returns those of triangle i
+    //and may be called from several threads at once
+    void build(const size_t numTriangles,
+               const std::function<void(size_t, dvec3&, dvec3&, dvec3&)>& corners,
+               const BuildSettings& settings = BuildSettings());
+
+    //build from a set of boxes, e.g. the bounds of the objects in a scene
+    void build(const std::vector<BoundingBox>& boxes, const BuildSettings& settings = BuildSettings());
+
+    ///Writes the nodes, the primitive index list and the statistics in binary form
+    void write(std::ostream& out) const;
+
+    /**
+     * Reads a tree written by write() for numPrimitives primitives. Checks that all nodes and
+     * indices are in range and that the tree is not deeper than MaxDepth. Returns false and
+     * leaves the tree empty otherwise.
+     */
+    bool read(std::istream& in, const size_t numPrimitives);
+
+    ///Default node callback of traverse(); compiles to nothing
+    struct IgnoreNode
+    {
+        void operator()(int) const {}
+    };
 
-    //returns a set of triangle indices as candidates for ray-triangle intersection
-    const std::vector<int>& intersectBoundingBoxes(const Ray& ray, const double maxLambda) const;
+    /**
+     * Traverses the tree front to back and calls intersectTriangle(triangleIndex, maxLambda)
+     * for every triangle in a leaf whose box is hit by the ray within maxLambda.
+     * The callback may shrink maxLambda to cull farther nodes.
+     * Traversal stops once the callback returns true; the function then returns true as well.
+     * visitNode(nodeIndex) is called for every node that is entered, e.g. for statistics.
+     */
+    template <typename IntersectTriangle, typename VisitNode = IgnoreNode>
+    bool traverse(const Ray& ray, double& maxLambda, IntersectTriangle&& intersectTriangle,
+                  VisitNode&& visitNode = VisitNode()) const;
+
+    /**
+     * Traverses the tree once for the rays of a packet in activeMask. A node is visited if any
+     * of these rays hits its box within its entry in maxLambda. For every triangle in a leaf,
+     * intersectTriangle(triangleIndex, laneMask) is called with the rays that hit the leaf box.
+     * The callback may shrink their maxLambda entries, and returns a mask of rays that are done,
+     * e.g. because they are occluded. Traversal stops once no rays are left.
+     */
+    template <typename IntersectTriangle>
+    void traversePacket(const RayPacket8& packet, int activeMask, const double* maxLambda,
+                        IntersectTriangle&& intersectTriangle) const;
+
+    const std::vector<Node>& getNodes() const { return mNodes; }
+    ///Triangle indices in leaf order
+    const std::vector<int>& getPrimitiveIndices() const { return mPrimitiveIndices; }
+    size_t getNumNodes() const { return mNodes.size(); }
+    size_t getNumLeaves() const { return mNumLeaves; }
+    static constexpr size_t getBytesPerNode() { return sizeof(Node); }
+    ///Memory used by the nodes and the primitive index list in bytes
+    size_t getMemoryUsage() const
+    {
+        return mNodes.size() * sizeof(Node) + mPrimitiveIndices.size() * sizeof(int);
+    }
+    ///Wall-clock time of the last build in seconds
+    double getBuildTime() const { return mBuildTime; }
+    ///Surface area heuristic cost of the tree, relative to the root box
+    double getSAHCost() const { return mSAHCost; }
 
 private:
-    struct Node
+    void buildFromBounds(const std::vector<vec3>& boundsMin, const std::vector<vec3>& boundsMax,
+                         const BuildSettings& settings);
+
+    ///Slab test of a ray against the box of a node. Returns the entry distance in tEntry.
+    static bool intersectNode(const Node& node, const vec3& origin, const vec3& invDirection,
+                              const float maxLambda, float& tEntry);
+
+    ///Slab test of the rays of a packet in mask against the box of a node. Returns the mask of
+    ///rays hitting the box, and their smallest entry distance in tEntry.
+    static int intersectNode(const Node& node, const RayPacket8& packet, const double* maxLambda,
+                             const int mask, float& tEntry);
+
+    std::vector<Node> mNodes;
+    ///Triangle indices in leaf order. Leaves reference ranges in this list.
+    std::vector<int> mPrimitiveIndices;
+    size_t mNumLeaves;
+    double mBuildTime;
+    double mSAHCost;
+};
+
+
+inline bool BVTree::intersectNode(const Node& node, const vec3& origin, const vec3& invDirection,
+                                  const float maxLambda, float& tEntry)
+{
+    //Zero direction components yield infinite inverse directions.
+    //The resulting NaNs are dropped by the min/max argument order below.
+    float tNear = 0.0f;
+    float tFar = maxLambda;
+    for (int i = 0; i < 3; i++)
+    {
+        const float t0 = (node.bboxMin[i] - origin[i]) * invDirection[i];
+        const float t1 = (node.bboxMax[i] - origin[i]) * invDirection[i];
+        tNear = std::max(tNear, std::min(t0, t1));
+        tFar = std::min(tFar, std::max(t0, t1));
+    }
+
+    tEntry = tNear;
+    return tNear <= tFar;
+}
+
+
+inline int BVTree::intersectNode(const Node& node, const RayPacket8& packet, const double* maxLambda,
+                                 const int mask, float& tEntry)
+{
+    //All lanes at once without branches, so that the loops are vectorized; the mask is applied afterwards
+    float tNear[RayPacket8::Size];
+    float tFar[RayPacket8::Size];
+    for (int lane = 0; lane < RayPacket8::Size; lane++)
+    {
+        tNear[lane] = 0.0f;
+        tFar[lane] = float(maxLambda[lane]);
+    }
+    for (int i = 0; i < 3; i++)
     {
-        Node()
+        for (int lane = 0; lane < RayPacket8::Size; lane++)
         {
-            left = 0;
-            right = 0;
+            const float t0 = (node.bboxMin[i] - packet.origin[i][lane]) * packet.invDirection[i][lane];
+            const float t1 = (node.bboxMax[i] - packet.origin[i][lane]) * packet.invDirection[i][lane];
+            tNear[lane] = std::max(tNear[lane], std::min(t0, t1));
+            tFar[lane] = std::min(tFar[lane], std::max(t0, t1));
         }
-        int left;
-        int right;
-        BoundingBox bbox;
+    }
+
+    int hitMask = 0;
+    tEntry = std::numeric_limits<float>::infinity();
+    for (int lane = 0; lane < RayPacket8::Size; lane++)
+    {
+        if ((mask & (1 << lane)) && tNear[lane] <= tFar[lane])
+        {
+            hitMask |= (1 << lane);
+            tEntry = std::min(tEntry, tNear[lane]);
+        }
+    }
+    return hitMask;
+}
+
+
+template <typename IntersectTriangle, typename VisitNode>
+bool BVTree::traverse(const Ray& ray, double& maxLambda, IntersectTriangle&& intersectTriangle,
+                      VisitNode&& visitNode) const
+{
+    if (mNodes.empty()) return false;
+
+    const dvec3& direction = ray.getDirection();
+    const vec3 origin(ray.getOrigin());
+    const vec3 invDirection(float(1.0 / direction[0]), float(1.0 / direction[1]), float(1.0 / direction[2]));
+
+    //Fixed-size stack; the builder guarantees that the tree is not deeper than this.
+    struct StackEntry
+    {
+        int node;
+        float tEntry;
     };
-    void sortTriangles();
-    void createNodes(const std::vector<dvec3>& vertexPositions,
-                     const std::vector<ivec3>& triangleIndices);
+    StackEntry stack[MaxDepth];
+    int stackSize = 0;
 
-    void printSortedIndicesStatus(unsigned int offset, unsigned int numTriangles);
-    void buildHierarchy(unsigned int rootNodeIndex, unsigned int numTriangles, unsigned int offset);
+    float tEntry;
+    if (!intersectNode(mNodes[0], origin, invDirection, float(maxLambda), tEntry)) return false;
 
-    void computeBoundingBoxAreas(unsigned int offset, unsigned int numTriangles);
+    int nodeIndex = 0;
+    while (true)
+    {
+        visitNode(nodeIndex);
+        const Node& node = mNodes[nodeIndex];
+        if (node.isLeaf())
+        {
+            //Intersect the triangles in place
+            const int last = node.rightOrFirst + node.numPrimitives;
+            for (int i = node.rightOrFirst; i < last; i++)
+            {
+                if (intersectTriangle(mPrimitiveIndices[i], maxLambda)) return true;
+            }
+        }
+        else
+        {
+            //Visit the nearer child first, remember the farther one
+            int nearChild = nodeIndex + 1;
+            int farChild = node.rightOrFirst;
+            float tNear, tFar;
+            const bool bHitNear = intersectNode(mNodes[nearChild], origin, invDirection, float(maxLambda), tNear);
+            const bool bHitFar = intersectNode(mNodes[farChild], origin, invDirection, float(maxLambda), tFar);
+            if (bHitNear && bHitFar)
+            {
+                if (tFar < tNear)
+                {
+                    std::swap(nearChild, farChild);
+                    std::swap(tNear, tFar);
+                }
+                stack[stackSize++] = {farChild, tFar};
+                nodeIndex = nearChild;
+                continue;
+            }
+            if (bHitNear)
+            {
+                nodeIndex = nearChild;
+                continue;
+            }
+            if (bHitFar)
+            {
+                nodeIndex = farChild;
+                continue;
+            }
+        }
 
-    std::vector<Node> mNodes;
+        //Pop the next node, skipping those that start behind the closest hit found so far
+        do
+        {
+            if (stackSize == 0) return false;
+            --stackSize;
+        } while (stack[stackSize].tEntry > maxLambda);
+        nodeIndex = stack[stackSize].node;
+    }
+}
+
+
+template <typename IntersectTriangle>
+void BVTree::traversePacket(const RayPacket8& packet, int activeMask, const double* maxLambda,
+                            IntersectTriangle&& intersectTriangle) const
+{
+    if (mNodes.empty()) return;
+
+    //Like traverse(), but every entry carries the rays that hit the node
+    struct StackEntry
+    {
+        int node;
+        int mask;
+    };
+    StackEntry stack[MaxDepth];
+    int stackSize = 0;
+
+    float tEntry;
+    int nodeIndex = 0;
+    int mask = intersectNode(mNodes[0], packet, maxLambda, activeMask, tEntry);
+    if (mask == 0) return;
+
+    while (true)
+    {
+        const Node& node = mNodes[nodeIndex];
+        if (node.isLeaf())
+        {
+            //Intersect the triangles in place; rays that are done leave the packet
+            const int last = node.rightOrFirst + node.numPrimitives;
+            for (int i = node.rightOrFirst; i < last && mask; i++)
+            {
+                activeMask &= ~intersectTriangle(mPrimitiveIndices[i], mask);
+                if (activeMask == 0) return;
+                mask &= activeMask;
+            }
+        }
+        else
+        {
+            //Visit the child that the rays enter first, remember the other one
+            int nearChild = nodeIndex + 1;
+            int farChild = node.rightOrFirst;
+            float tNear, tFar;
+            int nearMask = intersectNode(mNodes[nearChild], packet, maxLambda, mask, tNear);
+            int farMask = intersectNode(mNodes[farChild], packet, maxLambda, mask, tFar);
+            if (nearMask && farMask)
+            {
+                if (tFar < tNear)
+                {
+                    std::swap(nearChild, farChild);
+                    std::swap(nearMask, farMask);
+                }
+                stack[stackSize++] = {farChild, farMask};
+                nodeIndex = nearChild;
+                mask = nearMask;
+                continue;
+            }
+            if (nearMask)
+            {
+                nodeIndex = nearChild;
+                mask = nearMask;
+                continue;
+            }
+            if (farMask)
+            {
+                nodeIndex = farChild;
+                mask = farMask;
+                continue;
+            }
+        }
+
+        //Pop the next node. Its rays may have found closer hits or finished meanwhile, so test it again.
+        do
+        {
+            if (stackSize == 0) return;
+            --stackSize;
+            nodeIndex = stack[stackSize].node;
+            mask = intersectNode(mNodes[nodeIndex], packet, maxLambda, stack[stackSize].mask & activeMask, tEntry);
+        } while (mask == 0);
+    }
+}
 
-    std::vector<bool> mTempMarker;
-    std::vector<BoundingBox> mTempTriangleBoxes;
-    std::vector<ivec3> mTempSortedTriangleIndices;
-    std::vector<ivec3> mTempBufferTriangleIndices;
-    std::vector<dvec3> mTempAreasLeft;
-    std::vector<dvec3> mTempAreasRight;
-    mutable std::vector<std::vector<int>> mTempCandidates;
-    mutable std::vector<std::stack<int>> mTempTraversalJobs;
-};
 }
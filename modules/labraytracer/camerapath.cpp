@@ -0,0 +1,113 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 08:31:03
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include <labraytracer/camerapath.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace inviwo
+{
+
+CameraPath CameraPath::turntable(const Camera& start, const size_t numFrames, const bool bSwing)
+{
+    CameraPath path;
+    const dvec3 initialDir = start.lookFrom - start.lookTo;
+    for (size_t i(0); i < numFrames; i++)
+    {
+        const double t = (numFrames > 1) ? double(i) / double(numFrames - 1) : 0.0;
+        const double rotateBy = 2 * M_PI * t;
+        const double swingBy = bSwing ? 3.0 / 4.0 + cos(4 * M_PI * t) / 4 : 1.0;
+
+        Camera camera = start;
+        camera.lookFrom = start.lookTo + swingBy * glm::rotate(initialDir, rotateBy, start.lookUp);
+        path.addKeyframe(i, camera);
+    }
+    return path;
+}
+
+void CameraPath::addKeyframe(const size_t frame, const Camera& camera)
+{
+    keyframes_.emplace_back(frame, camera);
+}
+
+bool CameraPath::load(const std::string& filename)
+{
+    std::ifstream file(filename);
+    if (!file) return false;
+
+    keyframes_.clear();
+    std::string line;
+    size_t lineNumber(0);
+    while (std::getline(file, line))
+    {
+        lineNumber++;
+        std::istringstream words(line);
+        std::string first;
+        if (!(words >> first) || first[0] == '#') continue;
+
+        //The whole first word must be the frame; a sign would wrap around in size_t
+        size_t frame;
+        std::istringstream frameWord(first);
+        if (first[0] == '-' || first[0] == '+' || !(frameWord >> frame) || !frameWord.eof())
+        {
+            LogWarn(filename << ":" << lineNumber << ": expected a frame number instead of '" << first << "'.");
+            return false;
+        }
+
+        Camera camera;
+        words >> camera.lookFrom.x >> camera.lookFrom.y >> camera.lookFrom.z
+              >> camera.lookTo.x >> camera.lookTo.y >> camera.lookTo.z
+              >> camera.lookUp.x >> camera.lookUp.y >> camera.lookUp.z
+              >> camera.fovy;
+        if (!words)
+        {
+            LogWarn(filename << ":" << lineNumber << ": expected ten numbers for the camera after the frame.");
+            return false;
+        }
+        if (!keyframes_.empty() && frame <= keyframes_.back().first)
+        {
+            LogWarn(filename << ":" << lineNumber << ": frame " << frame << " does not come after frame "
+                             << keyframes_.back().first << ".");
+            return false;
+        }
+        addKeyframe(frame, camera);
+    }
+    return !keyframes_.empty();
+}
+
+size_t CameraPath::getNumFrames() const
+{
+    return keyframes_.empty() ? 0 : keyframes_.back().first + 1;
+}
+
+CameraPath::Camera CameraPath::getCamera(const size_t frame) const
+{
+    //First keyframe after the frame
+    auto next = std::upper_bound(keyframes_.begin(), keyframes_.end(), frame,
+                                 [](const size_t f, const std::pair<size_t, Camera>& keyframe)
+                                 { return f < keyframe.first; });
+    if (next == keyframes_.begin()) return next->second;
+    auto previous = next - 1;
+    if (next == keyframes_.end() || previous->first == frame) return previous->second;
+
+    const double t = double(frame - previous->first) / double(next->first - previous->first);
+    const Camera& a = previous->second;
+    const Camera& b = next->second;
+    Camera camera;
+    camera.lookFrom = glm::mix(a.lookFrom, b.lookFrom, t);
+    camera.lookTo = glm::mix(a.lookTo, b.lookTo, t);
+    camera.lookUp = glm::mix(a.lookUp, b.lookUp, t);
+    camera.fovy = glm::mix(a.fovy, b.fovy, t);
+    return camera;
+}
+
+}// namespace inviwo
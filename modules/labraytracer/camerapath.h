@@ -0,0 +1,74 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 08:31:03
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <labraytracer/labraytracermoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace inviwo
+{
+
+/** \class CameraPath
+    \brief Camera for every frame of an animation
+
+    The path is given by keyframes; the frames in between are interpolated linearly.
+*/
+class IVW_MODULE_LABRAYTRACER_API CameraPath
+{
+//Types
+public:
+    struct Camera
+    {
+        dvec3 lookFrom;
+        dvec3 lookTo;
+        dvec3 lookUp;
+        ///Vertical field of view in degrees
+        double fovy;
+    };
+
+//Construction / Deconstruction
+public:
+    CameraPath() = default;
+    virtual ~CameraPath() = default;
+
+    /** Rotates the camera once around its look-to point and its up vector.
+        With bSwing, the distance to the look-to point oscillates between 1/2 and 1 of the initial distance.
+    */
+    static CameraPath turntable(const Camera& start, const size_t numFrames, const bool bSwing);
+
+//Methods
+public:
+    ///Keyframes need to be added in increasing order of their frames
+    void addKeyframe(const size_t frame, const Camera& camera);
+
+    /** Reads keyframes from a text file with one keyframe per line:
+        frame lookFrom.x lookFrom.y lookFrom.z lookTo.x lookTo.y lookTo.z lookUp.x lookUp.y lookUp.z fovy
+        Empty lines and lines starting with # are skipped.
+        @returns false if the file cannot be read or a line is malformed; a malformed line is logged.
+    */
+    bool load(const std::string& filename);
+
+    ///Frames from 0 up to the last keyframe
+    size_t getNumFrames() const;
+
+    Camera getCamera(const size_t frame) const;
+
+//Attributes
+private:
+    ///Keyframes sorted by frame
+    std::vector<std::pair<size_t, Camera>> keyframes_;
+};
+
+}// namespace inviwo
@@ -42,6 +42,15 @@ public:
     dvec4 shade(const RayIntersection& intersection, const Light& light) const override;
     dvec4 shadeAmbient(const RayIntersection& intersection, const Light& light) const override;
 
+    const dvec3& getAlbedo() const
+    {return albedo_;}
+
+    double getRoughness() const
+    {return roughness_;}
+
+    double getRefraction() const
+    {return refraction_;}
+
 //Attributes
 protected:
     dvec3 albedo_;
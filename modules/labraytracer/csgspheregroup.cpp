@@ -13,3 +13,291 @@
 #include <labraytracer/util.h>
 
 
+#include <labraytracer/rayintersection.h>
+
+#include <algorithm>
+#include <numeric>
+
+namespace inviwo
+{
+
+namespace
+{
+using Ball = CSGSphereGroup::Ball;
+using Span = CSGSphereGroup::Span;
+
+///Spans of the rays of one thread; grows with the largest group, never per ray
+struct SpanArena
+{
+    std::vector<Span> added;
+    std::vector<Span> subtracted;
+};
+thread_local SpanArena Arena;
+
+///Parameters of the ray where it enters and leaves the ball
+bool intersectBall(const Ray& ray, const Ball& ball, double& enter, double& leave)
+{
+    return Util::intersectRaySphereSpan(ray.getOrigin(), ray.getDirection(), ball.center,
+                                        ball.radius * ball.radius, enter, leave);
+}
+
+///Sorts the spans and merges the overlapping ones in place; returns the number of merged spans
+size_t mergeSpans(Span* spans, const size_t numSpans)
+{
+    std::sort(spans, spans + numSpans, [](const Span& a, const Span& b) { return a.start < b.start; });
+
+    size_t NumMerged(0);
+    for (size_t i(0); i < numSpans; i++)
+    {
+        if (NumMerged > 0 && spans[i].start <= spans[NumMerged - 1].end)
+        {
+            Span& Last = spans[NumMerged - 1];
+            if (spans[i].end > Last.end)
+            {
+                Last.end = spans[i].end;
+                Last.endOperand = spans[i].endOperand;
+            }
+            continue;
+        }
+        spans[NumMerged++] = spans[i];
+    }
+    return NumMerged;
+}
+
+///Whether a piece of the solid has a boundary ahead of the ray origin; the closer one if both are
+bool boundaryAhead(const Span& piece, double& lambda, uint32_t& operand)
+{
+    if (piece.start >= piece.end) return false;
+    if (piece.start > 0)
+    {
+        lambda = piece.start;
+        operand = piece.startOperand;
+        return true;
+    }
+    if (piece.end > 0)
+    {
+        lambda = piece.end;
+        operand = piece.endOperand;
+        return true;
+    }
+    return false;
+}
+}
+
+void CSGSphereGroup::SphereHierarchy::build(const std::vector<Ball>& balls)
+{
+    clear();
+    if (balls.empty()) return;
+
+    mIndices.resize(balls.size());
+    std::iota(mIndices.begin(), mIndices.end(), 0);
+    mNodes.reserve(2 * (balls.size() / MaxLeafSize + 1));
+    buildNode(balls, 0, uint32_t(balls.size()));
+}
+
+void CSGSphereGroup::SphereHierarchy::clear()
+{
+    mNodes.clear();
+    mIndices.clear();
+}
+
+uint32_t CSGSphereGroup::SphereHierarchy::buildNode(const std::vector<Ball>& balls, const uint32_t first,
+                                                    const uint32_t count)
+{
+    //Bounding sphere around the center of the box of the balls
+    BoundingBox Box;
+    BoundingBox CenterBox;
+    for (uint32_t i(first); i < first + count; i++)
+    {
+        const Ball& B = balls[mIndices[i]];
+        Box.merge(BoundingBox(B.center - dvec3(B.radius), B.center + dvec3(B.radius)));
+        CenterBox.expandByPoint(B.center);
+    }
+    Node NewNode;
+    NewNode.bounds.center = 0.5 * (Box.min() + Box.max());
+    NewNode.bounds.radius = 0;
+    for (uint32_t i(first); i < first + count; i++)
+    {
+        const Ball& B = balls[mIndices[i]];
+        NewNode.bounds.radius = std::max(NewNode.bounds.radius, length(B.center - NewNode.bounds.center) + B.radius);
+    }
+    NewNode.index = first;
+    NewNode.count = count;
+
+    const uint32_t NodeIndex = uint32_t(mNodes.size());
+    mNodes.push_back(NewNode);
+    if (count <= MaxLeafSize) return NodeIndex;
+
+    //Median split along the longest extent of the centers
+    const dvec3 Extent = CenterBox.max() - CenterBox.min();
+    const int Axis = (Extent.x >= Extent.y && Extent.x >= Extent.z) ? 0 : ((Extent.y >= Extent.z) ? 1 : 2);
+    const uint32_t Half = count / 2;
+    std::nth_element(mIndices.begin() + first, mIndices.begin() + first + Half, mIndices.begin() + first + count,
+                     [&balls, Axis](uint32_t a, uint32_t b) { return balls[a].center[Axis] < balls[b].center[Axis]; });
+
+    buildNode(balls, first, Half);
+    const uint32_t SecondChild = buildNode(balls, first + Half, count - Half);
+    mNodes[NodeIndex].index = SecondChild;
+    mNodes[NodeIndex].count = 0;
+    return NodeIndex;
+}
+
+size_t CSGSphereGroup::SphereHierarchy::collectSpans(const Ray& ray, const std::vector<Ball>& balls,
+                                                     const double minLambda, const double maxLambda,
+                                                     const uint32_t firstOperand, Span* spans) const
+{
+    if (mNodes.empty()) return 0;
+
+    size_t NumSpans(0);
+    uint32_t Stack[MaxDepth];
+    int StackSize(0);
+    Stack[StackSize++] = 0;
+    while (StackSize > 0)
+    {
+        const Node& N = mNodes[Stack[--StackSize]];
+        double Enter, Leave;
+        if (!intersectBall(ray, N.bounds, Enter, Leave) || Leave <= minLambda || Enter >= maxLambda) continue;
+
+        if (N.count == 0)
+        {
+            Stack[StackSize++] = N.index;
+            Stack[StackSize++] = uint32_t(&N - mNodes.data()) + 1;
+            continue;
+        }
+
+        for (uint32_t i(N.index); i < N.index + N.count; i++)
+        {
+            const uint32_t Operand = mIndices[i];
+            if (!intersectBall(ray, balls[Operand], Enter, Leave) || Leave <= minLambda || Enter >= maxLambda) continue;
+            spans[NumSpans++] = {Enter, Leave, firstOperand + Operand, firstOperand + Operand};
+        }
+    }
+    return NumSpans;
+}
+
+void CSGSphereGroup::addSphere(std::shared_ptr<Sphere> sphere)
+{
+    mAddedSpheres.push_back(std::move(sphere));
+}
+
+void CSGSphereGroup::subtractSphere(std::shared_ptr<Sphere> sphere)
+{
+    mSubtractedSpheres.push_back(std::move(sphere));
+}
+
+void CSGSphereGroup::initialize()
+{
+    mAdded.clear();
+    mSubtracted.clear();
+    for (const auto& S : mAddedSpheres) mAdded.push_back({S->center_, S->radius_});
+    for (const auto& S : mSubtractedSpheres) mSubtracted.push_back({S->center_, S->radius_});
+    mAddedHierarchy.build(mAdded);
+    mSubtractedHierarchy.build(mSubtracted);
+}
+
+bool CSGSphereGroup::firstBoundary(const Ray& ray, const double maxLambda, double& lambda, uint32_t& operand) const
+{
+    SpanArena& A = Arena;
+    if (A.added.size() < mAdded.size()) A.added.resize(mAdded.size());
+    if (A.subtracted.size() < mSubtracted.size()) A.subtracted.resize(mSubtracted.size());
+    Span* Added = A.added.data();
+    Span* Subtracted = A.subtracted.data();
+
+    size_t NumAdded = mAddedHierarchy.collectSpans(ray, mAdded, 0, maxLambda, 0, Added);
+    if (NumAdded == 0) return false;
+    NumAdded = mergeSpans(Added, NumAdded);
+
+    //Subtracted spheres matter only where the ray is inside an added one
+    const double From = std::max(0.0, Added[0].start);
+    const double To = std::min(maxLambda, Added[NumAdded - 1].end);
+    size_t NumSubtracted = mSubtractedHierarchy.collectSpans(ray, mSubtracted, From, To,
+                                                             uint32_t(mAdded.size()), Subtracted);
+    NumSubtracted = mergeSpans(Subtracted, NumSubtracted);
+
+    //Cut the subtracted spans out of the added ones, front to back, until a piece has a boundary ahead
+    size_t k(0);
+    for (size_t i(0); i < NumAdded; i++)
+    {
+        const Span& Whole = Added[i];
+        Span Piece = Whole;
+        while (k < NumSubtracted && Subtracted[k].end <= Piece.start) k++;
+        while (k < NumSubtracted && Subtracted[k].start < Whole.end)
+        {
+            Piece.end = Subtracted[k].start;
+            Piece.endOperand = Subtracted[k].startOperand;
+            if (boundaryAhead(Piece, lambda, operand)) return lambda < maxLambda;
+
+            Piece.start = Subtracted[k].end;
+            Piece.startOperand = Subtracted[k].endOperand;
+            Piece.end = Whole.end;
+            Piece.endOperand = Whole.endOperand;
+            //The subtracted span may reach into the next added one
+            if (Subtracted[k].end >= Whole.end) break;
+            k++;
+        }
+        if (boundaryAhead(Piece, lambda, operand)) return lambda < maxLambda;
+    }
+    return false;
+}
+
+bool CSGSphereGroup::closestIntersection(const Ray& ray, double maxLambda, RayIntersection& intersection) const
+{
+    HitRecord Hit;
+    if (!closestHit(ray, maxLambda, Hit)) return false;
+    intersection = makeIntersection(ray, Hit);
+    return true;
+}
+
+bool CSGSphereGroup::anyIntersection(const Ray& ray, double maxLambda) const
+{
+    double Lambda;
+    uint32_t Operand;
+    return firstBoundary(ray, maxLambda, Lambda, Operand);
+}
+
+bool CSGSphereGroup::closestHit(const Ray& ray, double maxLambda, HitRecord& hit) const
+{
+    double Lambda;
+    uint32_t Operand;
+    if (!firstBoundary(ray, maxLambda, Lambda, Operand)) return false;
+    hit.renderable = this;
+    hit.primitive = Operand;
+    hit.lambda = Lambda;
+    hit.u = 0;
+    hit.v = 0;
+    return true;
+}
+
+RayIntersection CSGSphereGroup::makeIntersection(const Ray& ray, const HitRecord& hit) const
+{
+    const bool bSubtracted = hit.primitive >= mAdded.size();
+    const Ball& B = bSubtracted ? mSubtracted[hit.primitive - mAdded.size()] : mAdded[hit.primitive];
+    const dvec3 Outward = (ray.pointOnRay(hit.lambda) - B.center) / B.radius;
+
+    //The surface takes the material of its sphere, if it has one
+    const Sphere& Operand = getOperand(hit.primitive);
+    const Renderable* Surface = Operand.mMaterial ? static_cast<const Renderable*>(&Operand) : this;
+    return RayIntersection(ray, Surface, hit.lambda, bSubtracted ? -Outward : Outward, dvec3(0, 0, 0));
+}
+
+bool CSGSphereGroup::getBoundingBox(BoundingBox& box) const
+{
+    if (mAddedSpheres.empty()) return false;
+
+    box = BoundingBox();
+    for (const auto& S : mAddedSpheres)
+    {
+        BoundingBox SphereBox;
+        S->getBoundingBox(SphereBox);
+        box.merge(SphereBox);
+    }
+    return true;
+}
+
+void CSGSphereGroup::drawGeometry(std::shared_ptr<BasicMesh> mesh, std::vector<BasicMesh::Vertex>& vertices) const
+{
+    for (const auto& S : mAddedSpheres) S->drawGeometryLonLat(mesh, vertices, 10, 8, dvec4(0.2, 0.2, 0.2, 1));
+    for (const auto& S : mSubtractedSpheres) S->drawGeometryLonLat(mesh, vertices, 10, 8, dvec4(0.6, 0.2, 0.2, 1));
+}
+
+}// namespace inviwo
@@ -16,3 +16,135 @@
 #include <labraytracer/boundingbox.h>
 #include <labraytracer/sphere.h>
 
+
+#include <memory>
+#include <vector>
+
+namespace inviwo
+{
+
+/** \class CSGSphereGroup
+    \brief Union of spheres minus the union of other spheres.
+
+    A ray is clipped against every sphere it touches, which gives an interval per sphere.
+    The intervals of each kind are merged into spans, and the subtracted spans are cut out of
+    the added ones; the first boundary of what remains is the hit. The spans live in a per-thread
+    arena that only grows with the number of operands, never per ray. Each kind of sphere has a
+    bounding-sphere hierarchy, and the subtracted spheres are only looked up where the ray is
+    inside an added one.
+
+    A hit on a subtracted sphere has its material and the normal pointing into it.
+*/
+class IVW_MODULE_LABRAYTRACER_API CSGSphereGroup : public Renderable
+{
+//Friends
+//Types
+public:
+
+//Construction / Deconstruction
+public:
+    CSGSphereGroup() = default;
+    virtual ~CSGSphereGroup() = default;
+
+//Methods
+public:
+    ///Adds the volume of the sphere to the group
+    void addSphere(std::shared_ptr<Sphere> sphere);
+    ///Removes the volume of the sphere from the group
+    void subtractSphere(std::shared_ptr<Sphere> sphere);
+
+    size_t getNumAddedSpheres() const { return mAddedSpheres.size(); }
+    size_t getNumSubtractedSpheres() const { return mSubtractedSpheres.size(); }
+
+    ///Copies the spheres and builds the hierarchies; call again after changing a sphere
+    void initialize() override;
+
+    bool closestIntersection(const Ray& ray, double maxLambda,
+                             RayIntersection& intersection) const override;
+    bool anyIntersection(const Ray& ray, double maxLambda) const override;
+    bool closestHit(const Ray& ray, double maxLambda, HitRecord& hit) const override;
+    RayIntersection makeIntersection(const Ray& ray, const HitRecord& hit) const override;
+
+    ///Bounds of the added spheres
+    bool getBoundingBox(BoundingBox& box) const override;
+
+    void drawGeometry(std::shared_ptr<BasicMesh> mesh,
+                      std::vector<BasicMesh::Vertex>& vertices) const override;
+
+    ///Sphere of an operand, as copied in initialize()
+    struct Ball
+    {
+        dvec3 center;
+        double radius;
+    };
+
+    ///Part of a ray inside a solid; the operands that the ray enters and leaves it through
+    struct Span
+    {
+        double start;
+        double end;
+        uint32_t startOperand;
+        uint32_t endOperand;
+    };
+
+    /** Bounding-sphere hierarchy over a set of balls. Inner nodes have two children, the first
+        one directly after them; leaves refer to a range of the reordered operand indices.
+    */
+    class SphereHierarchy
+    {
+    public:
+        struct Node
+        {
+            Ball bounds;
+            ///Leaf: first entry in the index list; inner node: second child
+            uint32_t index;
+            ///Leaf: number of balls; inner node: 0
+            uint32_t count;
+        };
+
+        static constexpr uint32_t MaxLeafSize = 4;
+        ///The median split keeps the depth at log2 of the number of balls
+        static constexpr int MaxDepth = 64;
+
+        void build(const std::vector<Ball>& balls);
+        void clear();
+
+        /** Appends a span for every ball that the ray passes through within (minLambda, maxLambda),
+            unclipped. Operand i of the spans is firstOperand + i. Returns the number of spans.
+        */
+        size_t collectSpans(const Ray& ray, const std::vector<Ball>& balls, const double minLambda,
+                            const double maxLambda, const uint32_t firstOperand, Span* spans) const;
+
+        size_t getNumNodes() const { return mNodes.size(); }
+
+    private:
+        uint32_t buildNode(const std::vector<Ball>& balls, const uint32_t first, const uint32_t count);
+
+        std::vector<Node> mNodes;
+        std::vector<uint32_t> mIndices;
+    };
+
+protected:
+    /** Closest boundary of the group within (0, maxLambda). The operand counts the added spheres
+        first, then the subtracted ones.
+    */
+    bool firstBoundary(const Ray& ray, const double maxLambda, double& lambda, uint32_t& operand) const;
+
+    const Sphere& getOperand(const uint32_t operand) const
+    {
+        return (operand < mAddedSpheres.size()) ? *mAddedSpheres[operand]
+                                                : *mSubtractedSpheres[operand - mAddedSpheres.size()];
+    }
+
+//Attributes
+protected:
+    std::vector<std::shared_ptr<Sphere>> mAddedSpheres;
+    std::vector<std::shared_ptr<Sphere>> mSubtractedSpheres;
+
+    std::vector<Ball> mAdded;
+    std::vector<Ball> mSubtracted;
+    SphereHierarchy mAddedHierarchy;
+    SphereHierarchy mSubtractedHierarchy;
+};
+
+}// namespace inviwo
@@ -0,0 +1,106 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 08:34:20
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include <labraytracer/gbuffer.h>
+#include <labraytracer/scene.h>
+
+namespace inviwo
+{
+
+namespace
+{
+bool sameRay(const Ray& a, const Ray& b)
+{
+    return a.getOrigin() == b.getOrigin() && a.getDirection() == b.getDirection();
+}
+}
+
+GBuffer::GBuffer()
+    : imageSize_(0, 0)
+    , numLights_(0)
+    , bComplete_(false)
+{
+}
+
+void GBuffer::begin(const Scene& scene)
+{
+    bComplete_ = false;
+    imageSize_ = size2_t(scene.getImageSize());
+    samples_.resize(imageSize_.x * imageSize_.y);
+
+    numLights_ = scene.getLights().size();
+    lightVisible_.resize(samples_.size() * numLights_);
+    lightPositions_.clear();
+    for (const auto& light : scene.getLights()) lightPositions_.push_back(light->getPosition());
+
+    renderables_ = std::make_shared<const std::vector<std::shared_ptr<Renderable>>>(scene.getRenderables());
+
+    cornerRays_[0] = scene.getRay(size2_t(0, 0));
+    cornerRays_[1] = scene.getRay(size2_t(imageSize_.x - 1, 0));
+    cornerRays_[2] = scene.getRay(size2_t(0, imageSize_.y - 1));
+}
+
+void GBuffer::clear()
+{
+    bComplete_ = false;
+    imageSize_ = size2_t(0, 0);
+    samples_ = std::vector<Sample>();
+    numLights_ = 0;
+    lightVisible_ = std::vector<uint8_t>();
+    lightPositions_.clear();
+    renderables_.reset();
+}
+
+bool GBuffer::isValidFor(const Scene& scene) const
+{
+    if (!bComplete_ || imageSize_ != size2_t(scene.getImageSize())) return false;
+    if (*renderables_ != scene.getRenderables()) return false;
+
+    return sameRay(cornerRays_[0], scene.getRay(size2_t(0, 0)))
+        && sameRay(cornerRays_[1], scene.getRay(size2_t(imageSize_.x - 1, 0)))
+        && sameRay(cornerRays_[2], scene.getRay(size2_t(0, imageSize_.y - 1)));
+}
+
+bool GBuffer::hasSameLights(const Scene& scene) const
+{
+    const auto& lights = scene.getLights();
+    if (lights.size() != lightPositions_.size()) return false;
+    for (size_t l(0); l < lights.size(); l++)
+    {
+        if (lights[l]->getPosition() != lightPositions_[l]) return false;
+    }
+    return true;
+}
+
+void GBuffer::set(const size2_t& pixel, const RayIntersection& intersection, const uint8_t* lightVisible)
+{
+    const size_t i = index(pixel);
+    samples_[i] = {intersection.getRenderable(), intersection.getLambda(), intersection.getNormal(),
+                   intersection.getUVW()};
+    std::copy(lightVisible, lightVisible + numLights_, lightVisible_.begin() + i * numLights_);
+}
+
+void GBuffer::setBackground(const size2_t& pixel)
+{
+    samples_[index(pixel)].renderable = nullptr;
+}
+
+RayIntersection GBuffer::getIntersection(const Sample& sample, const Ray& ray) const
+{
+    //The buffer keeps the renderables alive
+    return RayIntersection(ray, sample.renderable, sample.lambda, sample.normal, sample.uvw);
+}
+
+size_t GBuffer::getSizeInBytes() const
+{
+    return samples_.size() * sizeof(Sample) + lightVisible_.size();
+}
+
+}// namespace inviwo
@@ -0,0 +1,100 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 08:34:20
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <labraytracer/labraytracermoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <labraytracer/ray.h>
+#include <labraytracer/rayintersection.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace inviwo
+{
+
+class Scene;
+class Renderable;
+
+/** \class GBuffer
+    \brief First hit of the primary ray of every pixel
+
+    Recorded during a full-resolution rendering, together with the visibility of the lights
+    from each hit. As long as camera, image size and renderables stay the same, the image can
+    be shaded again from it without tracing primary rays, e.g. after the colors of the lights
+    have changed. Shadow rays are only traced again if the lights have moved.
+*/
+class IVW_MODULE_LABRAYTRACER_API GBuffer
+{
+//Types
+public:
+    struct Sample
+    {
+        ///nullptr for the background
+        const Renderable* renderable;
+        double lambda;
+        dvec3 normal;
+        dvec3 uvw;
+    };
+
+//Construction / Deconstruction
+public:
+    GBuffer();
+    virtual ~GBuffer() = default;
+
+//Methods
+public:
+    ///Starts recording a rendering of the scene. The buffer is invalid until finish().
+    void begin(const Scene& scene);
+    void finish() { bComplete_ = true; }
+    void clear();
+
+    ///Whether the buffer holds a complete recording for the camera, image size and renderables of the scene
+    bool isValidFor(const Scene& scene) const;
+    ///Whether the lights of the scene are at the positions of the recording, so that their visibility is still valid
+    bool hasSameLights(const Scene& scene) const;
+
+    ///Records the hit of a pixel with the visibility of each light from it
+    void set(const size2_t& pixel, const RayIntersection& intersection, const uint8_t* lightVisible);
+    ///Records that the ray of a pixel hit nothing
+    void setBackground(const size2_t& pixel);
+
+    const Sample& get(const size2_t& pixel) const { return samples_[index(pixel)]; }
+    const uint8_t* getLightVisible(const size2_t& pixel) const { return &lightVisible_[index(pixel) * numLights_]; }
+
+    ///Intersection of a recorded hit for the given primary ray
+    RayIntersection getIntersection(const Sample& sample, const Ray& ray) const;
+
+    ///Memory used by the samples and the light visibilities
+    size_t getSizeInBytes() const;
+
+protected:
+    size_t index(const size2_t& pixel) const { return pixel.y * imageSize_.x + pixel.x; }
+
+//Attributes
+private:
+    size2_t imageSize_;
+    std::vector<Sample> samples_;
+    size_t numLights_;
+    std::vector<uint8_t> lightVisible_;
+    std::vector<dvec3> lightPositions_;
+
+    ///Keeps the renderables alive; the samples refer to them (or their parts) by raw pointers
+    std::shared_ptr<const std::vector<std::shared_ptr<Renderable>>> renderables_;
+
+    ///Primary rays of three corners; the camera is the same if they are
+    Ray cornerRays_[3];
+
+    bool bComplete_;
+};
+
+}// namespace inviwo
@@ -0,0 +1,327 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 09:20:38
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include <labraytracer/indexedtrianglemesh.h>
+#include <labraytracer/util.h>
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <mutex>
+
+namespace inviwo
+{
+
+namespace
+{
+///Vertices converted together; the block stays in L1
+constexpr size_t ConversionBlockSize = 64;
+///Vertices per thread below which converting in parallel does not pay off
+constexpr size_t MinParallelVertices = 1 << 15;
+}
+
+int IndexedTriangleMesh::addVertex(const dvec3& v, const dvec3& n)
+{
+    //Someone else's arrays cannot grow
+    if (mStorage == VertexStorage::External) setVertexStorage(VertexStorage::Float);
+
+    switch (mStorage)
+    {
+        case VertexStorage::Float:
+            mFloatVertices.push_back({vec3(v), vec3(n)});
+            break;
+        case VertexStorage::Quantized:
+            mQuantizedVertices.push_back({vec3(v), Util::encodeOctahedral(n)});
+            break;
+        default:
+            mVertexPosition.push_back(v);
+            mVertexNormal.push_back(n);
+            break;
+    }
+    mNumVertices++;
+
+    //The box holds the stored position, which may be rounded
+    BBox.expandByPoint(getVertexPosition(mNumVertices - 1));
+    mGeometryVersion++;
+
+    return int(mNumVertices - 1);
+}
+
+void IndexedTriangleMesh::reserveVertices(const size_t NewCapacity)
+{
+    switch (mStorage)
+    {
+        case VertexStorage::Float:
+            mFloatVertices.reserve(NewCapacity);
+            break;
+        case VertexStorage::Quantized:
+            mQuantizedVertices.reserve(NewCapacity);
+            break;
+        case VertexStorage::Double:
+            mVertexPosition.reserve(NewCapacity);
+            mVertexNormal.reserve(NewCapacity);
+            break;
+        default:
+            break;
+    }
+}
+
+void IndexedTriangleMesh::setVertexStorage(const VertexStorage storage)
+{
+    if (storage == mStorage) return;
+    if (storage == VertexStorage::External)
+    {
+        LogWarn("External vertex storage needs the arrays; use setExternalVertices().");
+        return;
+    }
+
+    //Read everything through the current storage, then switch
+    const size_t NumVertices = mNumVertices;
+    std::vector<dvec3> Positions(NumVertices);
+    std::vector<dvec3> Normals(NumVertices, dvec3(0));
+    const bool bNormals = hasVertexNormals();
+    for (size_t i(0); i < NumVertices; i++)
+    {
+        Positions[i] = getVertexPosition(i);
+        if (bNormals) Normals[i] = getVertexNormal(i);
+    }
+
+    clearVertices();
+
+    mStorage = storage;
+    mNumVertices = 0;
+    BBox = BoundingBox();
+    reserveVertices(NumVertices);
+    for (size_t i(0); i < NumVertices; i++) addVertex(Positions[i], Normals[i]);
+}
+
+std::string IndexedTriangleMesh::getStorageName(const VertexStorage storage)
+{
+    switch (storage)
+    {
+        case VertexStorage::Float:
+            return "float";
+        case VertexStorage::Quantized:
+            return "quantized";
+        case VertexStorage::External:
+            return "external";
+        default:
+            return "double";
+    }
+}
+
+void IndexedTriangleMesh::setExternalVertices(const float* positions, const size_t positionStride,
+                                              const float* normals, const size_t normalStride,
+                                              const size_t numVertices, const dmat4& transformation,
+                                              std::shared_ptr<const void> owner)
+{
+    clearVertices();
+    mVertexTextureCoordinate.clear();
+
+    mStorage = VertexStorage::External;
+    mNumVertices = numVertices;
+    mExternalPositions = positions;
+    mExternalNormals = normals;
+    mExternalPositionStride = positionStride;
+    mExternalNormalStride = normalStride;
+    mExternalTransformation = transformation;
+    mExternalNormalTransformation = glm::inverseTranspose(dmat3(transformation));
+    mExternalOwner = std::move(owner);
+
+    std::mutex BoxMutex;
+    BBox = BoundingBox();
+    Util::forEachChunk(mNumVertices, MinParallelVertices, [&](size_t begin, size_t end)
+    {
+        BoundingBox ChunkBox;
+        for (size_t i(begin); i < end; i++) ChunkBox.expandByPoint(getVertexPosition(i));
+        std::lock_guard<std::mutex> Lock(BoxMutex);
+        BBox.merge(ChunkBox);
+    });
+    mGeometryVersion++;
+}
+
+void IndexedTriangleMesh::setVertices(const vec3* positions, const vec3* normals, const size_t numVertices,
+                                      const dmat4& transformation)
+{
+    convertVertices(positions, normals, numVertices, transformation);
+}
+
+void IndexedTriangleMesh::setVertices(const dvec3* positions, const dvec3* normals, const size_t numVertices,
+                                      const dmat4& transformation)
+{
+    convertVertices(positions, normals, numVertices, transformation);
+}
+
+template <typename Vec>
+void IndexedTriangleMesh::convertVertices(const Vec* positions, const Vec* normals, const size_t numVertices,
+                                          const dmat4& transformation)
+{
+    const VertexStorage Storage = (mStorage == VertexStorage::External) ? VertexStorage::Float : mStorage;
+    clearVertices();
+    mVertexTextureCoordinate.clear();
+    mStorage = Storage;
+    mNumVertices = numVertices;
+    switch (mStorage)
+    {
+        case VertexStorage::Float:
+            mFloatVertices.resize(numVertices);
+            break;
+        case VertexStorage::Quantized:
+            mQuantizedVertices.resize(numVertices);
+            break;
+        default:
+            mVertexPosition.resize(numVertices);
+            mVertexNormal.resize(numVertices);
+            break;
+    }
+
+    const dmat4& M = transformation;
+    const dmat3 N = glm::inverseTranspose(dmat3(transformation));
+    //The homogeneous division is only needed for projective transformations
+    const bool bAffine = M[0][3] == 0 && M[1][3] == 0 && M[2][3] == 0 && M[3][3] == 1;
+
+    std::mutex BoxMutex;
+    BBox = BoundingBox();
+    Util::forEachChunk(numVertices, MinParallelVertices, [&](size_t begin, size_t end)
+    {
+        //Structure of arrays, so that the compiler vectorizes the transformations
+        double X[ConversionBlockSize], Y[ConversionBlockSize], Z[ConversionBlockSize], W[ConversionBlockSize];
+        double NX[ConversionBlockSize], NY[ConversionBlockSize], NZ[ConversionBlockSize];
+        BoundingBox ChunkBox;
+        for (size_t Block(begin); Block < end; Block += ConversionBlockSize)
+        {
+            const size_t Count = std::min(ConversionBlockSize, end - Block);
+            for (size_t k(0); k < Count; k++)
+            {
+                const Vec& p = positions[Block + k];
+                const Vec& n = normals[Block + k];
+                X[k] = double(p[0]);
+                Y[k] = double(p[1]);
+                Z[k] = double(p[2]);
+                NX[k] = double(n[0]);
+                NY[k] = double(n[1]);
+                NZ[k] = double(n[2]);
+            }
+
+            //Same order of operations as glm, so that the result equals Trafo * dvec4(p, 1)
+            for (size_t k(0); k < Count; k++)
+            {
+                const double x(X[k]), y(Y[k]), z(Z[k]);
+                X[k] = (M[0][0] * x + M[1][0] * y) + (M[2][0] * z + M[3][0]);
+                Y[k] = (M[0][1] * x + M[1][1] * y) + (M[2][1] * z + M[3][1]);
+                Z[k] = (M[0][2] * x + M[1][2] * y) + (M[2][2] * z + M[3][2]);
+                W[k] = (M[0][3] * x + M[1][3] * y) + (M[2][3] * z + M[3][3]);
+            }
+            if (!bAffine)
+            {
+                for (size_t k(0); k < Count; k++)
+                {
+                    X[k] /= W[k];
+                    Y[k] /= W[k];
+                    Z[k] /= W[k];
+                }
+            }
+            for (size_t k(0); k < Count; k++)
+            {
+                const double x(NX[k]), y(NY[k]), z(NZ[k]);
+                NX[k] = N[0][0] * x + N[1][0] * y + N[2][0] * z;
+                NY[k] = N[0][1] * x + N[1][1] * y + N[2][1] * z;
+                NZ[k] = N[0][2] * x + N[1][2] * y + N[2][2] * z;
+            }
+
+            for (size_t k(0); k < Count; k++)
+            {
+                const size_t i = Block + k;
+                const dvec3 Position(X[k], Y[k], Z[k]);
+                const dvec3 Normal = glm::normalize(dvec3(NX[k], NY[k], NZ[k]));
+                switch (Storage)
+                {
+                    case VertexStorage::Float:
+                        mFloatVertices[i] = {vec3(Position), vec3(Normal)};
+                        break;
+                    case VertexStorage::Quantized:
+                        mQuantizedVertices[i] = {vec3(Position), Util::encodeOctahedral(Normal)};
+                        break;
+                    default:
+                        mVertexPosition[i] = Position;
+                        mVertexNormal[i] = Normal;
+                        break;
+                }
+                ChunkBox.expandByPoint(getVertexPosition(i));
+            }
+        }
+
+        std::lock_guard<std::mutex> Lock(BoxMutex);
+        BBox.merge(ChunkBox);
+    });
+    mGeometryVersion++;
+}
+
+void IndexedTriangleMesh::clearVertices()
+{
+    std::vector<dvec3>().swap(mVertexPosition);
+    std::vector<dvec3>().swap(mVertexNormal);
+    std::vector<FloatVertex>().swap(mFloatVertices);
+    std::vector<QuantizedVertex>().swap(mQuantizedVertices);
+    mExternalPositions = nullptr;
+    mExternalNormals = nullptr;
+    mExternalOwner.reset();
+}
+
+dvec3 IndexedTriangleMesh::getVertexPosition(const size_t i) const
+{
+    switch (mStorage)
+    {
+        case VertexStorage::Float:
+            return dvec3(mFloatVertices[i].position);
+        case VertexStorage::Quantized:
+            return dvec3(mQuantizedVertices[i].position);
+        case VertexStorage::External:
+        {
+            const float* p = mExternalPositions + i * mExternalPositionStride;
+            const dvec4 Transformed = mExternalTransformation * dvec4(p[0], p[1], p[2], 1.0);
+            return dvec3(Transformed) / Transformed.w;
+        }
+        default:
+            return mVertexPosition[i];
+    }
+}
+
+dvec3 IndexedTriangleMesh::getVertexNormal(const size_t i) const
+{
+    switch (mStorage)
+    {
+        case VertexStorage::Float:
+            return Util::normalize(dvec3(mFloatVertices[i].normal));
+        case VertexStorage::Quantized:
+            return Util::decodeOctahedral(mQuantizedVertices[i].normal);
+        case VertexStorage::External:
+        {
+            const float* n = mExternalNormals + i * mExternalNormalStride;
+            return Util::normalize(mExternalNormalTransformation * dvec3(n[0], n[1], n[2]));
+        }
+        default:
+            return mVertexNormal[i];
+    }
+}
+
+size_t IndexedTriangleMesh::getMemoryUsage() const
+{
+    return mVertexPosition.size() * sizeof(dvec3) + mVertexNormal.size() * sizeof(dvec3)
+           + mFloatVertices.size() * sizeof(FloatVertex) + mQuantizedVertices.size() * sizeof(QuantizedVertex)
+           + mVertexTextureCoordinate.size() * sizeof(dvec3) + mIndices.size() * sizeof(int);
+}
+
+size_t IndexedTriangleMesh::getExternalMemoryUsage() const
+{
+    if (mStorage != VertexStorage::External) return 0;
+    return mNumVertices * 3 * sizeof(float) * (mExternalNormals ? 2 : 1);
+}
+
+}// namespace inviwo
@@ -6,66 +6,116 @@
 #include <labraytracer/ray.h>
 #include <labraytracer/boundingbox.h>
 
+#include <memory>
+#include <string>
+
 namespace inviwo
 {
 
 class IVW_MODULE_LABRAYTRACER_API IndexedTriangleMesh : public Renderable
 {
 public:
+    ///How the vertex positions and normals are stored
+    enum class VertexStorage
+    {
+        ///Separate arrays of dvec3, 48 bytes per vertex
+        Double,
+        ///Interleaved float position and normal, 24 bytes per vertex
+        Float,
+        ///Interleaved float position and octahedral normal in 2x16 bits, 16 bytes per vertex
+        Quantized,
+        ///Float arrays owned by someone else, see setExternalVertices(); no copy at all
+        External
+    };
+
     int addVertex(const dvec3& v, const dvec3& n, const dvec3& uvw)
     {
-        mVertexPosition.push_back(v);
-        mVertexNormal.push_back(n);
         mVertexTextureCoordinate.push_back(uvw);
-
-        BBox.expandByPoint(v);
-
-        return int(mVertexPosition.size() - 1);
+        return addVertex(v, n);
     }
 
-    int addVertex(const dvec3& v, const dvec3& n)
-    {
-        mVertexPosition.push_back(v);
-        mVertexNormal.push_back(n);
-        //mVertexTextureCoordinate.push_back(uvw);
-
-        BBox.expandByPoint(v);
-
-        return int(mVertexPosition.size() - 1);
-    }
+    int addVertex(const dvec3& v, const dvec3& n);
 
     void addTriangle(const int i0, const int i1, const int i2)
     {
         mIndices.push_back(i0);
         mIndices.push_back(i1);
         mIndices.push_back(i2);
+        mGeometryVersion++;
     }
 
-    void reserveVertexPositions(const size_t NewCapacity)
+    ///Appends a plain list of triangles, three indices each, in one go
+    void addTriangles(const uint32_t* indices, const size_t numIndices)
     {
-        mVertexPosition.reserve(NewCapacity);
+        mIndices.insert(mIndices.end(), indices, indices + (numIndices - numIndices % 3));
+        mGeometryVersion++;
     }
 
+    ///Reserves positions and normals in the current storage
+    void reserveVertices(const size_t NewCapacity);
+
     void reserveVertexTextureCoordinates(const size_t NewCapacity)
     {
         mVertexTextureCoordinate.reserve(NewCapacity);
     }
 
-    void reserveVertexNormals(const size_t NewCapacity)
-    {
-        mVertexNormal.reserve(NewCapacity);
-    }
-
     void reserveTriangleIndices(const size_t NewCapacity)
     {
         mIndices.reserve(NewCapacity);
     }
 
-    const std::vector<dvec3>& vertexPositions() const { return mVertexPosition; }
+    /** Converts the vertices to the given storage. Float and Quantized round the positions to float,
+        Quantized also the normals to about 1e-4. External cannot be chosen here.
+        Adding a vertex to an External mesh converts it to Float first.
+    */
+    void setVertexStorage(const VertexStorage storage);
+    VertexStorage getVertexStorage() const { return mStorage; }
+    static std::string getStorageName(const VertexStorage storage);
+
+    /** Uses the positions and normals of someone else's float arrays instead of copying them,
+        e.g. the RAM representation of the buffers of an input mesh. Component i of vertex v is
+        at positions[v * positionStride + i]; likewise for the normals, which may be null.
+        The transformation is applied when reading, the normals get its inverse transpose.
+        owner keeps the arrays alive; they must not change while the mesh uses them.
+    */
+    void setExternalVertices(const float* positions, const size_t positionStride, const float* normals,
+                             const size_t normalStride, const size_t numVertices, const dmat4& transformation,
+                             std::shared_ptr<const void> owner);
+
+    /** Replaces all vertices by transformed copies of the given positions and normals, which are
+        kept in the current storage (Float for an External mesh). The transformation is applied as in
+        setExternalVertices(), the normals are normalized. Blocks of vertices are converted in parallel.
+        Texture coordinates are dropped.
+    */
+    void setVertices(const vec3* positions, const vec3* normals, const size_t numVertices,
+                     const dmat4& transformation);
+    void setVertices(const dvec3* positions, const dvec3* normals, const size_t numVertices,
+                     const dmat4& transformation);
+
+    size_t getNumVertices() const { return mNumVertices; }
+    dvec3 getVertexPosition(const size_t i) const;
+    bool hasVertexNormals() const { return mStorage != VertexStorage::External || mExternalNormals; }
+    ///Normal of vertex i, normalized unless stored as Double
+    dvec3 getVertexNormal(const size_t i) const;
+
     const std::vector<dvec3>& vertexTextureCoordinates() const { return mVertexTextureCoordinate; }
-    const std::vector<dvec3>& vertexNormals() const { return mVertexNormal; }
     const std::vector<int>& triangleIndices() const { return mIndices; }
 
+    ///Bytes of vertex and index data owned by the mesh
+    size_t getMemoryUsage() const;
+    ///Bytes of vertex data referenced with setExternalVertices()
+    size_t getExternalMemoryUsage() const;
+
+    ///Increases with every change of vertices or triangles. Lets derived classes skip rebuilding
+    ///their acceleration structures if nothing has changed.
+    uint64_t getGeometryVersion() const { return mGeometryVersion; }
+
+    bool getBoundingBox(BoundingBox& box) const override
+    {
+        box = BBox;
+        return true;
+    }
+
     void drawGeometry(std::shared_ptr<BasicMesh> mesh, std::vector<BasicMesh::Vertex>& vertices) const
     {
         //We show the triangle mesh using a point cloud. Easier to code.
@@ -73,22 +123,61 @@ public:
 
         //Copy over the vertices.
         const size_t OldNum = vertices.size();
-        vertices.reserve(OldNum + mVertexPosition.size());
-        indexBuffer->reserve(indexBuffer->getSize() + mVertexPosition.size());
-        for(size_t i(0);i<mVertexPosition.size();i++)
+        vertices.reserve(OldNum + mNumVertices);
+        indexBuffer->reserve(indexBuffer->getSize() + mNumVertices);
+        for(size_t i(0);i<mNumVertices;i++)
         {
-            vertices.push_back({mVertexPosition[i], vec3(0, 0, 0), mVertexPosition[i], vec4(0.5, 0.5, 0.5, 1)});
+            const vec3 Position(getVertexPosition(i));
+            vertices.push_back({Position, vec3(0, 0, 0), Position, vec4(0.5, 0.5, 0.5, 1)});
             indexBuffer->add(uint32_t(OldNum + i));
         }
     }
 
 private:
+    template <typename Vec>
+    void convertVertices(const Vec* positions, const Vec* normals, const size_t numVertices,
+                         const dmat4& transformation);
+
+    ///Frees the arrays of all storages
+    void clearVertices();
+
+    struct FloatVertex
+    {
+        vec3 position;
+        vec3 normal;
+    };
+
+    struct QuantizedVertex
+    {
+        vec3 position;
+        ///Octahedral encoding, see Util::encodeOctahedral()
+        uint32_t normal;
+    };
+
+    VertexStorage mStorage = VertexStorage::Double;
+    size_t mNumVertices = 0;
+
+    ///Double
     std::vector<dvec3> mVertexPosition;
-    std::vector<dvec3> mVertexTextureCoordinate;
     std::vector<dvec3> mVertexNormal;
+    ///Float
+    std::vector<FloatVertex> mFloatVertices;
+    ///Quantized
+    std::vector<QuantizedVertex> mQuantizedVertices;
+    ///External
+    const float* mExternalPositions = nullptr;
+    const float* mExternalNormals = nullptr;
+    size_t mExternalPositionStride = 3;
+    size_t mExternalNormalStride = 3;
+    dmat4 mExternalTransformation = dmat4(1);
+    dmat3 mExternalNormalTransformation = dmat3(1);
+    std::shared_ptr<const void> mExternalOwner;
+
+    std::vector<dvec3> mVertexTextureCoordinate;
     std::vector<int> mIndices;
 
     BoundingBox BBox;
+    uint64_t mGeometryVersion = 0;
 };
 
 }
@@ -0,0 +1,163 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 08:57:05
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include <labraytracer/lighttree.h>
+
+#include <algorithm>
+
+namespace inviwo
+{
+
+void LightTree::build(const std::vector<std::shared_ptr<Light>>& lights)
+{
+    clear();
+    if (lights.empty()) return;
+
+    std::vector<dvec3> positions(lights.size());
+    std::vector<double> power(lights.size());
+    order_.resize(lights.size());
+    for (size_t l(0); l < lights.size(); l++)
+    {
+        positions[l] = lights[l]->getPosition();
+        power[l] = getPower(*lights[l]);
+        order_[l] = uint32_t(l);
+    }
+
+    nodes_.reserve(2 * lights.size() - 1);
+    buildRecursive(positions, power, 0, uint32_t(lights.size()));
+}
+
+void LightTree::clear()
+{
+    nodes_.clear();
+    order_.clear();
+}
+
+double LightTree::getPower(const Light& light)
+{
+    return compMax(light.getDiffuseColor() + light.getSpecularColor());
+}
+
+uint32_t LightTree::buildRecursive(const std::vector<dvec3>& positions, const std::vector<double>& power,
+                                   const uint32_t begin, const uint32_t end)
+{
+    const uint32_t index = uint32_t(nodes_.size());
+    nodes_.emplace_back();
+    Node node;
+    node.min = dvec3(std::numeric_limits<double>::max());
+    node.max = dvec3(-std::numeric_limits<double>::max());
+    node.power = 0;
+    node.begin = begin;
+    node.end = end;
+    node.right = 0;
+    for (uint32_t i = begin; i < end; i++)
+    {
+        node.min = glm::min(node.min, positions[order_[i]]);
+        node.max = glm::max(node.max, positions[order_[i]]);
+        node.power += power[order_[i]];
+    }
+
+    if (end - begin > 1)
+    {
+        //Median split along the longest axis
+        const dvec3 extent = node.max - node.min;
+        const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+        const uint32_t mid = begin + (end - begin) / 2;
+        std::nth_element(order_.begin() + begin, order_.begin() + mid, order_.begin() + end,
+                         [&](const uint32_t a, const uint32_t b) { return positions[a][axis] < positions[b][axis]; });
+        buildRecursive(positions, power, begin, mid);
+        node.right = buildRecursive(positions, power, mid, end);
+    }
+
+    nodes_[index] = node;
+    return index;
+}
+
+double LightTree::distance2(const Node& node, const dvec3& position)
+{
+    const dvec3 d = glm::max(glm::max(node.min - position, position - node.max), dvec3(0));
+    return dot(d, d);
+}
+
+size_t LightTree::cull(const dvec3& position, const double threshold, double* lightWeight) const
+{
+    if (nodes_.empty()) return 0;
+
+    size_t numCulled(0);
+    uint32_t stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        const Node& node = nodes_[stack[--stackSize]];
+        //Largest possible contribution of any light in the subtree
+        const double dist2 = distance2(node, position);
+        if (node.power < threshold * dist2)
+        {
+            for (uint32_t i = node.begin; i < node.end; i++)
+            {
+                if (lightWeight[order_[i]] == 0) continue;
+                lightWeight[order_[i]] = 0;
+                numCulled++;
+            }
+        }
+        else if (node.end - node.begin > 1)
+        {
+            stack[stackSize++] = node.right;
+            stack[stackSize++] = uint32_t(&node - nodes_.data()) + 1;
+        }
+    }
+    return numCulled;
+}
+
+double LightTree::importance(const Node& node, const dvec3& position, const bool bFalloff) const
+{
+    if (!bFalloff) return node.power;
+
+    //Distance to the center, but not closer than the extent of the box, so that a point inside gets no singularity
+    const dvec3 center = 0.5 * (node.min + node.max);
+    const dvec3 halfExtent = 0.5 * (node.max - node.min);
+    const dvec3 d = center - position;
+    const double dist2 = std::max(dot(d, d), std::max(dot(halfExtent, halfExtent), 1e-12));
+    return node.power / dist2;
+}
+
+uint32_t LightTree::sample(const dvec3& position, const bool bFalloff, double u, double& pdf) const
+{
+    pdf = 1;
+    uint32_t index = 0;
+    while (nodes_[index].end - nodes_[index].begin > 1)
+    {
+        const uint32_t left = index + 1;
+        const uint32_t right = nodes_[index].right;
+        const double importanceLeft = importance(nodes_[left], position, bFalloff);
+        const double importanceRight = importance(nodes_[right], position, bFalloff);
+        const double sum = importanceLeft + importanceRight;
+        const double pLeft = (sum > 0) ? importanceLeft / sum : 0.5;
+
+        //Reuse u for the next decision
+        if (u < pLeft)
+        {
+            u /= pLeft;
+            pdf *= pLeft;
+            index = left;
+        }
+        else
+        {
+            u = (u - pLeft) / (1 - pLeft);
+            pdf *= 1 - pLeft;
+            index = right;
+        }
+        u = std::min(u, 1.0 - std::numeric_limits<double>::epsilon());
+    }
+    return order_[nodes_[index].begin];
+}
+
+}// namespace inviwo
@@ -0,0 +1,90 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 08:57:05
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <labraytracer/labraytracermoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <labraytracer/light.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace inviwo
+{
+
+/** \class LightTree
+    \brief Binary hierarchy over the positions of the lights of a scene
+
+    Every node bounds the positions of its lights and sums their power, i.e., the largest
+    channel of diffuse plus specular color. With the quadratic fall-off of the light,
+    power / (distance to the box)^2 bounds the direct light of a whole subtree at a point.
+    This allows to cull many weak lights at once, and to sample lights by importance.
+*/
+class IVW_MODULE_LABRAYTRACER_API LightTree
+{
+//Construction / Deconstruction
+public:
+    LightTree() = default;
+    virtual ~LightTree() = default;
+
+//Methods
+public:
+    void build(const std::vector<std::shared_ptr<Light>>& lights);
+    void clear();
+
+    ///Number of lights the tree was built for
+    size_t getNumLights() const { return order_.size(); }
+
+    ///Power of a light as used for the bounds
+    static double getPower(const Light& light);
+
+    /** Sets lightWeight[l] to 0 for every light l whose power / distance^2 at position is below
+        threshold. Other weights are left as they are. Returns the number of lights set to 0 that
+        had a weight before.
+    */
+    size_t cull(const dvec3& position, const double threshold, double* lightWeight) const;
+
+    /** Draws a light with a probability proportional to its estimated contribution at position,
+        using u in [0, 1). The estimate is power / distance^2 with fall-off, otherwise just the power.
+        Returns the index of the light and its probability in pdf.
+    */
+    uint32_t sample(const dvec3& position, const bool bFalloff, double u, double& pdf) const;
+
+private:
+    struct Node
+    {
+        dvec3 min;
+        dvec3 max;
+        double power;
+        ///Range of the lights of the subtree in order_
+        uint32_t begin;
+        uint32_t end;
+        ///Index of the second child; the first one follows the node
+        uint32_t right;
+    };
+
+    uint32_t buildRecursive(const std::vector<dvec3>& positions, const std::vector<double>& power,
+                            const uint32_t begin, const uint32_t end);
+
+    ///Importance of a subtree at position for sampling
+    double importance(const Node& node, const dvec3& position, const bool bFalloff) const;
+
+    static double distance2(const Node& node, const dvec3& position);
+
+//Attributes
+private:
+    std::vector<Node> nodes_;
+    ///Light indices, ordered such that every subtree covers a contiguous range
+    std::vector<uint32_t> order_;
+};
+
+}// namespace inviwo
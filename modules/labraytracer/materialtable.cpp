@@ -0,0 +1,318 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 08:44:03
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include <labraytracer/materialtable.h>
+#include <labraytracer/constantmaterial.h>
+#include <labraytracer/cooktorrancematerial.h>
+#include <labraytracer/phongmaterial.h>
+#include <labraytracer/renderable.h>
+#include <labraytracer/util.h>
+
+#include <algorithm>
+#include <typeinfo>
+
+namespace inviwo
+{
+
+namespace
+{
+///Direct light scaled by the weight of a sampled light; unchanged without weights
+inline dvec3 weighted(const dvec3& direct, const double* lightWeight, const double weight)
+{
+    return lightWeight ? direct * weight : direct;
+}
+
+///Same as Material::shadeAmbient()
+inline dvec3 ambientWithFalloff(const dvec3& position, const dvec3& ambient, const Light& light)
+{
+    const double dist2 = glm::length2(light.getPosition() - position);
+    const dvec3 c_a = light.getAmbientColor() / dist2;
+    return ambient * c_a;
+}
+
+///Same as PhongMaterial::shade(); N and V are normalized
+inline dvec3 phongDirect(const dvec3& position, const dvec3& N, const dvec3& V, const dvec3& diffuse,
+                         const dvec3& specular, const double shininess, const Light& light)
+{
+    dvec3 L = (light.getPosition() - position);
+    const double dist2 = dot(L, L);
+    L = Util::normalize(L);
+    dvec3 R = L - Util::scalarMult(dot(N, L) * 2.0, N);
+    R = Util::normalize(R);
+
+    const double cosNL = std::max(double(dot(N, L)), double(0));
+    const double cosRV = std::max(dot(R, V), 0.0);
+
+    const dvec3 c_d = Util::scalarMult(1.0 / dist2, light.getDiffuseColor());
+    const dvec3 c_s = Util::scalarMult(1.0 / dist2, light.getSpecularColor());
+    const dvec3 c_diffuse = Util::scalarMult(cosNL, diffuse) * c_d;
+    const dvec3 c_specular = Util::scalarMult(pow(cosRV, shininess), specular) * c_s;
+    return c_diffuse + c_specular;
+}
+
+///Same as CookTorranceMaterial::shade(); normal and rayDir are normalized
+inline dvec3 cookTorranceDirect(const dvec3& position, const dvec3& normal, const dvec3& rayDir,
+                                const dvec3& albedo, const double r2, const double f2, const Light& light)
+{
+    const dvec3 lightDir = Util::normalize(position - light.getPosition());
+
+    const double vdn = glm::clamp(dot(-rayDir, normal), 0.0, 1.0);
+    const double ndl = glm::clamp(dot(normal, -lightDir), 0.0, 1.0);
+    const dvec3 h = -Util::normalize(lightDir + rayDir);
+    const double ndh = glm::clamp(dot(normal, h), Util::epsilon, 1.0);
+    const double vdh = glm::clamp(dot(-rayDir, h), 0.0, 1.0);
+
+    const double G = (fabs(vdh) >= Util::epsilon) ? std::min(1.0, 2.0 * ndh * std::min(vdn, ndl) / vdh) : 1.0;
+    const double ndh2 = ndh * ndh;
+    const double D = exp((ndh2 - 1.0) / (r2 * ndh2)) / (4.0 * r2 * ndh2 * ndh2);
+
+    //Schlick's approximation, (1 - vdn)^5 without pow()
+    const double c = 1.0 - vdn;
+    const double c2 = c * c;
+    const double F = f2 + (1.0 - f2) * (c2 * c2 * c);
+
+    const dvec3 lightColor = light.getDiffuseColor();
+    const double spec = glm::clamp(G * D * F, 0.0, 1.0);
+    const dvec3 specular = glm::mix(lightColor, albedo, 0.5) * spec;
+
+    const double cosNL = std::max(double(dot(normal, -lightDir)), double(0));
+    const dvec3 diffuse = Util::scalarMult(cosNL, albedo) * lightColor;
+    return diffuse + specular;
+}
+}
+
+
+void MaterialTable::build(const std::vector<std::shared_ptr<Renderable>>& renderables)
+{
+    clear();
+    for (const auto& R : renderables)
+    {
+        const std::shared_ptr<const Material> material = R->getMaterial();
+        R->mMaterialId = material ? find(material.get()) : NotFound;
+        if (!material || R->mMaterialId != NotFound) continue;
+
+        const uint32_t id = uint32_t(types_.size());
+        ids_[material.get()] = id;
+        R->mMaterialId = id;
+        materials_.push_back(material);
+        reflectance_.push_back(material->getReflectance());
+        absorption_.push_back(material->getAbsorptionSpectrum());
+
+        //Exact classes only; derived classes may shade differently
+        const std::type_info& type = typeid(*material);
+        if (type == typeid(ConstantMaterial))
+        {
+            types_.push_back(Type::Constant);
+            paramIndex_.push_back(uint32_t(constantColor_.size()));
+            constantColor_.push_back(material->getAmbientMaterialColor());
+        }
+        else if (type == typeid(PhongMaterial))
+        {
+            const auto& phong = static_cast<const PhongMaterial&>(*material);
+            types_.push_back(Type::Phong);
+            paramIndex_.push_back(uint32_t(phongAmbient_.size()));
+            phongAmbient_.push_back(phong.getAmbientMaterialColor());
+            phongDiffuse_.push_back(phong.getDiffuseMaterialColor());
+            phongSpecular_.push_back(phong.getSpecularMaterialColor());
+            phongShininess_.push_back(phong.getShininess());
+        }
+        else if (type == typeid(CookTorranceMaterial))
+        {
+            const auto& cook = static_cast<const CookTorranceMaterial&>(*material);
+            types_.push_back(Type::CookTorrance);
+            paramIndex_.push_back(uint32_t(cookAmbient_.size()));
+            cookAmbient_.push_back(cook.getAmbientMaterialColor());
+            cookAlbedo_.push_back(cook.getAlbedo());
+            const double roughness = std::max(cook.getRoughness(), 0.03);
+            cookRoughness2_.push_back(roughness * roughness);
+            const double f0 = (1.0 - cook.getRefraction()) / (1.0 + cook.getRefraction());
+            cookF0_.push_back(f0 * f0);
+        }
+        else
+        {
+            types_.push_back(Type::Generic);
+            paramIndex_.push_back(id);
+        }
+    }
+}
+
+void MaterialTable::clear()
+{
+    types_.clear();
+    paramIndex_.clear();
+    reflectance_.clear();
+    absorption_.clear();
+    materials_.clear();
+    ids_.clear();
+    constantColor_.clear();
+    phongAmbient_.clear();
+    phongDiffuse_.clear();
+    phongSpecular_.clear();
+    phongShininess_.clear();
+    cookAmbient_.clear();
+    cookAlbedo_.clear();
+    cookRoughness2_.clear();
+    cookF0_.clear();
+}
+
+uint32_t MaterialTable::find(const Material* material) const
+{
+    const auto it = ids_.find(material);
+    return (it != ids_.end()) ? it->second : NotFound;
+}
+
+dvec4 MaterialTable::shade(const Hit& hit, const std::vector<std::shared_ptr<Light>>& lights,
+                           RenderCounters& counters) const
+{
+    const RayIntersection& intersection = *hit.intersection;
+    const uint32_t p = paramIndex_[hit.material];
+    const dvec3& P = intersection.getPosition();
+    const dvec3 N = Util::normalize(intersection.getNormal());
+    const dvec3 V = Util::normalize(intersection.getRay().getDirection());
+
+    dvec4 color(0, 0, 0, 1);
+    for (size_t l(0); l < lights.size(); l++)
+    {
+        const Light& light = *lights[l];
+        const bool bVisible = hit.lightVisible[l] != 0;
+        const double weight = hit.lightWeight ? hit.lightWeight[l] : 1.0;
+        switch (types_[hit.material])
+        {
+            case Type::Constant:
+                if (bVisible) color += dvec4(weighted(constantColor_[p], hit.lightWeight, weight), 1.0);
+                break;
+            case Type::Phong:
+                color += dvec4(ambientWithFalloff(P, phongAmbient_[p], light), 1.0);
+                if (bVisible)
+                {
+                    const dvec3 direct =
+                        phongDirect(P, N, V, phongDiffuse_[p], phongSpecular_[p], phongShininess_[p], light);
+                    color += dvec4(weighted(direct, hit.lightWeight, weight), 1.0);
+                }
+                break;
+            case Type::CookTorrance:
+                color += dvec4(cookAmbient_[p] * light.getAmbientColor(), 1.0);
+                if (bVisible)
+                {
+                    const dvec3 direct =
+                        cookTorranceDirect(P, N, V, cookAlbedo_[p], cookRoughness2_[p], cookF0_[p], light);
+                    color += dvec4(weighted(direct, hit.lightWeight, weight), 1.0);
+                }
+                break;
+            case Type::Generic:
+                color += materials_[p]->shadeAmbient(intersection, light);
+                if (bVisible)
+                {
+                    const dvec4 direct = materials_[p]->shade(intersection, light);
+                    color += hit.lightWeight ? dvec4(dvec3(direct) * weight, direct[3]) : direct;
+                }
+                break;
+        }
+        if (bVisible) counters.numShading++;
+    }
+    return color;
+}
+
+void MaterialTable::shade(const std::vector<Hit>& hits, const std::vector<std::shared_ptr<Light>>& lights,
+                          dvec4* colors, RenderCounters& counters) const
+{
+    //Group the hits by type
+    Batch batches[NumTypes];
+    for (size_t i(0); i < hits.size(); i++)
+    {
+        const uint32_t id = hits[i].material;
+        batches[size_t(types_[id])].add(i, hits[i], paramIndex_[id]);
+        colors[i] = dvec4(0, 0, 0, 1);
+    }
+
+    shadeConstant(batches[size_t(Type::Constant)], lights, colors, counters);
+    shadePhong(batches[size_t(Type::Phong)], lights, colors, counters);
+    shadeCookTorrance(batches[size_t(Type::CookTorrance)], lights, colors, counters);
+
+    //Everything else through the virtual functions
+    const Batch& generic = batches[size_t(Type::Generic)];
+    for (size_t k(0); k < generic.index.size(); k++)
+    {
+        const size_t i = generic.index[k];
+        colors[i] = shade(hits[i], lights, counters);
+    }
+}
+
+void MaterialTable::shadeConstant(const Batch& batch, const std::vector<std::shared_ptr<Light>>& lights,
+                                  dvec4* colors, RenderCounters& counters) const
+{
+    //No ambient part; the color is added once per visible light
+    for (size_t l(0); l < lights.size(); l++)
+    {
+        for (size_t k(0); k < batch.index.size(); k++)
+        {
+            if (!batch.lightVisible[k][l]) continue;
+            const double* lightWeight = batch.lightWeight[k];
+            colors[batch.index[k]] +=
+                dvec4(weighted(constantColor_[batch.param[k]], lightWeight, lightWeight ? lightWeight[l] : 1.0), 1.0);
+            counters.numShading++;
+        }
+    }
+}
+
+void MaterialTable::shadePhong(const Batch& batch, const std::vector<std::shared_ptr<Light>>& lights,
+                               dvec4* colors, RenderCounters& counters) const
+{
+    for (size_t l(0); l < lights.size(); l++)
+    {
+        const Light& light = *lights[l];
+        for (size_t k(0); k < batch.index.size(); k++)
+        {
+            const uint32_t p = batch.param[k];
+            dvec4& color = colors[batch.index[k]];
+            color += dvec4(ambientWithFalloff(batch.position[k], phongAmbient_[p], light), 1.0);
+            if (!batch.lightVisible[k][l]) continue;
+            const dvec3 direct = phongDirect(batch.position[k], batch.normal[k], batch.view[k], phongDiffuse_[p],
+                                             phongSpecular_[p], phongShininess_[p], light);
+            const double* lightWeight = batch.lightWeight[k];
+            color += dvec4(weighted(direct, lightWeight, lightWeight ? lightWeight[l] : 1.0), 1.0);
+            counters.numShading++;
+        }
+    }
+}
+
+void MaterialTable::shadeCookTorrance(const Batch& batch, const std::vector<std::shared_ptr<Light>>& lights,
+                                      dvec4* colors, RenderCounters& counters) const
+{
+    for (size_t l(0); l < lights.size(); l++)
+    {
+        const Light& light = *lights[l];
+        for (size_t k(0); k < batch.index.size(); k++)
+        {
+            const uint32_t p = batch.param[k];
+            dvec4& color = colors[batch.index[k]];
+            color += dvec4(cookAmbient_[p] * light.getAmbientColor(), 1.0);
+            if (!batch.lightVisible[k][l]) continue;
+            const dvec3 direct = cookTorranceDirect(batch.position[k], batch.normal[k], batch.view[k], cookAlbedo_[p],
+                                                    cookRoughness2_[p], cookF0_[p], light);
+            const double* lightWeight = batch.lightWeight[k];
+            color += dvec4(weighted(direct, lightWeight, lightWeight ? lightWeight[l] : 1.0), 1.0);
+            counters.numShading++;
+        }
+    }
+}
+
+void MaterialTable::Batch::add(const size_t i, const Hit& hit, const uint32_t paramIndex)
+{
+    index.push_back(i);
+    param.push_back(paramIndex);
+    position.push_back(hit.intersection->getPosition());
+    normal.push_back(Util::normalize(hit.intersection->getNormal()));
+    view.push_back(Util::normalize(hit.intersection->getRay().getDirection()));
+    lightVisible.push_back(hit.lightVisible);
+    lightWeight.push_back(hit.lightWeight);
+}
+
+}// namespace inviwo
@@ -0,0 +1,147 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 08:44:03
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <labraytracer/labraytracermoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <labraytracer/light.h>
+#include <labraytracer/rayintersection.h>
+#include <labraytracer/renderstatistics.h>
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace inviwo
+{
+
+class Material;
+class Renderable;
+
+/** \class MaterialTable
+    \brief Parameters of all materials of a scene in flat arrays, one set of arrays per material type
+
+    Shading dispatches on the type id of a material instead of calling it virtually.
+    A batch of hits is grouped by type, and every type is evaluated in one loop over its hits.
+    Materials of other classes are of type Generic and shaded through their virtual functions.
+    The results equal those of Material::shade() and Material::shadeAmbient().
+*/
+class IVW_MODULE_LABRAYTRACER_API MaterialTable
+{
+//Types
+public:
+    enum class Type : uint8_t
+    {
+        Constant = 0,
+        Phong,
+        CookTorrance,
+        Generic
+    };
+    static constexpr size_t NumTypes = 4;
+
+    ///Id of materials that are not in the table
+    static constexpr uint32_t NotFound = std::numeric_limits<uint32_t>::max();
+
+    /** A hit to be shaded; lightVisible[l] says whether light l is visible from it.
+        The direct light of light l is scaled by lightWeight[l], if given.
+    */
+    struct Hit
+    {
+        const RayIntersection* intersection;
+        const uint8_t* lightVisible;
+        uint32_t material;
+        const double* lightWeight = nullptr;
+    };
+
+//Construction / Deconstruction
+public:
+    MaterialTable() = default;
+    virtual ~MaterialTable() = default;
+
+//Methods
+public:
+    ///Collects the materials of the renderables and sets their Renderable::mMaterialId
+    void build(const std::vector<std::shared_ptr<Renderable>>& renderables);
+    void clear();
+
+    ///Id of the material, or NotFound
+    uint32_t find(const Material* material) const;
+    ///Whether id is the id of the material; cheaper than find()
+    bool isId(const uint32_t id, const Material* material) const
+    {
+        return id < materials_.size() && materials_[id].get() == material;
+    }
+    size_t size() const { return types_.size(); }
+    Type getType(const uint32_t id) const { return types_[id]; }
+    double getReflectance(const uint32_t id) const { return reflectance_[id]; }
+    const dvec3& getAbsorptionSpectrum(const uint32_t id) const { return absorption_[id]; }
+    ///Whether the direct light falls off with the squared distance to the light, and is at most the light color
+    bool hasFalloff(const uint32_t id) const { return types_[id] == Type::Phong; }
+
+    ///Ambient light of all lights and direct light of the visible ones at a single hit
+    dvec4 shade(const Hit& hit, const std::vector<std::shared_ptr<Light>>& lights,
+                RenderCounters& counters) const;
+
+    ///Ambient and direct light of a batch of hits; colors[i] belongs to hits[i]
+    void shade(const std::vector<Hit>& hits, const std::vector<std::shared_ptr<Light>>& lights,
+               dvec4* colors, RenderCounters& counters) const;
+
+private:
+    ///Hits of one type, with normals and view directions normalized once
+    struct Batch
+    {
+        std::vector<size_t> index;
+        std::vector<uint32_t> param;
+        std::vector<dvec3> position;
+        std::vector<dvec3> normal;
+        std::vector<dvec3> view;
+        std::vector<const uint8_t*> lightVisible;
+        std::vector<const double*> lightWeight;
+
+        void add(const size_t i, const Hit& hit, const uint32_t paramIndex);
+    };
+
+    void shadeConstant(const Batch& batch, const std::vector<std::shared_ptr<Light>>& lights,
+                       dvec4* colors, RenderCounters& counters) const;
+    void shadePhong(const Batch& batch, const std::vector<std::shared_ptr<Light>>& lights,
+                    dvec4* colors, RenderCounters& counters) const;
+    void shadeCookTorrance(const Batch& batch, const std::vector<std::shared_ptr<Light>>& lights,
+                           dvec4* colors, RenderCounters& counters) const;
+
+//Attributes
+private:
+    ///Per material, indexed by its id
+    std::vector<Type> types_;
+    std::vector<uint32_t> paramIndex_;
+    std::vector<double> reflectance_;
+    std::vector<dvec3> absorption_;
+    ///Keeps the materials alive, so that their addresses stay unique
+    std::vector<std::shared_ptr<const Material>> materials_;
+    std::unordered_map<const Material*, uint32_t> ids_;
+
+    ///Constant: color
+    std::vector<dvec3> constantColor_;
+
+    ///Phong
+    std::vector<dvec3> phongAmbient_;
+    std::vector<dvec3> phongDiffuse_;
+    std::vector<dvec3> phongSpecular_;
+    std::vector<double> phongShininess_;
+
+    ///Cook-Torrance, with the squared roughness and Fresnel reflectance at normal incidence
+    std::vector<dvec3> cookAmbient_;
+    std::vector<dvec3> cookAlbedo_;
+    std::vector<double> cookRoughness2_;
+    std::vector<double> cookF0_;
+};
+
+}// namespace inviwo
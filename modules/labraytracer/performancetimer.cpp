@@ -28,12 +28,6 @@ namespace inviwo
 
 PerformanceTimer::PerformanceTimer()
 {
-	#ifdef WIN32
-		QueryPerformanceFrequency((LARGE_INTEGER*)&Frequency);
-	#else
-		Frequency = CLOCKS_PER_SEC;
-	#endif
-
 	Reset();
 }
 
@@ -46,24 +40,14 @@ PerformanceTimer::~PerformanceTimer()
 
 void PerformanceTimer::Reset()
 {
-	#ifdef WIN32
-		QueryPerformanceCounter((LARGE_INTEGER*)&Start);
-	#else
-		Start = clock();
-	#endif
+	Start = std::chrono::steady_clock::now();
 }
 
 
-float PerformanceTimer::ElapsedTime() const
+double PerformanceTimer::ElapsedTime() const
 {
-	#ifdef WIN32
-		__int64 End;
-		QueryPerformanceCounter((LARGE_INTEGER*)&End);
-	#else
-		clock_t End = clock();
-	#endif
-
-	return (float)(End - Start) / Frequency;
+	//clock() would return the processor time of all threads together
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
 }
 
 }
@@ -25,17 +25,16 @@
 
 #include <labraytracer/labraytracermoduledefine.h>
 
-#ifdef WIN32
-	#include <windows.h>
-#else
-	#include <time.h>
-#endif
+#include <chrono>
 
 namespace inviwo
 {
 
 /** Provides a simple timer to measure code performance.
 
+It measures monotonic wall-clock time, so that multi-threaded code is not reported
+with the summed processor time of all threads.
+
 @author Tino Weinkauf
 */
 class IVW_MODULE_LABRAYTRACER_API PerformanceTimer
@@ -52,12 +51,12 @@ public:
 //Methods
 public:
 	///Returns elapsed time since construction of the object in seconds
-	float ElapsedTime() const;
+	double ElapsedTime() const;
 
 	///Returns elapsed time since construction of the object in seconds and resets the clock.
-	inline float ElapsedTimeAndReset()
+	inline double ElapsedTimeAndReset()
 	{
-		const float Time = ElapsedTime();
+		const double Time = ElapsedTime();
 		Reset();
 		return Time;
 	}
@@ -67,13 +66,7 @@ public:
 
 //Attributes
 protected:
-	#ifdef WIN32
-		__int64 Start;
-		__int64 Frequency;
-	#else
-		clock_t Start;
-		clock_t Frequency;
-	#endif
+	std::chrono::steady_clock::time_point Start;
 };
 
 }
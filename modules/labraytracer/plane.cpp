@@ -23,24 +23,15 @@ PlaneX::PlaneX(const dvec3& normal, const dvec3& point)
 bool PlaneX::closestIntersection(const Ray& ray, double maxLambda,
                                  RayIntersection& intersection) const
 {
-    double d = dot(ray.getDirection(), normal_);
-
-    if (fabs(d) < Util::epsilon)
-    {
-        return false;
-    }
-
-    double a = dot((point_ - ray.getOrigin()), normal_);
-
-    double lambda = a / d;
-
-    if (lambda < 0 || lambda + Util::epsilon > maxLambda)
+    double lambda;
+    if (!Util::intersectRayPlane(ray.getOrigin(), ray.getDirection(), normal_, point_, maxLambda,
+                                 lambda))
     {
         return false;
     }
 
     const dvec3 uvw(0, 0, 0);
-    intersection = RayIntersection(ray, shared_from_this(), lambda, normal_, uvw);
+    intersection = RayIntersection(ray, this, lambda, normal_, uvw);
     return true;
 }
 
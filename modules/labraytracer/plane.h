@@ -41,6 +41,9 @@ public:
     void drawGeometry(std::shared_ptr<BasicMesh> mesh,
                       std::vector<BasicMesh::Vertex>& vertices) const override;
 
+    const dvec3& getNormal() const { return normal_; }
+    const dvec3& getPoint() const { return point_; }
+
 //Attributes
 private:
     dvec3 normal_;
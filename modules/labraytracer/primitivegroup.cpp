@@ -0,0 +1,415 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 09:57:45
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include <labraytracer/primitivegroup.h>
+#include <labraytracer/rayintersection.h>
+#include <labraytracer/util.h>
+#include <labraytracer/widebvtree.h>
+
+#include <algorithm>
+#include <typeinfo>
+
+namespace inviwo
+{
+
+namespace primitivegroup
+{
+//Defined in primitivegroup_avx.cpp, which is compiled for AVX
+bool isAVXCompiled();
+int intersectSpheresAVX(const double (*center)[8], const double* radius2, const double* origin,
+                        const double* direction, const double maxLambda, double* lambda);
+int intersectPlanesAVX(const double (*normal)[8], const double (*point)[8], const double* origin,
+                       const double* direction, const double maxLambda, const double epsilon, double* lambda);
+int intersectTrianglesAVX(const double (*p0)[8], const double (*e1)[8], const double (*e2)[8],
+                          const double (*n)[8], const double* origin, const double* direction,
+                          const double maxLambda, double* lambda, double* u, double* v);
+}
+
+namespace
+{
+constexpr int Width = PrimitiveGroup::Width;
+
+///Component i of the lanes as a vector
+dvec3 lane(const double (*lanes)[Width], const int i)
+{
+    return dvec3(lanes[0][i], lanes[1][i], lanes[2][i]);
+}
+
+//Portable kernels. Each lane is tested with the scalar intersection of the single primitive,
+//so the groups hit exactly what Sphere, PlaneX and Triangle hit. The AVX kernels do the same
+//operations in the same order.
+int intersectSpheresLanes(const double (*center)[Width], const double* radius2, const double* origin,
+                          const double* direction, const double maxLambda, double* lambda)
+{
+    const dvec3 O(origin[0], origin[1], origin[2]);
+    const dvec3 D(direction[0], direction[1], direction[2]);
+    int hitMask = 0;
+    for (int i = 0; i < Width; i++)
+    {
+        hitMask |= int(Util::intersectRaySphere(O, D, lane(center, i), radius2[i], maxLambda, lambda[i])) << i;
+    }
+    return hitMask;
+}
+
+int intersectPlanesLanes(const double (*normal)[Width], const double (*point)[Width], const double* origin,
+                         const double* direction, const double maxLambda, const double /*epsilon*/, double* lambda)
+{
+    const dvec3 O(origin[0], origin[1], origin[2]);
+    const dvec3 D(direction[0], direction[1], direction[2]);
+    int hitMask = 0;
+    for (int i = 0; i < Width; i++)
+    {
+        hitMask |= int(Util::intersectRayPlane(O, D, lane(normal, i), lane(point, i), maxLambda, lambda[i])) << i;
+    }
+    return hitMask;
+}
+
+int intersectTrianglesLanes(const double (*p0)[Width], const double (*e1)[Width], const double (*e2)[Width],
+                            const double (*n)[Width], const double* origin, const double* direction,
+                            const double maxLambda, double* lambda, double* u, double* v)
+{
+    const dvec3 O(origin[0], origin[1], origin[2]);
+    const dvec3 D(direction[0], direction[1], direction[2]);
+    int hitMask = 0;
+    for (int i = 0; i < Width; i++)
+    {
+        hitMask |= int(Util::intersectRayTriangle(O, D, lane(p0, i), lane(e1, i), lane(e2, i), lane(n, i),
+                                                  maxLambda, lambda[i], u[i], v[i])) << i;
+    }
+    return hitMask;
+}
+
+///The kernels are picked once, from the widest instruction set available
+struct Kernels
+{
+    decltype(&intersectSpheresLanes) spheres;
+    decltype(&intersectPlanesLanes) planes;
+    decltype(&intersectTrianglesLanes) triangles;
+};
+
+const Kernels& getKernels()
+{
+    static const Kernels Selected = primitivegroup::hasAVX()
+        ? Kernels{&primitivegroup::intersectSpheresAVX, &primitivegroup::intersectPlanesAVX,
+                  &primitivegroup::intersectTrianglesAVX}
+        : Kernels{&intersectSpheresLanes, &intersectPlanesLanes, &intersectTrianglesLanes};
+    return Selected;
+}
+
+///Lane with the smallest distance among the ones in hitMask, which must not be empty
+int closestLane(int hitMask, const double* lambda)
+{
+    int Closest = -1;
+    for (int i = 0; hitMask; i++, hitMask >>= 1)
+    {
+        if ((hitMask & 1) && (Closest < 0 || lambda[i] < lambda[Closest])) Closest = i;
+    }
+    return Closest;
+}
+
+///Copies the component of every primitive into the lanes; unused lanes repeat the first primitive
+template <typename Get>
+void fillLanes(double (*lanes)[Width], const int numPrimitives, Get&& get)
+{
+    for (int i = 0; i < Width; i++)
+    {
+        const dvec3 Value = get(i < numPrimitives ? i : 0);
+        for (int c = 0; c < 3; c++) lanes[c][i] = Value[c];
+    }
+}
+
+/** Reorders [begin, end) such that consecutive runs of Width primitives are close to each other.
+    The centroids are split at their median along the longest axis, rounded to a multiple of Width,
+    so that all groups but the last are full.
+*/
+void clusterByCentroid(std::vector<uint32_t>& order, const std::vector<dvec3>& centroids, const size_t begin,
+                       const size_t end)
+{
+    if (end - begin <= size_t(Width)) return;
+
+    BoundingBox Box;
+    for (size_t i(begin); i < end; i++) Box.expandByPoint(centroids[order[i]]);
+    const dvec3 Extent = Box.max() - Box.min();
+    const int Axis = (Extent[0] >= Extent[1] && Extent[0] >= Extent[2]) ? 0 : (Extent[1] >= Extent[2] ? 1 : 2);
+
+    const size_t NumGroups = (end - begin + Width - 1) / Width;
+    const size_t Middle = begin + (NumGroups / 2) * Width;
+    std::nth_element(order.begin() + begin, order.begin() + Middle, order.begin() + end,
+                     [&](const uint32_t a, const uint32_t b) { return centroids[a][Axis] < centroids[b][Axis]; });
+    clusterByCentroid(order, centroids, begin, Middle);
+    clusterByCentroid(order, centroids, Middle, end);
+}
+
+///Groups the primitives in runs of Width along the order
+template <typename Group, typename Primitive>
+void addGroups(std::vector<std::shared_ptr<Renderable>>& groups,
+               const std::vector<std::shared_ptr<Primitive>>& primitives, const std::vector<uint32_t>& order)
+{
+    std::vector<std::shared_ptr<Primitive>> Members;
+    for (size_t begin(0); begin < order.size(); begin += Width)
+    {
+        Members.clear();
+        for (size_t i(begin); i < std::min(begin + Width, order.size()); i++) Members.push_back(primitives[order[i]]);
+        groups.push_back(std::make_shared<Group>(Members));
+    }
+}
+
+template <typename Primitive>
+std::vector<uint32_t> clusterPrimitives(const std::vector<std::shared_ptr<Primitive>>& primitives)
+{
+    std::vector<dvec3> Centroids(primitives.size());
+    std::vector<uint32_t> Order(primitives.size());
+    for (size_t i(0); i < primitives.size(); i++)
+    {
+        BoundingBox Box;
+        primitives[i]->getBoundingBox(Box);
+        Centroids[i] = (Box.min() + Box.max()) * 0.5;
+        Order[i] = uint32_t(i);
+    }
+    clusterByCentroid(Order, Centroids, 0, Order.size());
+    return Order;
+}
+}
+
+bool primitivegroup::hasAVX()
+{
+    static const bool bHasAVX = isAVXCompiled() && widebvh::hasAVX();
+    return bHasAVX;
+}
+
+
+std::vector<std::shared_ptr<Renderable>> PrimitiveGroup::coalesce(
+    const std::vector<std::shared_ptr<Renderable>>& renderables)
+{
+    std::vector<std::shared_ptr<Renderable>> Result;
+    std::vector<std::shared_ptr<Sphere>> Spheres;
+    std::vector<std::shared_ptr<PlaneX>> Planes;
+    std::vector<std::shared_ptr<Triangle>> Triangles;
+    for (const auto& R : renderables)
+    {
+        //Subclasses may intersect differently, so only the exact types are grouped
+        const std::type_info& Type = typeid(*R);
+        if (Type == typeid(Sphere))
+        {
+            Spheres.push_back(std::static_pointer_cast<Sphere>(R));
+        }
+        else if (Type == typeid(PlaneX))
+        {
+            Planes.push_back(std::static_pointer_cast<PlaneX>(R));
+        }
+        else if (Type == typeid(Triangle))
+        {
+            Triangles.push_back(std::static_pointer_cast<Triangle>(R));
+        }
+        else
+        {
+            Result.push_back(R);
+        }
+    }
+
+    addGroups<SphereGroup>(Result, Spheres, clusterPrimitives(Spheres));
+    addGroups<TriangleSoup>(Result, Triangles, clusterPrimitives(Triangles));
+    std::vector<uint32_t> PlaneOrder(Planes.size());
+    for (size_t i(0); i < Planes.size(); i++) PlaneOrder[i] = uint32_t(i);
+    addGroups<PlaneGroup>(Result, Planes, PlaneOrder);
+    return Result;
+}
+
+bool PrimitiveGroup::closestIntersection(const Ray& ray, double maxLambda, RayIntersection& intersection) const
+{
+    HitRecord Hit;
+    if (!closestHit(ray, maxLambda, Hit)) return false;
+    intersection = makeIntersection(ray, Hit);
+    return true;
+}
+
+bool PrimitiveGroup::anyIntersection(const Ray& ray, double maxLambda) const
+{
+    double Lambda[Width], U[Width], V[Width];
+    return intersectLanes(ray, maxLambda, Lambda, U, V) != 0;
+}
+
+bool PrimitiveGroup::closestHit(const Ray& ray, double maxLambda, HitRecord& hit) const
+{
+    //Only triangles have barycentric coordinates
+    alignas(32) double Lambda[Width], U[Width] = {}, V[Width] = {};
+    const int HitMask = intersectLanes(ray, maxLambda, Lambda, U, V);
+    if (!HitMask) return false;
+
+    const int Lane = closestLane(HitMask, Lambda);
+    hit.renderable = this;
+    hit.primitive = uint32_t(Lane);
+    hit.lambda = Lambda[Lane];
+    hit.u = U[Lane];
+    hit.v = V[Lane];
+    return true;
+}
+
+bool PrimitiveGroup::anyHit(const Ray& ray, double maxLambda, HitRecord& hit) const
+{
+    double Lambda[Width], U[Width], V[Width];
+    const int HitMask = intersectLanes(ray, maxLambda, Lambda, U, V);
+    if (!HitMask) return false;
+
+    //Any lane will do as the occluder
+    int Lane(0);
+    while (!(HitMask & (1 << Lane))) Lane++;
+    hit.renderable = this;
+    hit.primitive = uint32_t(Lane);
+    return true;
+}
+
+bool PrimitiveGroup::anyPrimitiveIntersection(const Ray& ray, double maxLambda, const uint32_t primitive) const
+{
+    double Lambda[Width], U[Width], V[Width];
+    return (intersectLanes(ray, maxLambda, Lambda, U, V) & (1 << primitive)) != 0;
+}
+
+
+SphereGroup::SphereGroup(const std::vector<std::shared_ptr<Sphere>>& spheres)
+    : mSpheres(spheres.begin(), spheres.begin() + std::min(spheres.size(), size_t(Width)))
+{
+    mNumPrimitives = int(mSpheres.size());
+    if (mSpheres.empty()) return;
+
+    fillLanes(mCenter, mNumPrimitives, [&](const int i) { return mSpheres[i]->center_; });
+    for (int i = 0; i < Width; i++)
+    {
+        const double Radius = mSpheres[i < mNumPrimitives ? i : 0]->radius_;
+        mRadius2[i] = Radius * Radius;
+    }
+    for (const auto& S : mSpheres)
+    {
+        BoundingBox SphereBox;
+        S->getBoundingBox(SphereBox);
+        mBox.merge(SphereBox);
+    }
+}
+
+int SphereGroup::intersectLanes(const Ray& ray, const double maxLambda, double* lambda, double* /*u*/,
+                                double* /*v*/) const
+{
+    if (!mNumPrimitives) return 0;
+    const dvec3& Origin = ray.getOrigin();
+    const dvec3& Direction = ray.getDirection();
+    const double O[3] = {Origin[0], Origin[1], Origin[2]};
+    const double D[3] = {Direction[0], Direction[1], Direction[2]};
+    const int HitMask = getKernels().spheres(mCenter, mRadius2, O, D, maxLambda, lambda);
+    return HitMask & ((1 << mNumPrimitives) - 1);
+}
+
+RayIntersection SphereGroup::makeIntersection(const Ray& ray, const HitRecord& hit) const
+{
+    const Sphere& S = *mSpheres[hit.primitive];
+    const dvec3 Normal = (ray.pointOnRay(hit.lambda) - S.center_) / S.radius_;
+    return RayIntersection(ray, &S, hit.lambda, Normal, dvec3(0, 0, 0));
+}
+
+bool SphereGroup::getBoundingBox(BoundingBox& box) const
+{
+    if (mSpheres.empty()) return false;
+    box = mBox;
+    return true;
+}
+
+void SphereGroup::drawGeometry(std::shared_ptr<BasicMesh> mesh, std::vector<BasicMesh::Vertex>& vertices) const
+{
+    for (const auto& S : mSpheres) S->drawGeometry(mesh, vertices);
+}
+
+
+PlaneGroup::PlaneGroup(const std::vector<std::shared_ptr<PlaneX>>& planes)
+    : mPlanes(planes.begin(), planes.begin() + std::min(planes.size(), size_t(Width)))
+{
+    mNumPrimitives = int(mPlanes.size());
+    if (mPlanes.empty()) return;
+
+    fillLanes(mNormal, mNumPrimitives, [&](const int i) { return mPlanes[i]->getNormal(); });
+    fillLanes(mPoint, mNumPrimitives, [&](const int i) { return mPlanes[i]->getPoint(); });
+}
+
+int PlaneGroup::intersectLanes(const Ray& ray, const double maxLambda, double* lambda, double* /*u*/,
+                               double* /*v*/) const
+{
+    if (!mNumPrimitives) return 0;
+    const dvec3& Origin = ray.getOrigin();
+    const dvec3& Direction = ray.getDirection();
+    const double O[3] = {Origin[0], Origin[1], Origin[2]};
+    const double D[3] = {Direction[0], Direction[1], Direction[2]};
+    const int HitMask = getKernels().planes(mNormal, mPoint, O, D, maxLambda, Util::epsilon, lambda);
+    return HitMask & ((1 << mNumPrimitives) - 1);
+}
+
+RayIntersection PlaneGroup::makeIntersection(const Ray& ray, const HitRecord& hit) const
+{
+    const PlaneX& P = *mPlanes[hit.primitive];
+    return RayIntersection(ray, &P, hit.lambda, P.getNormal(), dvec3(0, 0, 0));
+}
+
+void PlaneGroup::drawGeometry(std::shared_ptr<BasicMesh> mesh, std::vector<BasicMesh::Vertex>& vertices) const
+{
+    for (const auto& P : mPlanes) P->drawGeometry(mesh, vertices);
+}
+
+
+TriangleSoup::TriangleSoup(const std::vector<std::shared_ptr<Triangle>>& triangles)
+    : mTriangles(triangles.begin(), triangles.begin() + std::min(triangles.size(), size_t(Width)))
+{
+    mNumPrimitives = int(mTriangles.size());
+    if (mTriangles.empty()) return;
+
+    const auto Vertex = [&](const int i, const int k) { return mTriangles[i]->getVertex(k); };
+    fillLanes(mP0, mNumPrimitives, [&](const int i) { return Vertex(i, 0); });
+    fillLanes(mE1, mNumPrimitives, [&](const int i) { return Vertex(i, 1) - Vertex(i, 0); });
+    fillLanes(mE2, mNumPrimitives, [&](const int i) { return Vertex(i, 2) - Vertex(i, 0); });
+    fillLanes(mN, mNumPrimitives, [&](const int i) { return cross(Vertex(i, 1) - Vertex(i, 0), Vertex(i, 2) - Vertex(i, 0)); });
+    for (const auto& T : mTriangles)
+    {
+        BoundingBox TriangleBox;
+        T->getBoundingBox(TriangleBox);
+        mBox.merge(TriangleBox);
+    }
+}
+
+int TriangleSoup::intersectLanes(const Ray& ray, const double maxLambda, double* lambda, double* u,
+                                 double* v) const
+{
+    if (!mNumPrimitives) return 0;
+    const dvec3& Origin = ray.getOrigin();
+    const dvec3& Direction = ray.getDirection();
+    const double O[3] = {Origin[0], Origin[1], Origin[2]};
+    const double D[3] = {Direction[0], Direction[1], Direction[2]};
+    const int HitMask = getKernels().triangles(mP0, mE1, mE2, mN, O, D, maxLambda, lambda, u, v);
+    return HitMask & ((1 << mNumPrimitives) - 1);
+}
+
+RayIntersection TriangleSoup::makeIntersection(const Ray& ray, const HitRecord& hit) const
+{
+    const Triangle& T = *mTriangles[hit.primitive];
+    const int i = int(hit.primitive);
+    const dvec3 Normal = normalize(dvec3(mN[0][i], mN[1][i], mN[2][i]));
+    const dvec3 uvw = T.getTextureCoordinate(0) * (1.0 - hit.u - hit.v) + T.getTextureCoordinate(1) * hit.u +
+                      T.getTextureCoordinate(2) * hit.v;
+    return RayIntersection(ray, &T, hit.lambda, Normal, uvw);
+}
+
+bool TriangleSoup::getBoundingBox(BoundingBox& box) const
+{
+    if (mTriangles.empty()) return false;
+    box = mBox;
+    return true;
+}
+
+void TriangleSoup::drawGeometry(std::shared_ptr<BasicMesh> mesh, std::vector<BasicMesh::Vertex>& vertices) const
+{
+    for (const auto& T : mTriangles) T->drawGeometry(mesh, vertices);
+}
+
+}// namespace inviwo
@@ -0,0 +1,162 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 09:57:45
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <labraytracer/labraytracermoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <labraytracer/renderable.h>
+#include <labraytracer/boundingbox.h>
+#include <labraytracer/plane.h>
+#include <labraytracer/sphere.h>
+#include <labraytracer/triangle.h>
+
+#include <memory>
+#include <vector>
+
+namespace inviwo
+{
+
+/** \class PrimitiveGroup
+    \brief Up to Width simple primitives of one type, tested against a ray all at once
+
+    The geometry is copied into structure-of-arrays lanes, so that a single kernel call tests
+    the ray against every primitive of the group with AVX. Without AVX, the lanes are tested one by one
+    with the scalar intersections in Util, which Sphere, PlaneX and Triangle use as well. A hit refers to the lane in HitRecord::primitive; its intersection is made
+    with the original primitive, so that the material and shading are the same as without grouping.
+
+    coalesce() replaces the plain spheres, planes and triangles of a scene by groups.
+*/
+class IVW_MODULE_LABRAYTRACER_API PrimitiveGroup : public Renderable
+{
+//Friends
+//Types
+public:
+    ///Primitives per group; two AVX registers of doubles
+    static constexpr int Width = 8;
+
+//Construction / Deconstruction
+public:
+    PrimitiveGroup() = default;
+    virtual ~PrimitiveGroup() = default;
+
+//Methods
+public:
+    /** Returns the renderables with every Sphere, PlaneX and Triangle, but none of their subclasses,
+        replaced by groups. Spheres and triangles are grouped with their nearest neighbors by
+        recursive median splits, all planes are put in groups in the order given.
+        The others are returned as they are.
+    */
+    static std::vector<std::shared_ptr<Renderable>> coalesce(
+        const std::vector<std::shared_ptr<Renderable>>& renderables);
+
+    ///Number of primitives in the group, at most Width
+    int getNumPrimitives() const { return mNumPrimitives; }
+
+    bool closestIntersection(const Ray& ray, double maxLambda,
+                             RayIntersection& intersection) const override;
+    bool anyIntersection(const Ray& ray, double maxLambda) const override;
+    bool closestHit(const Ray& ray, double maxLambda, HitRecord& hit) const override;
+    bool anyHit(const Ray& ray, double maxLambda, HitRecord& hit) const override;
+    bool anyPrimitiveIntersection(const Ray& ray, double maxLambda, const uint32_t primitive) const override;
+
+protected:
+    /** Tests the ray against all lanes. Returns the mask of the primitives hit within maxLambda
+        and writes the distances to lambda; triangles also write their barycentric coordinates.
+    */
+    virtual int intersectLanes(const Ray& ray, const double maxLambda, double* lambda, double* u,
+                               double* v) const = 0;
+
+    int mNumPrimitives = 0;
+};
+
+/** \class SphereGroup
+    \brief Spheres hit from outside or inside, as in CSGSphereGroup
+*/
+class IVW_MODULE_LABRAYTRACER_API SphereGroup : public PrimitiveGroup
+{
+public:
+    ///Takes up to Width spheres, the others are ignored
+    explicit SphereGroup(const std::vector<std::shared_ptr<Sphere>>& spheres);
+
+    RayIntersection makeIntersection(const Ray& ray, const HitRecord& hit) const override;
+    bool getBoundingBox(BoundingBox& box) const override;
+    void drawGeometry(std::shared_ptr<BasicMesh> mesh,
+                      std::vector<BasicMesh::Vertex>& vertices) const override;
+
+protected:
+    int intersectLanes(const Ray& ray, const double maxLambda, double* lambda, double* u,
+                       double* v) const override;
+
+private:
+    std::vector<std::shared_ptr<Sphere>> mSpheres;
+    BoundingBox mBox;
+    alignas(32) double mCenter[3][Width];
+    alignas(32) double mRadius2[Width];
+};
+
+/** \class PlaneGroup
+    \brief Unbounded planes, with the tolerances of PlaneX
+*/
+class IVW_MODULE_LABRAYTRACER_API PlaneGroup : public PrimitiveGroup
+{
+public:
+    ///Takes up to Width planes, the others are ignored
+    explicit PlaneGroup(const std::vector<std::shared_ptr<PlaneX>>& planes);
+
+    RayIntersection makeIntersection(const Ray& ray, const HitRecord& hit) const override;
+    void drawGeometry(std::shared_ptr<BasicMesh> mesh,
+                      std::vector<BasicMesh::Vertex>& vertices) const override;
+
+protected:
+    int intersectLanes(const Ray& ray, const double maxLambda, double* lambda, double* u,
+                       double* v) const override;
+
+private:
+    std::vector<std::shared_ptr<PlaneX>> mPlanes;
+    alignas(32) double mNormal[3][Width];
+    alignas(32) double mPoint[3][Width];
+};
+
+/** \class TriangleSoup
+    \brief Unconnected triangles, intersected as in Util::intersectRayTriangle()
+*/
+class IVW_MODULE_LABRAYTRACER_API TriangleSoup : public PrimitiveGroup
+{
+public:
+    ///Takes up to Width triangles, the others are ignored
+    explicit TriangleSoup(const std::vector<std::shared_ptr<Triangle>>& triangles);
+
+    ///Face normal and interpolated texture coordinates
+    RayIntersection makeIntersection(const Ray& ray, const HitRecord& hit) const override;
+    bool getBoundingBox(BoundingBox& box) const override;
+    void drawGeometry(std::shared_ptr<BasicMesh> mesh,
+                      std::vector<BasicMesh::Vertex>& vertices) const override;
+
+protected:
+    int intersectLanes(const Ray& ray, const double maxLambda, double* lambda, double* u,
+                       double* v) const override;
+
+private:
+    std::vector<std::shared_ptr<Triangle>> mTriangles;
+    BoundingBox mBox;
+    alignas(32) double mP0[3][Width];
+    alignas(32) double mE1[3][Width];
+    alignas(32) double mE2[3][Width];
+    alignas(32) double mN[3][Width];
+};
+
+namespace primitivegroup
+{
+///Whether the processor and the build support the AVX kernels
+IVW_MODULE_LABRAYTRACER_API bool hasAVX();
+}
+
+}// namespace inviwo
@@ -0,0 +1,185 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 09:57:45
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+//This file is compiled with AVX enabled (see CMakeLists.txt) and is only called after
+//primitivegroup::hasAVX() has confirmed processor support. As widebvtree_avx.cpp, it includes
+//no other headers, so that no inline function compiled for AVX can be picked by the linker.
+//The kernels do the same operations in the same order as Util::intersectRaySphere(), intersectRayPlane()
+//and intersectRayTriangle(), which the lane loops in primitivegroup.cpp call, so that both give the same hits.
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+namespace inviwo
+{
+
+namespace primitivegroup
+{
+
+#ifdef __AVX__
+namespace
+{
+///Four lanes of a vector given as three arrays of 8 lanes
+struct Lanes4
+{
+    __m256d x, y, z;
+};
+
+inline Lanes4 load(const double (*v)[8], const int offset)
+{
+    return {_mm256_load_pd(v[0] + offset), _mm256_load_pd(v[1] + offset), _mm256_load_pd(v[2] + offset)};
+}
+
+inline Lanes4 broadcast(const double* v)
+{
+    return {_mm256_set1_pd(v[0]), _mm256_set1_pd(v[1]), _mm256_set1_pd(v[2])};
+}
+
+inline Lanes4 sub(const Lanes4& a, const Lanes4& b)
+{
+    return {_mm256_sub_pd(a.x, b.x), _mm256_sub_pd(a.y, b.y), _mm256_sub_pd(a.z, b.z)};
+}
+
+inline __m256d dot(const Lanes4& a, const Lanes4& b)
+{
+    return _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(a.x, b.x), _mm256_mul_pd(a.y, b.y)), _mm256_mul_pd(a.z, b.z));
+}
+
+inline Lanes4 cross(const Lanes4& a, const Lanes4& b)
+{
+    return {_mm256_sub_pd(_mm256_mul_pd(a.y, b.z), _mm256_mul_pd(b.y, a.z)),
+            _mm256_sub_pd(_mm256_mul_pd(a.z, b.x), _mm256_mul_pd(b.z, a.x)),
+            _mm256_sub_pd(_mm256_mul_pd(a.x, b.y), _mm256_mul_pd(b.x, a.y))};
+}
+}
+#endif
+
+bool isAVXCompiled()
+{
+#ifdef __AVX__
+    return true;
+#else
+    return false;
+#endif
+}
+
+int intersectSpheresAVX(const double (*center)[8], const double* radius2, const double* origin,
+                        const double* direction, const double maxLambda, double* lambda)
+{
+#ifdef __AVX__
+    const Lanes4 O = broadcast(origin);
+    const Lanes4 D = broadcast(direction);
+    const __m256d Zero = _mm256_setzero_pd();
+    const __m256d Max = _mm256_set1_pd(maxLambda);
+    const __m256d SignBit = _mm256_set1_pd(-0.0);
+    int hitMask = 0;
+    for (int offset = 0; offset < 8; offset += 4)
+    {
+        const Lanes4 OC = sub(O, load(center, offset));
+        const __m256d b = dot(OC, D);
+        const __m256d c = _mm256_sub_pd(dot(OC, OC), _mm256_load_pd(radius2 + offset));
+        const __m256d Discriminant = _mm256_sub_pd(_mm256_mul_pd(b, b), c);
+        const __m256d Root = _mm256_sqrt_pd(_mm256_max_pd(Discriminant, Zero));
+        const __m256d MinusB = _mm256_xor_pd(b, SignBit);
+        const __m256d Enter = _mm256_sub_pd(MinusB, Root);
+        const __m256d Leave = _mm256_add_pd(MinusB, Root);
+        //The entry unless the ray starts inside
+        const __m256d t = _mm256_blendv_pd(Leave, Enter, _mm256_cmp_pd(Enter, Zero, _CMP_GT_OQ));
+        const __m256d bHit = _mm256_and_pd(_mm256_cmp_pd(Discriminant, Zero, _CMP_GE_OQ),
+                                           _mm256_and_pd(_mm256_cmp_pd(t, Zero, _CMP_GT_OQ),
+                                                         _mm256_cmp_pd(t, Max, _CMP_LT_OQ)));
+        _mm256_storeu_pd(lambda + offset, t);
+        hitMask |= _mm256_movemask_pd(bHit) << offset;
+    }
+    return hitMask;
+#else
+    (void)center; (void)radius2; (void)origin; (void)direction; (void)maxLambda; (void)lambda;
+    return 0;
+#endif
+}
+
+int intersectPlanesAVX(const double (*normal)[8], const double (*point)[8], const double* origin,
+                       const double* direction, const double maxLambda, const double epsilon, double* lambda)
+{
+#ifdef __AVX__
+    const Lanes4 O = broadcast(origin);
+    const Lanes4 D = broadcast(direction);
+    const __m256d Zero = _mm256_setzero_pd();
+    const __m256d Max = _mm256_set1_pd(maxLambda);
+    const __m256d Epsilon = _mm256_set1_pd(epsilon);
+    const __m256d SignBit = _mm256_set1_pd(-0.0);
+    int hitMask = 0;
+    for (int offset = 0; offset < 8; offset += 4)
+    {
+        const Lanes4 N = load(normal, offset);
+        const __m256d d = dot(D, N);
+        const __m256d a = dot(sub(load(point, offset), O), N);
+        const __m256d t = _mm256_div_pd(a, d);
+        //Negated rejections of PlaneX, which let NaNs through the same way
+        const __m256d bHit = _mm256_and_pd(
+            _mm256_cmp_pd(_mm256_andnot_pd(SignBit, d), Epsilon, _CMP_NLT_UQ),
+            _mm256_and_pd(_mm256_cmp_pd(t, Zero, _CMP_NLT_UQ),
+                          _mm256_cmp_pd(_mm256_add_pd(t, Epsilon), Max, _CMP_NGT_UQ)));
+        _mm256_storeu_pd(lambda + offset, t);
+        hitMask |= _mm256_movemask_pd(bHit) << offset;
+    }
+    return hitMask;
+#else
+    (void)normal; (void)point; (void)origin; (void)direction; (void)maxLambda; (void)epsilon; (void)lambda;
+    return 0;
+#endif
+}
+
+int intersectTrianglesAVX(const double (*p0)[8], const double (*e1)[8], const double (*e2)[8],
+                          const double (*n)[8], const double* origin, const double* direction,
+                          const double maxLambda, double* lambda, double* u, double* v)
+{
+#ifdef __AVX__
+    const Lanes4 O = broadcast(origin);
+    const Lanes4 D = broadcast(direction);
+    const __m256d Zero = _mm256_setzero_pd();
+    const __m256d One = _mm256_set1_pd(1.0);
+    const __m256d Max = _mm256_set1_pd(maxLambda);
+    const __m256d SignBit = _mm256_set1_pd(-0.0);
+    int hitMask = 0;
+    for (int offset = 0; offset < 8; offset += 4)
+    {
+        const Lanes4 N = load(n, offset);
+        const __m256d Det = dot(D, N);
+        const __m256d InvDet = _mm256_div_pd(One, Det);
+        const Lanes4 C = sub(load(p0, offset), O);
+        const Lanes4 R = cross(D, C);
+        const __m256d U = _mm256_mul_pd(_mm256_xor_pd(dot(R, load(e2, offset)), SignBit), InvDet);
+        const __m256d V = _mm256_mul_pd(dot(R, load(e1, offset)), InvDet);
+        const __m256d t = _mm256_mul_pd(dot(C, N), InvDet);
+        const __m256d bInside = _mm256_and_pd(
+            _mm256_and_pd(_mm256_cmp_pd(U, Zero, _CMP_NLT_UQ), _mm256_cmp_pd(U, One, _CMP_NGT_UQ)),
+            _mm256_and_pd(_mm256_cmp_pd(V, Zero, _CMP_NLT_UQ),
+                          _mm256_cmp_pd(_mm256_add_pd(U, V), One, _CMP_NGT_UQ)));
+        const __m256d bHit = _mm256_and_pd(
+            _mm256_and_pd(_mm256_cmp_pd(Det, Zero, _CMP_NEQ_UQ), bInside),
+            _mm256_and_pd(_mm256_cmp_pd(t, Zero, _CMP_GT_OQ), _mm256_cmp_pd(t, Max, _CMP_LT_OQ)));
+        _mm256_storeu_pd(lambda + offset, t);
+        _mm256_storeu_pd(u + offset, U);
+        _mm256_storeu_pd(v + offset, V);
+        hitMask |= _mm256_movemask_pd(bHit) << offset;
+    }
+    return hitMask;
+#else
+    (void)p0; (void)e1; (void)e2; (void)n; (void)origin; (void)direction; (void)maxLambda;
+    (void)lambda; (void)u; (void)v;
+    return 0;
+#endif
+}
+
+}
+
+}
@@ -13,9 +13,9 @@
 namespace inviwo
 {
 
-RayIntersection::RayIntersection() {}
+RayIntersection::RayIntersection() : mRenderable(nullptr) {}
 
-RayIntersection::RayIntersection(const Ray& ray, std::shared_ptr<const Renderable> renderable,
+RayIntersection::RayIntersection(const Ray& ray, const Renderable* renderable,
                                  const double lambda, const dvec3& normal, const dvec3& uvw)
 {
     mRay = ray;
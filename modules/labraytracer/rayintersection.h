@@ -20,6 +20,23 @@ namespace inviwo
 
 class Renderable;
 
+/** \struct HitRecord
+    \brief Closest hit found so far during the traversal
+
+    Small enough to be copied for every candidate; the full RayIntersection is only made
+    for the final hit, see Renderable::makeIntersection().
+*/
+struct HitRecord
+{
+    const Renderable* renderable = nullptr;
+    ///Index of the hit primitive within the renderable, e.g. a triangle
+    uint32_t primitive = 0;
+    double lambda = std::numeric_limits<double>::infinity();
+    ///Barycentric coordinates of the hit w.r.t. the second and third vertex of a triangle
+    double u = 0;
+    double v = 0;
+};
+
 /** \class RayIntersection
     \brief Intersection of a Renderable with a ray. 
         It is defined by the intersection point, normal at the intersection, etc.
@@ -36,7 +53,8 @@ public:
 public:
     RayIntersection();
 
-    RayIntersection(const Ray& ray, std::shared_ptr<const Renderable> renderable,
+    ///The renderable is owned by the scene and must outlive the intersection
+    RayIntersection(const Ray& ray, const Renderable* renderable,
                     const double lambda, const dvec3& normal, const dvec3& uvw);
 
     virtual ~RayIntersection() = default;
@@ -46,14 +64,14 @@ public:
     double getLambda() const { return mLambda; }
     const dvec3& getNormal() const { return mNormal; }
     const dvec3& getPosition() const { return mPosition; }
-    std::shared_ptr<const Renderable> getRenderable() const { return mRenderable; }
+    const Renderable* getRenderable() const { return mRenderable; }
     const Ray& getRay() const { return mRay; }
     const dvec3& getUVW() const { return mUVW; }
 
 //Attributes
 protected:
     Ray mRay;
-    std::shared_ptr<const Renderable> mRenderable;
+    const Renderable* mRenderable;
     double mLambda;
     dvec3 mPosition;
     dvec3 mNormal;
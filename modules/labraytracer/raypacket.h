@@ -0,0 +1,60 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 08:24:55
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <labraytracer/labraytracermoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <labraytracer/ray.h>
+
+namespace inviwo
+{
+
+/** Up to eight coherent rays, e.g. primary rays of neighboring pixels or shadow rays toward
+    the same light, that are traced through a hierarchy together.
+
+    The rays are kept as they are for the exact primitive tests. For the box tests, origins and
+    inverse directions are stored in single precision as a structure of arrays, so that one box
+    is tested against all rays at once. Queries take a mask of the lanes to consider.
+*/
+struct RayPacket8
+{
+    static constexpr int Size = 8;
+    static constexpr int AllLanes = (1 << Size) - 1;
+
+    RayPacket8()
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            for (int lane = 0; lane < Size; lane++)
+            {
+                origin[i][lane] = 0.0f;
+                invDirection[i][lane] = 0.0f;
+            }
+        }
+    }
+
+    void setRay(const int lane, const Ray& ray)
+    {
+        rays[lane] = ray;
+        for (int i = 0; i < 3; i++)
+        {
+            origin[i][lane] = float(ray.getOrigin()[i]);
+            invDirection[i][lane] = float(1.0 / ray.getDirection()[i]);
+        }
+    }
+
+    Ray rays[Size];
+    ///Indexed as [axis][lane]
+    alignas(32) float origin[3][Size];
+    alignas(32) float invDirection[3][Size];
+};
+
+}// namespace inviwo
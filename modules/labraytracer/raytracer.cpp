@@ -11,6 +11,11 @@
 #include <labraytracer/raytracer.h>
 #include <inviwo/core/datastructures/image/layerram.h>
 #include <inviwo/core/datastructures/camera/perspectivecamera.h>
+#include <inviwo/core/common/inviwoapplication.h>
+#include <labraytracer/performancetimer.h>
+#include <labraytracer/batchrenderer.h>
+
+#include <mutex>
 
 namespace inviwo
 {
@@ -57,14 +62,52 @@ Raytracer::Raytracer()
                     dvec3(.1), InvalidationLevel::InvalidOutput, PropertySemantics::Color)
     ,inputMeshColor_("inputMeshColor", "Mesh Color", dvec3(0.5, 0.9, 0.5), dvec3(0), dvec3(1),
                    dvec3(.1), InvalidationLevel::InvalidOutput, PropertySemantics::Color)
+    ,meshStorage_("meshStorage", "Mesh Storage",
+                    {{"double", "Double", IndexedTriangleMesh::VertexStorage::Double}
+                    ,{"float", "Float", IndexedTriangleMesh::VertexStorage::Float}
+                    ,{"quantized", "Float, Quantized Normals", IndexedTriangleMesh::VertexStorage::Quantized}
+                    ,{"reference", "Reference Input", IndexedTriangleMesh::VertexStorage::External}},
+                    0)
     ,useSpecificSeedPrettySpheres_("useSpecificSeedPrettySpheres", "Use Seed", false)
     ,seedPrettySpheres_("seedPrettySpheres", "Seed", 0, INT_MIN, INT_MAX, 1,
                     InvalidationLevel::InvalidOutput, PropertySemantics::Text)
     ,imageSize_("imSize", "Image Size", ivec2(100, 100), ivec2(10, 10), ivec2(1000, 1000), ivec2(1, 1))
     ,adaptiveAntiAliasing_("adaptiveAntiAliasing", "Adaptive Anti-Aliasing")
+    ,antiAliasingSamples_("antiAliasingSamples", "Max Samples per Pixel", {{"four", "2x2", 4}, {"sixteen", "4x4", 16}}, 1)
+    ,antiAliasingThreshold_("antiAliasingThreshold", "Anti-Aliasing Threshold", 0.1, 0.001, 1.0, 0.001)
     ,lightIntensity_("lightIntensity", "Brightness", 100, 0, 255, 1)
     ,maxRecursiveDepth_("maxRecursiveDepth", "Depth", 1, 0, 3)
+    ,bvhMaxLeafSize_("bvhMaxLeafSize", "BVH Leaf Size", 4, 1, 16)
+    ,bvhNodeWidth_("bvhNodeWidth", "BVH Node Width",
+                    {{"binary", "Binary", BVHIndexedTriangleMesh::NodeWidth::Binary}
+                    ,{"four", "4-wide", BVHIndexedTriangleMesh::NodeWidth::Four}
+                    ,{"eight", "8-wide", BVHIndexedTriangleMesh::NodeWidth::Eight}
+                    ,{"auto", "Auto", BVHIndexedTriangleMesh::NodeWidth::Auto}},
+                    3)
+    ,bvhCache_("bvhCache", "BVH Disk Cache", true)
+    ,numThreads_("numThreads", "Threads", 0, 0, 256)
+    ,tileSize_("tileSize", "Tile Size", {{"16", "16x16", 16}, {"32", "32x32", 32}}, 0)
+    ,packetTracing_("packetTracing", "Ray Packets", true)
+    ,wavefrontReflections_("wavefrontReflections", "Wavefront Reflections", false)
+    ,primitiveGroups_("primitiveGroups", "Primitive Groups", true)
+    ,lightCullingThreshold_("lightCullingThreshold", "Light Culling", 0.0, 0.0, 0.01, 0.0001)
+    ,lightSamples_("lightSamples", "Light Samples", 0, 0, 64)
+    ,occluderCache_("occluderCache", "Occluder Cache", true)
+    ,firstHitCache_("firstHitCache", "Cache First Hits", true)
     ,render_("render", "Render")
+    ,renderOnChange_("renderOnChange", "Render on Change", false)
+    ,previewInterval_("previewInterval", "Preview Interval (ms)", 250, 10, 5000)
+    ,statisticsFile_("statisticsFile", "Statistics File")
+    ,stageTimings_("stageTimings", "Stage Timings", false)
+    ,renderAnimation_("renderAnimation", "Render Animation")
+    ,animationFrames_("animationFrames", "Animation Frames", 1801, 2, 100000)
+    ,animationSwing_("animationSwing", "Turntable Swing", true)
+    ,animationKeyframes_("animationKeyframes", "Camera Keyframes")
+    ,animationFile_("animationFile", "Animation Output")
+    ,bRenderRequested_(false)
+    ,bAnimationRequested_(false)
+    ,sceneBuildSeconds_(0)
+    ,gBuffer_(std::make_shared<GBuffer>())
 {
     triangleInput_.setOptional(true);
     addPort(triangleInput_);
@@ -91,15 +134,44 @@ Raytracer::Raytracer()
     addProperty(specularLight_);
 
     addProperty(inputMeshColor_);
+    addProperty(meshStorage_);
     addProperty(useSpecificSeedPrettySpheres_);
     addProperty(seedPrettySpheres_);
 
+    adaptiveAntiAliasing_.onChange([&]() { showProperties(); });
     addProperty(adaptiveAntiAliasing_);
+    addProperty(antiAliasingSamples_);
+    addProperty(antiAliasingThreshold_);
     addProperty(lightIntensity_);
     addProperty(maxRecursiveDepth_);
-
-    render_.onChange([&]() { render(); });
+    addProperty(bvhMaxLeafSize_);
+    addProperty(bvhNodeWidth_);
+    addProperty(bvhCache_);
+    addProperty(numThreads_);
+    addProperty(tileSize_);
+    addProperty(packetTracing_);
+    addProperty(wavefrontReflections_);
+    addProperty(primitiveGroups_);
+    addProperty(lightCullingThreshold_);
+    addProperty(lightSamples_);
+    addProperty(occluderCache_);
+    addProperty(firstHitCache_);
+
+    render_.onChange([&]() { bRenderRequested_ = true; });
     addProperty(render_);
+    addProperty(renderOnChange_);
+    addProperty(previewInterval_);
+    statisticsFile_.setAcceptMode(AcceptMode::Save);
+    addProperty(statisticsFile_);
+    addProperty(stageTimings_);
+
+    renderAnimation_.onChange([&]() { bAnimationRequested_ = true; });
+    addProperty(renderAnimation_);
+    addProperty(animationFrames_);
+    addProperty(animationSwing_);
+    addProperty(animationKeyframes_);
+    animationFile_.setAcceptMode(AcceptMode::Save);
+    addProperty(animationFile_);
 
     sceneSelection_.onChange([&]() { showProperties(); });
     lightInput_.onConnect([&]() { showProperties(); });
@@ -108,6 +180,11 @@ Raytracer::Raytracer()
     showProperties();
 }
 
+Raytracer::~Raytracer()
+{
+    cancelRendering();
+}
+
 void Raytracer::showProperties()
 {
     const bool bFirstScene = (sceneSelection_.get() == SceneCreationMethod::Intersections);
@@ -115,11 +192,18 @@ void Raytracer::showProperties()
     const bool bUseSeed = useSpecificSeedPrettySpheres_.get();
     const bool bHaveInLights = lightInput_.hasData();
     const bool bHaveInTriangles = triangleInput_.hasData();
+    const bool bAntiAliasing = adaptiveAntiAliasing_.get();
 
     ambientLight_.setVisible(!bFirstScene && !bHaveInLights);
     diffuseLight_.setVisible(!bFirstScene && !bHaveInLights);
     specularLight_.setVisible(!bFirstScene && !bHaveInLights);
     inputMeshColor_.setVisible(bHaveInTriangles);
+    meshStorage_.setVisible(bHaveInTriangles);
+    bvhMaxLeafSize_.setVisible(bHaveInTriangles);
+    bvhNodeWidth_.setVisible(bHaveInTriangles);
+    bvhCache_.setVisible(bHaveInTriangles);
+    antiAliasingSamples_.setVisible(bAntiAliasing);
+    antiAliasingThreshold_.setVisible(bAntiAliasing);
     useSpecificSeedPrettySpheres_.setVisible(bPrettySpheres);
     seedPrettySpheres_.setVisible(bPrettySpheres);
     seedPrettySpheres_.setReadOnly(!bUseSeed); 
@@ -166,28 +250,86 @@ void Raytracer::makeAScene()
         default:
             break;
     }
+    addSceneLights();
+}
+
+
+Scene Raytracer::buildScene(const SceneCreationMethod method, const ivec2& imageSize)
+{
+    sceneSelection_.set(method);
+    makeAScene();
+
+    Scene scene(scene_);
+    scene.init(imageSize);
+    if (auto PCam = dynamic_cast<PerspectiveCamera*>(&camera_.get()))
+    {
+        scene.setCameraProperties(PCam->getLookFrom(), PCam->getLookTo(), PCam->getLookUp(), PCam->getFovy());
+    }
+    scene.backgroundColor = dvec4(backgroundColor_.get(), 1);
+    scene.lightIntensity = lightIntensity_.get();
+    return scene;
+}
+
+
+void Raytracer::updateLights()
+{
+    //Nothing to keep yet
+    if (scene_.getRenderables().empty())
+    {
+        makeAScene();
+        return;
+    }
+
+    scene_.clearLights();
+    addSceneLights();
 }
 
 
 void Raytracer::process()
 {
+    //Every change outdates a rendering in progress. Also, it must not use the input meshes while they are rebuilt.
+    cancelRendering();
+
     auto PCam = dynamic_cast<PerspectiveCamera*>(&camera_.get());
     if (!PCam) return;
 
+    //Converted input meshes are only valid as long as the input does not change
+    if (triangleInput_.isChanged() || meshStorage_.isModified()) inputMeshCache_.clear();
+
     //Init scene; avoid regenerating when unimportant changes have been made.
-    if (sceneSelection_.isModified() || lightInput_.isChanged() || triangleInput_.isChanged()
-        || ambientLight_.isModified() || diffuseLight_.isModified() || specularLight_.isModified()
-        || inputMeshColor_.isModified()
+    // - prepared state (hierarchies) is reused by the scene and the input meshes unless geometry changed
+    // - changes of the lights alone keep the renderables, so that the cached first hits stay valid
+    if (sceneSelection_.isModified() || triangleInput_.isChanged()
+        || inputMeshColor_.isModified() || meshStorage_.isModified() || bvhMaxLeafSize_.isModified() || bvhNodeWidth_.isModified()
         || useSpecificSeedPrettySpheres_.isModified() || seedPrettySpheres_.isModified())
     {
+        PerformanceTimer Timer;
         makeAScene();
+        sceneBuildSeconds_ = Timer.ElapsedTime();
     }
+    else if (lightInput_.isChanged() || ambientLight_.isModified() || diffuseLight_.isModified()
+             || specularLight_.isModified())
+    {
+        PerformanceTimer Timer;
+        updateLights();
+        sceneBuildSeconds_ = Timer.ElapsedTime();
+    }
+    if (!firstHitCache_.get()) gBuffer_->clear();
     // - image size, camera, and some other params always get updated
     scene_.init(imageSize_.get());
     scene_.setCameraProperties(PCam->getLookFrom(), PCam->getLookTo(), PCam->getLookUp(), PCam->getFovy());
     scene_.backgroundColor = dvec4(backgroundColor_.get(), 1);
     scene_.lightIntensity = lightIntensity_.get();
     scene_.useAdaptiveAntiAliasing = adaptiveAntiAliasing_.get();
+    scene_.maxSamplesPerPixel = antiAliasingSamples_.get();
+    scene_.antiAliasingThreshold = antiAliasingThreshold_.get();
+    scene_.usePacketTracing = packetTracing_.get();
+    scene_.useWavefrontReflections = wavefrontReflections_.get();
+    scene_.usePrimitiveGroups = primitiveGroups_.get();
+    scene_.lightCullingThreshold = lightCullingThreshold_.get();
+    scene_.numLightSamples = lightSamples_.get();
+    scene_.useOccluderCache = occluderCache_.get();
+    scene_.useStageTimings = stageTimings_.get();
 
     //Create a representation of the scene to be rendered interactively outside of the raytracer
     auto mesh = std::make_shared<BasicMesh>();
@@ -200,19 +342,224 @@ void Raytracer::process()
     // - finalize
     mesh->addVertices(vertices);
     sceneGeometry_.setData(mesh);
+
+    if (bAnimationRequested_)
+    {
+        bAnimationRequested_ = false;
+        bRenderRequested_ = false;
+        renderAnimation();
+    }
+    else if (bRenderRequested_ || renderOnChange_.get())
+    {
+        bRenderRequested_ = false;
+        render();
+    }
 }
 
 
 void Raytracer::render()
 {
+    cancelRendering();
+
     auto outImage = std::make_shared<Image>(imageSize_.get(), DataVec4Float32::get());
     auto outLayer = outImage->getColorLayer();
     auto lr = outLayer->getEditableRepresentation<LayerRAM>();
 
+    scheduler_.setNumThreads(numThreads_.get());
+    scheduler_.setTileSize(tileSize_.get());
+    auto statistics = std::make_shared<RenderStatistics>();
+    statistics->imageSize = size2_t(imageSize_.get());
+    statistics->numThreads = scheduler_.getNumThreads();
+    statistics->sceneBuildSeconds = sceneBuildSeconds_;
+    sceneBuildSeconds_ = 0;
+
+    //The job renders a copy of the scene, so that process() can edit scene_ in the meantime
+    PerformanceTimer BuildTimer;
     scene_.prepareScene();
-    scene_.render(lr, maxRecursiveDepth_.get());
+    statistics->bvhBuildSeconds = BuildTimer.ElapsedTime();
+    auto scene = std::make_shared<const Scene>(scene_);
+
+    //The first hits of the last rendering are still valid if only lights or intensity have changed
+    std::shared_ptr<GBuffer> gBuffer = firstHitCache_.get() ? gBuffer_ : nullptr;
+    const bool bReshade = gBuffer && gBuffer->isValidFor(*scene);
+
+    auto cancelled = std::make_shared<std::atomic<bool>>(false);
+    renderCancelled_ = cancelled;
 
-    image_.setData(outImage);
+    const size_t maxRecursiveDepth = maxRecursiveDepth_.get();
+    const double previewInterval = previewInterval_.get() / 1000.0;
+    const std::string statisticsFile = statisticsFile_.get();
+    renderJob_ = dispatchPool([this, scene, outImage, lr, cancelled, maxRecursiveDepth, previewInterval,
+                               statistics, statisticsFile, gBuffer, bReshade]()
+    {
+        PerformanceTimer Timer;
+        const size_t width = size_t(outImage->getDimensions().x);
+        const size_t height = size_t(outImage->getDimensions().y);
+
+        if (bReshade)
+        {
+            //Fast enough to go without previews
+            if (!scene->reshade(lr, maxRecursiveDepth, scheduler_, *gBuffer, statistics->counters,
+                                cancelled.get())) return;
+            LogInfo("Shaded from the cached first hits (" << gBuffer->getSizeInBytes() / 1024 << " KiB).");
+        }
+        else
+        {
+            //Coarse previews with 1/16 and 1/4 of the rays
+            for (const size_t pixelStep : {size_t(4), size_t(2)})
+            {
+                if (!scene->renderPass(lr, maxRecursiveDepth, scheduler_, pixelStep, 0, height,
+                                       statistics->counters, cancelled.get())) return;
+                publish(std::shared_ptr<Image>(outImage->clone()), cancelled);
+            }
+
+            //Full resolution in bands of tile rows, with a few tiles per thread each.
+            // - the rows below the current band still show the previous preview
+            // - the first hits are recorded for shading again later; a cancelled recording stays invalid
+            if (gBuffer) gBuffer->begin(*scene);
+            const size_t tileSize = scheduler_.getTileSize();
+            const size_t numTilesPerRow = (width + tileSize - 1) / tileSize;
+            const size_t bandHeight = tileSize * ((4 * scheduler_.getNumThreads() + numTilesPerRow - 1) / numTilesPerRow);
+            PerformanceTimer PreviewTimer;
+            for (size_t firstRow(0); firstRow < height; firstRow += bandHeight)
+            {
+                const size_t lastRow = std::min(firstRow + bandHeight, height);
+                if (!scene->renderPass(lr, maxRecursiveDepth, scheduler_, 1, firstRow, lastRow,
+                                       statistics->counters, cancelled.get(), gBuffer.get())) return;
+                if (lastRow < height && PreviewTimer.ElapsedTime() >= previewInterval)
+                {
+                    publish(std::shared_ptr<Image>(outImage->clone()), cancelled);
+                    PreviewTimer.Reset();
+                }
+            }
+            if (gBuffer) gBuffer->finish();
+        }
+
+        //Refine the edges; the image with one ray per pixel is shown in the meantime
+        if (scene->useAdaptiveAntiAliasing)
+        {
+            publish(std::shared_ptr<Image>(outImage->clone()), cancelled);
+            if (!scene->antiAliasingPass(lr, maxRecursiveDepth, scheduler_, statistics->counters,
+                                         cancelled.get())) return;
+        }
+
+        //The job does not touch the final image anymore, so no copy is needed
+        publish(outImage, cancelled);
+
+        //Statistics cover all passes
+        statistics->renderSeconds = Timer.ElapsedTime();
+        statistics->log();
+        if (!statisticsFile.empty() && !statistics->appendJSON(statisticsFile))
+        {
+            LogWarn("Could not write the render statistics to " << statisticsFile << ".");
+        }
+    });
+}
+
+void Raytracer::renderAnimation()
+{
+    cancelRendering();
+
+    const std::string filename = animationFile_.get();
+    if (filename.empty())
+    {
+        LogWarn("Set the Animation Output file to render an animation.");
+        return;
+    }
+
+    auto path = std::make_shared<CameraPath>();
+    if (!animationKeyframes_.get().empty())
+    {
+        if (!path->load(animationKeyframes_.get()))
+        {
+            LogWarn("Could not read the camera keyframes from " << animationKeyframes_.get() << ".");
+            return;
+        }
+    }
+    else
+    {
+        auto PCam = dynamic_cast<PerspectiveCamera*>(&camera_.get());
+        const CameraPath::Camera start = {PCam->getLookFrom(), PCam->getLookTo(), PCam->getLookUp(), PCam->getFovy()};
+        *path = CameraPath::turntable(start, animationFrames_.get(), animationSwing_.get());
+    }
+
+    scheduler_.setNumThreads(numThreads_.get());
+    scheduler_.setTileSize(tileSize_.get());
+    auto statistics = std::make_shared<RenderStatistics>();
+    statistics->imageSize = size2_t(imageSize_.get());
+    statistics->numThreads = scheduler_.getNumThreads();
+    statistics->sceneBuildSeconds = sceneBuildSeconds_;
+    sceneBuildSeconds_ = 0;
+
+    //The hierarchies are built once for all frames
+    PerformanceTimer BuildTimer;
+    scene_.prepareScene();
+    statistics->bvhBuildSeconds = BuildTimer.ElapsedTime();
+    auto scene = std::make_shared<const Scene>(scene_);
+
+    auto cancelled = std::make_shared<std::atomic<bool>>(false);
+    renderCancelled_ = cancelled;
+
+    const size_t maxRecursiveDepth = maxRecursiveDepth_.get();
+    const double previewInterval = previewInterval_.get() / 1000.0;
+    const std::string statisticsFile = statisticsFile_.get();
+    renderJob_ = dispatchPool([this, scene, path, cancelled, maxRecursiveDepth, previewInterval, filename,
+                               statistics, statisticsFile]()
+    {
+        PerformanceTimer Timer;
+        const BatchRenderer batch(scheduler_);
+
+        //Frames are written by the threads that rendered them; now and then one is shown at the outport
+        std::mutex previewMutex;
+        PerformanceTimer PreviewTimer;
+        std::atomic<size_t> numFailed(0);
+        const auto onFrame = [&](const size_t frame, std::shared_ptr<Image> image)
+        {
+            if (!BatchRenderer::writeFrame(*image, BatchRenderer::getFrameFilename(filename, frame))) numFailed++;
+
+            std::lock_guard<std::mutex> lock(previewMutex);
+            if (PreviewTimer.ElapsedTime() >= previewInterval)
+            {
+                publish(image, cancelled);
+                PreviewTimer.Reset();
+            }
+        };
+        const size_t numRendered = batch.render(*scene, *path, maxRecursiveDepth, onFrame,
+                                                statistics->counters, cancelled.get());
+
+        statistics->renderSeconds = Timer.ElapsedTime();
+        LogInfo("Rendered " << numRendered << " of " << path->getNumFrames() << " frames in "
+                << statistics->renderSeconds << " seconds (" << numRendered / statistics->renderSeconds
+                << " frames/s) with " << batch.getNumFramesInFlight(statistics->imageSize)
+                << " frames at a time.");
+        if (numFailed > 0)
+        {
+            LogWarn("Could not write " << numFailed << " frames to " << filename << ".");
+        }
+        statistics->log();
+        if (!statisticsFile.empty() && !statistics->appendJSON(statisticsFile))
+        {
+            LogWarn("Could not write the render statistics to " << statisticsFile << ".");
+        }
+    });
+}
+
+void Raytracer::publish(std::shared_ptr<Image> image, std::shared_ptr<std::atomic<bool>> cancelled)
+{
+    dispatchFrontAndForget([this, cancelled, image]()
+    {
+        if (*cancelled) return;
+        image_.setData(image);
+        //Only the processors downstream need to update; invalidating ourselves would cancel the job
+        image_.invalidate(InvalidationLevel::InvalidOutput);
+    });
+}
+
+void Raytracer::cancelRendering()
+{
+    if (renderCancelled_) *renderCancelled_ = true;
+    //Stops after the tiles in progress
+    if (renderJob_.valid()) renderJob_.wait();
 }
 
 
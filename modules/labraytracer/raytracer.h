@@ -20,11 +20,17 @@
 #include <inviwo/core/properties/buttonproperty.h>
 #include <inviwo/core/properties/optionproperty.h>
 #include <inviwo/core/properties/boolproperty.h>
+#include <inviwo/core/properties/fileproperty.h>
 #include <inviwo/core/datastructures/light/baselightsource.h>
 
 #include <labraytracer/light.h>
 #include <labraytracer/renderable.h>
 #include <labraytracer/scene.h>
+#include <labraytracer/bvhindexedtrianglemesh.h>
+#include <labraytracer/gbuffer.h>
+
+#include <atomic>
+#include <future>
 
 namespace inviwo
 {
@@ -32,7 +38,12 @@ namespace inviwo
 /** \docpage{org.inviwo.Raytracer, Raytracer}
     ![](org.inviwo.Raytracer.png?classIdentifier=org.inviwo.Raytracer)
 
-    CPU Raytracer. The rendering has to be explicitly triggered with the Render button.
+    CPU Raytracer. The rendering has to be explicitly triggered with the Render button,
+    or happens after every change with Render on Change.
+
+    Rendering runs in the background and is refined progressively: a preview with 1/16 of
+    the rays, one with 1/4 of them, and then the full resolution. Any change to the
+    processor cancels a rendering in progress.
 
     ### Outports
       * __<imageOutport>__ Rendered image.
@@ -41,7 +52,46 @@ namespace inviwo
 
     ### Properties
       * __<Render Button>__ Button triggering raytracing.
+      * __<Render on Change>__ Start a new rendering after every change, e.g. of the camera
+      * __<Preview Interval>__ Milliseconds between updates of the output image during the
+            full-resolution pass
+      * __<Statistics File>__ If set, every finished rendering appends its timings and ray
+            counts as one line of JSON
+      * __<Stage Timings>__ Measure the time of the primary, shadow and reflection rays and of the
+            image writes; this reads the clock for every ray and slows down the rendering
+      * __<Render Animation>__ Renders every frame of the camera path into numbered image files,
+            without going through the network for each frame
+      * __<Animation Frames>__ Number of frames of the turntable path around the current camera
+      * __<Turntable Swing>__ Lets the camera distance oscillate during the turntable
+      * __<Camera Keyframes>__ Text file with one camera per line (frame, lookFrom, lookTo, lookUp,
+            fovy) to use instead of the turntable; frames in between are interpolated
+      * __<Animation Output>__ Image file name; the frame number is inserted before the extension
       * __<Image Size>__ Size of the rendering image (one Ray per pixel)
+      * __<Adaptive Anti-Aliasing>__ After the full-resolution pass, pixels at edges get up to
+            Max Samples per Pixel stratified subsamples; the Anti-Aliasing Threshold is the color
+            difference in a 3x3 neighborhood that counts as an edge
+      * __<Mesh Storage>__ How the raytracer keeps the vertices of the input mesh: double or float
+            copies, float with 16-bit normals, or no copy at all by referencing the input buffers
+      * __<BVH Leaf Size>__ Maximum number of triangles per leaf of the input mesh hierarchy
+      * __<BVH Node Width>__ Children per node of the input mesh hierarchy; Auto picks the
+            widest one supported by the processor
+      * __<BVH Disk Cache>__ Keep the hierarchies of input meshes in the user settings folder, so that
+            the next load of the same mesh with the same settings skips building them
+      * __<Threads>__ Number of render threads; 0 uses all cores
+      * __<Tile Size>__ Edge length of the image tiles that are distributed over the threads
+      * __<Ray Packets>__ Trace primary and shadow rays in packets of 8 through the BVH
+      * __<Wavefront Reflections>__ Trace the reflections after all primary rays, one depth at a time
+            and sorted by origin and direction, instead of recursively per pixel
+      * __<Primitive Groups>__ Intersect spheres, planes and triangles in groups of 8 with SIMD
+            instead of one object at a time
+      * __<Light Culling>__ Lights whose direct light at a Phong surface stays certainly below this
+            value get no shadow ray; 0 traces a shadow ray to every light
+      * __<Light Samples>__ Number of lights sampled by importance per hit, for scenes with many
+            lights; 0 uses all lights
+      * __<Occluder Cache>__ Test the last occluder towards each light first when tracing the
+            shadow rays of neighboring pixels
+      * __<Cache First Hits>__ Keep the first hit of every pixel, so that changes of the lights
+            or the light intensity are shaded again without tracing primary rays
 */
 
 /** \class Raytracer
@@ -58,21 +108,46 @@ class IVW_MODULE_LABRAYTRACER_API Raytracer : public Processor
     // Friends
     // Types
 public:
+    enum class SceneCreationMethod
+    {
+        Intersections,
+        Illumination,
+        PhongTest,
+        PrettySpheres,
+        SpikedSphereSubtraction,
+        SphereSubtraction,
+        SeeThroughSphereSubtraction,
+        InputMesh
+    };
+
     // Construction / Deconstruction
 public:
     Raytracer();
-    virtual ~Raytracer() = default;
+    virtual ~Raytracer();
 
     // Methods
 public:
     virtual const ProcessorInfo getProcessorInfo() const override;
     static const ProcessorInfo processorInfo_;
 
+    ///Builds one of the scenes with the camera and settings of the processor, without rendering it.
+    ///For benchmarks and tests; the scene still needs to be prepared.
+    Scene buildScene(const SceneCreationMethod method, const ivec2& imageSize);
+
 protected:
     /// Our main computation function
     virtual void process() override;
+    ///Starts a progressive rendering of the scene in the background
     void render();
+    ///Renders all frames of the camera path into numbered image files in the background
+    void renderAnimation();
+    ///Hands an image to the outport in the GUI thread, unless the rendering has been cancelled meanwhile
+    void publish(std::shared_ptr<Image> image, std::shared_ptr<std::atomic<bool>> cancelled);
+    ///Cancels the background rendering and waits for it to stop
+    void cancelRendering();
     void makeAScene();
+    ///Replaces the lights of the scene, keeping the renderables
+    void updateLights();
     void showProperties();
 
     /* Functions creating different scenes. See raytracer_scenes.cpp for their implementation. */
@@ -84,6 +159,8 @@ protected:
     void sceneSpikedSphereSubtraction();
     void sceneSphereSubtraction();
     void sceneSeeThroughSphereSubtraction();
+    ///Adds the lights of the selected scene; they do not depend on its geometry
+    void addSceneLights();
     void addDefaultLights();
     void addInputLights();
     
@@ -99,17 +176,6 @@ public:
 public:
     CameraProperty camera_;
 
-    enum class SceneCreationMethod
-    {
-        Intersections,
-        Illumination,
-        PhongTest,
-        PrettySpheres,
-        SpikedSphereSubtraction,
-        SphereSubtraction,
-        SeeThroughSphereSubtraction,
-        InputMesh
-    };
     TemplateOptionProperty<SceneCreationMethod> sceneSelection_;
 
     DoubleVec3Property backgroundColor_;
@@ -119,19 +185,66 @@ public:
     DoubleVec3Property specularLight_;
 
     DoubleVec3Property inputMeshColor_;
+    TemplateOptionProperty<IndexedTriangleMesh::VertexStorage> meshStorage_;
 
     BoolProperty useSpecificSeedPrettySpheres_;
     IntProperty seedPrettySpheres_;
 
     IntVec2Property imageSize_;
     BoolProperty adaptiveAntiAliasing_;
+    TemplateOptionProperty<size_t> antiAliasingSamples_;
+    DoubleProperty antiAliasingThreshold_;
     DoubleProperty lightIntensity_;
     IntSizeTProperty maxRecursiveDepth_;
+    IntProperty bvhMaxLeafSize_;
+    TemplateOptionProperty<BVHIndexedTriangleMesh::NodeWidth> bvhNodeWidth_;
+    BoolProperty bvhCache_;
+    IntSizeTProperty numThreads_;
+    TemplateOptionProperty<size_t> tileSize_;
+    BoolProperty packetTracing_;
+    BoolProperty wavefrontReflections_;
+    BoolProperty primitiveGroups_;
+    DoubleProperty lightCullingThreshold_;
+    IntSizeTProperty lightSamples_;
+    BoolProperty occluderCache_;
+    BoolProperty firstHitCache_;
     ButtonProperty render_;
+    BoolProperty renderOnChange_;
+    IntProperty previewInterval_;
+    FileProperty statisticsFile_;
+    BoolProperty stageTimings_;
+    ButtonProperty renderAnimation_;
+    IntSizeTProperty animationFrames_;
+    BoolProperty animationSwing_;
+    FileProperty animationKeyframes_;
+    FileProperty animationFile_;
 
 // Attributes
 private:
     Scene scene_;
+
+    ///Distributes the image tiles over the render threads
+    TileScheduler scheduler_;
+
+    ///Set by the Render button; the rendering is started in process() with the updated scene
+    bool bRenderRequested_;
+
+    ///Set by the Render Animation button, like bRenderRequested_
+    bool bAnimationRequested_;
+
+    ///Time of the last makeAScene() in seconds, reported with the next rendering; 0 if the scene was kept
+    double sceneBuildSeconds_;
+
+    ///Background rendering. It works on a copy of the scene, but shares the renderables and the scheduler.
+    std::future<void> renderJob_;
+    std::shared_ptr<std::atomic<bool>> renderCancelled_;
+
+    ///Input meshes converted for raytracing, with their hierarchies.
+    ///Kept until the triangle input changes, so that other edits do not trigger a rebuild.
+    std::vector<std::shared_ptr<BVHIndexedTriangleMesh>> inputMeshCache_;
+
+    ///First hits of the last full-resolution rendering; shared with the render job
+    std::shared_ptr<GBuffer> gBuffer_;
 };
 
 }// namespace inviwo
@@ -14,13 +14,16 @@
 #include <labraytracer/util.h>
 #include <labraytracer/triangle.h>
 #include <labraytracer/sphere.h>
+#include <labraytracer/csgspheregroup.h>
 #include <labraytracer/plane.h>
 #include <labraytracer/bvhindexedtrianglemesh.h>
 #include <labraytracer/constantmaterial.h>
 #include <labraytracer/phongmaterial.h>
 #include <labraytracer/cooktorrancematerial.h>
 #include <modules/base/algorithm/meshutils.h>
+#include <inviwo/core/datastructures/buffer/bufferramprecision.h>
 #include <inviwo/core/datastructures/light/pointlight.h>
+#include <inviwo/core/util/filesystem.h>
 
 #include <labraytracer/raytracer.h>
 
@@ -30,12 +33,23 @@
 namespace inviwo
 {
 
-void Raytracer::sceneIntersections()
+namespace
 {
-    std::shared_ptr<Light> light1 =
-        std::make_shared<Light>(dvec3(5, 2, 6), dvec3(0), dvec3(0), dvec3(0));
-    scene_.addLight(light1);
+///Copies a buffer of 3D vectors of any type into doubles, dispatching once on its type
+std::vector<dvec3> toDVec3(const BufferRAM& ram)
+{
+    return ram.dispatch<std::vector<dvec3>, dispatching::filter::Vec3s>([](auto typed)
+    {
+        const auto& Data = typed->getDataContainer();
+        std::vector<dvec3> Converted(Data.size());
+        for (size_t i(0); i < Data.size(); i++) Converted[i] = util::glm_convert<dvec3>(Data[i]);
+        return Converted;
+    });
+}
+}
 
+void Raytracer::sceneIntersections()
+{
     dvec3 a(2, 1, 0);
     dvec3 b(1, 2, 0);
     dvec3 c(1, 0, 2);
@@ -99,8 +113,6 @@ void Raytracer::sceneIllumination()
     scene_.addRenderable(sphere3);
     scene_.addRenderable(sphere4);
     scene_.addRenderable(plane);
-
-    addInputLights();
 }
 
 
@@ -115,8 +127,6 @@ void Raytracer::scenePhongTest()
         S->setMaterial(mat);
         scene_.addRenderable(S);
     }
-
-    addInputLights();
 }
 
 
@@ -257,8 +267,6 @@ void Raytracer::scenePrettySpheres()
         dvec3(0.3, 0.3, 0.6), dvec3(0.7, 0.7, 0.9), dvec3(0.5, 0.5, 0.5), 0.25, 10);
     Ground->setMaterial(GroundMat);
     scene_.addRenderable(Ground);
-
-    addInputLights();
 }
 
 
@@ -276,7 +284,10 @@ void Raytracer::sceneSpikedSphereSubtraction()
     auto BigSphere = std::make_shared<Sphere>(BigOrigin + BigOffset, BigRadius);
     auto BigMat = std::make_shared<PhongMaterial>(dvec3(0.5, 0.5, 1), dvec3(0.5, 0.5, 1), dvec3(0.5, 0.5, 1), 0.9, 2);
     BigSphere->setMaterial(BigMat);
-    scene_.addRenderable(BigSphere);
+
+    //The small spheres carve into the big one
+    auto SpikedSphere = std::make_shared<CSGSphereGroup>();
+    SpikedSphere->addSphere(BigSphere);
 
 
     //Regular, equidistant sampling of the sphere
@@ -302,18 +313,17 @@ void Raytracer::sceneSpikedSphereSubtraction()
                                     BigRadius * 1.15 * sin(theta) * sin(phi),
                                     BigRadius * 1.15 * cos(theta));
 
-            // TODO:
-            // These small spheres should subtract volume.
-            //Create small sphere and color it randomly
+            //Create small sphere and color it randomly; the color shows inside the dent
             auto SmallSphere = std::make_shared<Sphere>(SmallOrigin + BigOffset, 2.5 * dtheta);
             const auto SmallColor = Palette::Random(generator, Palette::Yellow());
             auto SmallMat = std::make_shared<PhongMaterial>(SmallColor, SmallColor, SmallColor, 0, 2);
             SmallSphere->setMaterial(SmallMat);
-            scene_.addRenderable(SmallSphere);
+            SpikedSphere->subtractSphere(SmallSphere);
 
             //Ncount++;
         }
     }
+    scene_.addRenderable(SpikedSphere);
 
     //Ground plane, slightly blue and reflective
     auto Ground = std::make_shared<PlaneX>();
@@ -321,8 +331,6 @@ void Raytracer::sceneSpikedSphereSubtraction()
         dvec3(0.3, 0.3, 0.6), dvec3(0.7, 0.7, 0.9), dvec3(0.5, 0.5, 0.5), 0.25, 10);
     Ground->setMaterial(GroundMat);
     scene_.addRenderable(Ground);
-
-    addInputLights();
 }
 
 
@@ -346,13 +354,10 @@ void Raytracer::sceneSphereSubtraction()
     Ground->setMaterial(GroundMat);
     scene_.addRenderable(Ground);
 
-    addInputLights();
-
     //Normal spheres
     std::shared_ptr<Sphere> normalsphere1 = std::make_shared<Sphere>(dvec3(0, 0, 4), 4);
 
-    // TODO:
-    // These spheres should subtract volume.
+    //These spheres subtract volume
     std::shared_ptr<Sphere> subsphere1 = std::make_shared<Sphere>(dvec3(4, 0, 4), 4);
     std::shared_ptr<Sphere> subsphere2 = std::make_shared<Sphere>(dvec3(0, 4, 4), 4);
     std::shared_ptr<Sphere> subsphere3 = std::make_shared<Sphere>(dvec3(-4, 0, 4), 4);
@@ -366,12 +371,14 @@ void Raytracer::sceneSphereSubtraction()
     subsphere4->setMaterial(material5);
     subsphere5->setMaterial(material2);
 
-    scene_.addRenderable(normalsphere1);
-    scene_.addRenderable(subsphere1);
-    scene_.addRenderable(subsphere2);
-    scene_.addRenderable(subsphere3);
-    scene_.addRenderable(subsphere4);
-    scene_.addRenderable(subsphere5);
+    auto Group = std::make_shared<CSGSphereGroup>();
+    Group->addSphere(normalsphere1);
+    Group->subtractSphere(subsphere1);
+    Group->subtractSphere(subsphere2);
+    Group->subtractSphere(subsphere3);
+    Group->subtractSphere(subsphere4);
+    Group->subtractSphere(subsphere5);
+    scene_.addRenderable(Group);
 }
 
 
@@ -395,8 +402,6 @@ void Raytracer::sceneSeeThroughSphereSubtraction()
     Ground->setMaterial(GroundMat);
     scene_.addRenderable(Ground);
 
-    addInputLights();
-
     //Normal spheres
     std::shared_ptr<Sphere> normalsphere1 = std::make_shared<Sphere>(dvec3(0, 0, 4), 4);
 
@@ -406,8 +411,7 @@ void Raytracer::sceneSeeThroughSphereSubtraction()
     const dvec3 o2 = dvec3(r * cos(2 * M_PI / 3), r * sin(2 * M_PI / 3), 4);
     const dvec3 o3 = dvec3(r * cos(4 * M_PI / 3), r * sin(4 * M_PI / 3), 4);
 
-    // TODO:
-    // These spheres should subtract volume.
+    //These spheres subtract volume
     std::shared_ptr<Sphere> subsphere1 = std::make_shared<Sphere>(o1, r-2);
     std::shared_ptr<Sphere> subsphere2 = std::make_shared<Sphere>(o2, r-2);
     std::shared_ptr<Sphere> subsphere3 = std::make_shared<Sphere>(o3, r-2);
@@ -419,11 +423,13 @@ void Raytracer::sceneSeeThroughSphereSubtraction()
     subsphere3->setMaterial(material4);
     subsphere4->setMaterial(material5);
 
-    scene_.addRenderable(normalsphere1);
-    scene_.addRenderable(subsphere1);
-    scene_.addRenderable(subsphere2);
-    scene_.addRenderable(subsphere3);
-    scene_.addRenderable(subsphere4);
+    auto Group = std::make_shared<CSGSphereGroup>();
+    Group->addSphere(normalsphere1);
+    Group->subtractSphere(subsphere1);
+    Group->subtractSphere(subsphere2);
+    Group->subtractSphere(subsphere3);
+    Group->subtractSphere(subsphere4);
+    scene_.addRenderable(Group);
 }
 
 void Raytracer::sceneInputMesh()
@@ -440,12 +446,29 @@ void Raytracer::sceneInputMesh()
     Ground->setMaterial(GroundMat);
     scene_.addRenderable(Ground);
 
-    addInputLights();
-
     //Get the input mesh data
     auto MultiInMeshes = triangleInput_.getVectorData();
     if (MultiInMeshes.empty()) return;
 
+    //Reuse the converted meshes as long as the input has not changed.
+    //Their hierarchies are only rebuilt if the build settings differ.
+    BVTree::BuildSettings BuildSettings;
+    BuildSettings.maxLeafSize = bvhMaxLeafSize_.get();
+    const std::string CacheDirectory =
+        bvhCache_.get() ? filesystem::getPath(PathType::Settings, "/labraytracer/bvhcache", true) : "";
+    if (!inputMeshCache_.empty())
+    {
+        for (auto& RayTriMesh : inputMeshCache_)
+        {
+            RayTriMesh->setBuildSettings(BuildSettings);
+            RayTriMesh->setNodeWidth(bvhNodeWidth_.get());
+            RayTriMesh->setCacheDirectory(CacheDirectory);
+            RayTriMesh->setMaterial(TriangleMat);
+            scene_.addRenderable(RayTriMesh);
+        }
+        return;
+    }
+
     for(auto InMesh : MultiInMeshes)
     {
         //Vertex data
@@ -476,29 +499,55 @@ void Raytracer::sceneInputMesh()
         if (posRam->getSize() != norRam->getSize()) return;
 
         //Convert to raytracer triangles with transformed vertices and normals
-        // - get the trafo as well as the inverted, transposed trafo for the normals
+        // - get the trafo; the mesh derives the one for the normals
         Matrix<4, double> Trafo = InMesh->getWorldMatrix();
-        Matrix<3, double> TrafoInvTransp = glm::inverseTranspose(Matrix<3, double>(Trafo));
         // - get a triangle mesh with bounding volume hierarchy
         std::shared_ptr<BVHIndexedTriangleMesh> RayTriMesh = std::make_shared<BVHIndexedTriangleMesh>();
+        RayTriMesh->setBuildSettings(BuildSettings);
+        RayTriMesh->setNodeWidth(bvhNodeWidth_.get());
+        RayTriMesh->setCacheDirectory(CacheDirectory);
         const size_t NumInVertices = posRam->getSize();
-        RayTriMesh->reserveVertexPositions(NumInVertices);
-        RayTriMesh->reserveVertexNormals(NumInVertices);
-        for(size_t i(0);i<NumInVertices;i++)
+        const IndexedTriangleMesh::VertexStorage Storage = meshStorage_.get();
+        const bool bFloatInput = posRam->getDataFormat()->getId() == DataFormatId::Vec3Float32
+                                 && norRam->getDataFormat()->getId() == DataFormatId::Vec3Float32;
+        if (Storage == IndexedTriangleMesh::VertexStorage::External && bFloatInput)
         {
-            //Get and transform position
-            dvec3 Position = posRam->getAsDVec3(i);
-            dvec4 HomogeneousPos(Position.x, Position.y, Position.z, 1.0f);
-            dvec4 TransformedHomogeneousPos = Trafo * HomogeneousPos;
-
-            //Get and transform normal
-            const dvec3 NewNormal = glm::normalize(TrafoInvTransp * norRam->getAsDVec3(i));
-
-            //Set position and normal
-            RayTriMesh->addVertex(dvec3(TransformedHomogeneousPos.x / TransformedHomogeneousPos.w,
-                                        TransformedHomogeneousPos.y / TransformedHomogeneousPos.w,
-                                        TransformedHomogeneousPos.z / TransformedHomogeneousPos.w),
-                                        NewNormal);
+            //No copy at all; the mesh transforms on access and keeps the input alive
+            RayTriMesh->setExternalVertices(static_cast<const float*>(posRam->getData()), 3,
+                                            static_cast<const float*>(norRam->getData()), 3,
+                                            NumInVertices, Trafo, InMesh);
+        }
+        else
+        {
+            if (Storage == IndexedTriangleMesh::VertexStorage::External)
+            {
+                LogWarn("Referencing the input needs float positions and normals. The mesh is copied as float instead.");
+                RayTriMesh->setVertexStorage(IndexedTriangleMesh::VertexStorage::Float);
+            }
+            else
+            {
+                RayTriMesh->setVertexStorage(Storage);
+            }
+
+            //Dispatch once on the buffer types; float and double are transformed directly,
+            //other types are widened to double first
+            if (bFloatInput)
+            {
+                RayTriMesh->setVertices(static_cast<const vec3*>(posRam->getData()),
+                                        static_cast<const vec3*>(norRam->getData()), NumInVertices, Trafo);
+            }
+            else if (posRam->getDataFormat()->getId() == DataFormatId::Vec3Float64
+                     && norRam->getDataFormat()->getId() == DataFormatId::Vec3Float64)
+            {
+                RayTriMesh->setVertices(static_cast<const dvec3*>(posRam->getData()),
+                                        static_cast<const dvec3*>(norRam->getData()), NumInVertices, Trafo);
+            }
+            else
+            {
+                const std::vector<dvec3> Positions = toDVec3(*posRam);
+                const std::vector<dvec3> Normals = toDVec3(*norRam);
+                RayTriMesh->setVertices(Positions.data(), Normals.data(), NumInVertices, Trafo);
+            }
         }
 
         //Go over all index buffers and copy over the triangles.
@@ -506,6 +555,14 @@ void Raytracer::sceneInputMesh()
         {
             if (ib.first.dt != DrawType::Triangles) continue;
 
+            //A plain triangle list is copied in one go
+            if (ib.first.ct == ConnectivityType::None)
+            {
+                const std::vector<uint32_t>& IndexData = ib.second->getRAMRepresentation()->getDataContainer();
+                RayTriMesh->addTriangles(IndexData.data(), IndexData.size());
+                continue;
+            }
+
             //Memory considerations
             RayTriMesh->reserveTriangleIndices(RayTriMesh->triangleIndices().size() + ib.second->getSize());
 
@@ -519,6 +576,26 @@ void Raytracer::sceneInputMesh()
 
         RayTriMesh->setMaterial(TriangleMat);
         scene_.addRenderable(RayTriMesh);
+        inputMeshCache_.push_back(RayTriMesh);
+    }
+}
+
+
+void Raytracer::addSceneLights()
+{
+    switch (sceneSelection_.get())
+    {
+        case SceneCreationMethod::Intersections:
+        {
+            std::shared_ptr<Light> light1 =
+                std::make_shared<Light>(dvec3(5, 2, 6), dvec3(0), dvec3(0), dvec3(0));
+            scene_.addLight(light1);
+            break;
+        }
+
+        default:
+            addInputLights();
+            break;
     }
 }
 
@@ -9,10 +9,77 @@
  */
 
 #include <labraytracer/renderable.h>
+#include <labraytracer/rayintersection.h>
 
 namespace inviwo
 {
 
-Renderable::Renderable() {}
+Renderable::Renderable()
+    : mMaterialId(std::numeric_limits<uint32_t>::max())
+{
+}
+
+bool Renderable::closestHit(const Ray& ray, double maxLambda, HitRecord& hit) const
+{
+    RayIntersection intersection;
+    if (!closestIntersection(ray, maxLambda, intersection)) return false;
+    hit.renderable = this;
+    hit.primitive = 0;
+    hit.lambda = intersection.getLambda();
+    return true;
+}
+
+RayIntersection Renderable::makeIntersection(const Ray& ray, const HitRecord& /*hit*/) const
+{
+    //The closest hit without a bound is the recorded one, as nothing closer was found before
+    RayIntersection intersection;
+    closestIntersection(ray, std::numeric_limits<double>::infinity(), intersection);
+    return intersection;
+}
+
+int Renderable::closestHit8(const RayPacket8& packet, const int activeMask, double* maxLambda,
+                            HitRecord* hits) const
+{
+    int hitMask = 0;
+    HitRecord hit;
+    for (int lane = 0; lane < RayPacket8::Size; lane++)
+    {
+        if (!(activeMask & (1 << lane))) continue;
+        if (closestHit(packet.rays[lane], maxLambda[lane], hit) && hit.lambda < maxLambda[lane])
+        {
+            maxLambda[lane] = hit.lambda;
+            hits[lane] = hit;
+            hitMask |= (1 << lane);
+        }
+    }
+    return hitMask;
+}
+
+int Renderable::anyIntersection8(const RayPacket8& packet, const int activeMask,
+                                 const double* maxLambda) const
+{
+    int hitMask = 0;
+    for (int lane = 0; lane < RayPacket8::Size; lane++)
+    {
+        if ((activeMask & (1 << lane)) && anyIntersection(packet.rays[lane], maxLambda[lane]))
+        {
+            hitMask |= (1 << lane);
+        }
+    }
+    return hitMask;
+}
+
+bool Renderable::anyHit(const Ray& ray, double maxLambda, HitRecord& hit) const
+{
+    if (!anyIntersection(ray, maxLambda)) return false;
+    hit.renderable = this;
+    hit.primitive = 0;
+    return true;
+}
+
+bool Renderable::anyPrimitiveIntersection(const Ray& ray, double maxLambda, const uint32_t /*primitive*/) const
+{
+    return anyIntersection(ray, maxLambda);
+}
 
 }// namespace inviwo
@@ -16,11 +16,14 @@
 #include <labraytracer/ray.h>
 #include <labraytracer/rayintersection.h>
 #include <labraytracer/material.h>
+#include <labraytracer/boundingbox.h>
+#include <labraytracer/raypacket.h>
 #include <inviwo/core/datastructures/geometry/basicmesh.h>
 
 namespace inviwo
 {
 class RayIntersection;
+struct HitRecord;
 class Material;
 
 /** \class Renderable
@@ -45,6 +48,28 @@ public:
     virtual bool closestIntersection(const Ray& ray, double maxLambda,
                                      RayIntersection& intersection) const = 0;
     virtual bool anyIntersection(const Ray& ray, double maxLambda) const = 0;
+
+    // Closest hit as a small record; the full intersection is made only for the final hit
+    // with makeIntersection(). The defaults call closestIntersection(), once for the hit and
+    // once more for the intersection; override both to avoid that.
+    virtual bool closestHit(const Ray& ray, double maxLambda, HitRecord& hit) const;
+    virtual RayIntersection makeIntersection(const Ray& ray, const HitRecord& hit) const;
+
+    // Packet versions for the rays of a packet in activeMask.
+    // closestHit8 returns the mask of rays with a hit closer than their maxLambda, and
+    // updates maxLambda and hits for those. anyIntersection8 returns the mask of rays
+    // with any hit. The defaults test the rays one by one; override them to traverse once per packet.
+    virtual int closestHit8(const RayPacket8& packet, const int activeMask, double* maxLambda,
+                            HitRecord* hits) const;
+    virtual int anyIntersection8(const RayPacket8& packet, const int activeMask,
+                                 const double* maxLambda) const;
+
+    // Shadow rays with the occluder cache of the scene. anyHit records the renderable and
+    // primitive that blocks the ray in hit; lambda and the barycentric coordinates are not set.
+    // anyPrimitiveIntersection tests a single recorded primitive. The defaults record primitive 0
+    // and test the whole object; override them for objects made of many primitives.
+    virtual bool anyHit(const Ray& ray, double maxLambda, HitRecord& hit) const;
+    virtual bool anyPrimitiveIntersection(const Ray& ray, double maxLambda, const uint32_t primitive) const;
     virtual void drawGeometry(std::shared_ptr<BasicMesh> mesh,
                               std::vector<BasicMesh::Vertex>& vertices) const = 0;
     void setMaterial(std::shared_ptr<Material> material) { mMaterial = material; }
@@ -53,9 +78,17 @@ public:
     // Override this method for pre-render initialization
     virtual void initialize() {}
 
+    // Computes the axis-aligned bounds of the object; valid after initialize().
+    // Returns false for unbounded objects such as planes, which are then tested with every ray.
+    virtual bool getBoundingBox(BoundingBox& /*box*/) const { return false; }
+
 //Attributes
 public:
     std::shared_ptr<Material> mMaterial;
+
+    ///Id of mMaterial in the MaterialTable of the prepared scene, MaterialTable::NotFound if none.
+    ///Set by MaterialTable::build(), so that shading does not need to look the material up.
+    uint32_t mMaterialId;
 };
 
 }// namespace inviwo
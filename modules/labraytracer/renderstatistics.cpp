@@ -0,0 +1,186 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 08:06:42
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include <labraytracer/renderstatistics.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace inviwo
+{
+
+RenderCounters& RenderCounters::operator+=(const RenderCounters& other)
+{
+    numPrimaryRays += other.numPrimaryRays;
+    numShadowRays += other.numShadowRays;
+    numReflectionRays += other.numReflectionRays;
+    numIntersections += other.numIntersections;
+    numShading += other.numShading;
+    numAntiAliasingRays += other.numAntiAliasingRays;
+    numRefinedPixels += other.numRefinedPixels;
+    numCulledShadowRays += other.numCulledShadowRays;
+    numUnsampledShadowRays += other.numUnsampledShadowRays;
+    numOccluderCacheLookups += other.numOccluderCacheLookups;
+    numOccluderCacheHits += other.numOccluderCacheHits;
+    numReflectionWaves += other.numReflectionWaves;
+    wavefrontPeakBytes = std::max(wavefrontPeakBytes, other.wavefrontPeakBytes);
+    numTiles += other.numTiles;
+    numStolenTiles += other.numStolenTiles;
+    primarySeconds += other.primarySeconds;
+    shadowSeconds += other.shadowSeconds;
+    reflectionSeconds += other.reflectionSeconds;
+    imageWriteSeconds += other.imageWriteSeconds;
+    tileSeconds += other.tileSeconds;
+    if (other.maxTileSeconds > maxTileSeconds)
+    {
+        maxTileSeconds = other.maxTileSeconds;
+        slowestTilePixel = other.slowestTilePixel;
+    }
+    maxTileImbalance = std::max(maxTileImbalance, other.maxTileImbalance);
+    return *this;
+}
+
+void RenderCounters::addTiles(const TileScheduler::Statistics& tiles, const size_t pixelStep, const size_t firstRow)
+{
+    if (tiles.numTiles == 0) return;
+
+    RenderCounters run;
+    run.numTiles = tiles.numTiles;
+    run.numStolenTiles = tiles.numSteals;
+    run.tileSeconds = tiles.meanTileSeconds * double(tiles.numTiles);
+    run.maxTileSeconds = tiles.maxTileSeconds;
+    run.slowestTilePixel = size2_t(tiles.slowestTile.begin.x * pixelStep, firstRow + tiles.slowestTile.begin.y * pixelStep);
+    run.maxTileImbalance = tiles.imbalance;
+    *this += run;
+}
+
+uint64_t RenderStatistics::getNumRays() const
+{
+    return counters.numPrimaryRays + counters.numShadowRays + counters.numReflectionRays;
+}
+
+double RenderStatistics::getRaysPerSecond() const
+{
+    return (renderSeconds > 0) ? double(getNumRays()) / renderSeconds : 0.0;
+}
+
+double RenderStatistics::getOccluderCacheHitRate() const
+{
+    return (counters.numOccluderCacheLookups > 0)
+               ? double(counters.numOccluderCacheHits) / double(counters.numOccluderCacheLookups)
+               : 0.0;
+}
+
+void RenderStatistics::writeJSON(std::ostream& os) const
+{
+    os << "{\"imageSize\": [" << imageSize.x << ", " << imageSize.y << "]"
+       << ", \"numThreads\": " << numThreads
+       << ", \"seconds\": {\"sceneBuild\": " << sceneBuildSeconds
+       << ", \"bvhBuild\": " << bvhBuildSeconds
+       << ", \"render\": " << renderSeconds << "}"
+       << ", \"threadSeconds\": {\"primaryRays\": " << counters.primarySeconds
+       << ", \"shadowRays\": " << counters.shadowSeconds
+       << ", \"reflectionRays\": " << counters.reflectionSeconds
+       << ", \"imageWrite\": " << counters.imageWriteSeconds << "}"
+       << ", \"rays\": {\"primary\": " << counters.numPrimaryRays
+       << ", \"shadow\": " << counters.numShadowRays
+       << ", \"reflection\": " << counters.numReflectionRays
+       << ", \"antiAliasing\": " << counters.numAntiAliasingRays
+       << ", \"total\": " << getNumRays() << "}"
+       << ", \"savedShadowRays\": {\"culled\": " << counters.numCulledShadowRays
+       << ", \"unsampled\": " << counters.numUnsampledShadowRays << "}"
+       << ", \"occluderCache\": {\"lookups\": " << counters.numOccluderCacheLookups
+       << ", \"hits\": " << counters.numOccluderCacheHits
+       << ", \"hitRate\": " << getOccluderCacheHitRate() << "}"
+       << ", \"wavefront\": {\"waves\": " << counters.numReflectionWaves
+       << ", \"peakBytes\": " << counters.wavefrontPeakBytes << "}"
+       << ", \"tiles\": {\"count\": " << counters.numTiles
+       << ", \"stolen\": " << counters.numStolenTiles
+       << ", \"seconds\": " << counters.tileSeconds
+       << ", \"maxSeconds\": " << counters.maxTileSeconds
+       << ", \"slowestPixel\": [" << counters.slowestTilePixel.x << ", " << counters.slowestTilePixel.y << "]"
+       << ", \"maxImbalance\": " << counters.maxTileImbalance << "}"
+       << ", \"numRefinedPixels\": " << counters.numRefinedPixels
+       << ", \"numIntersections\": " << counters.numIntersections
+       << ", \"numShading\": " << counters.numShading
+       << ", \"raysPerSecond\": " << getRaysPerSecond()
+       << ", \"mraysPerSecond\": " << getMRaysPerSecond() << "}";
+}
+
+std::string RenderStatistics::toJSON() const
+{
+    std::ostringstream os;
+    writeJSON(os);
+    return os.str();
+}
+
+bool RenderStatistics::appendJSON(const std::string& filename) const
+{
+    std::ofstream file(filename, std::ios::app);
+    if (!file) return false;
+    writeJSON(file);
+    file << "\n";
+    return bool(file);
+}
+
+void RenderStatistics::log() const
+{
+    LogInfo("Scene raytraced with " << counters.numIntersections << " intersections and "
+                                << counters.numShading << " shading computations."
+                                << " Needed " << renderSeconds << " seconds with "
+                                << numThreads << " parallel threads.");
+    LogInfo(getNumRays() << " rays (" << counters.numPrimaryRays << " primary, "
+            << counters.numShadowRays << " shadow, " << counters.numReflectionRays << " reflection) at "
+            << getMRaysPerSecond() << " Mrays/s.");
+    if (counters.primarySeconds > 0 || counters.shadowSeconds > 0 || counters.reflectionSeconds > 0
+        || counters.imageWriteSeconds > 0)
+    {
+        LogInfo("Thread time: primary " << counters.primarySeconds << " s, shadow " << counters.shadowSeconds
+                << " s, reflection " << counters.reflectionSeconds << " s, image write "
+                << counters.imageWriteSeconds << " s.");
+    }
+    if (counters.numTiles > 0)
+    {
+        //Load balance; reflective regions can make some tiles much more expensive than others
+        LogInfo(counters.numTiles << " tiles: mean " << 1000 * counters.tileSeconds / double(counters.numTiles)
+                << " ms, max " << counters.maxTileSeconds * 1000 << " ms at pixel (" << counters.slowestTilePixel.x
+                << ", " << counters.slowestTilePixel.y << "), " << counters.numStolenTiles
+                << " stolen, thread imbalance up to " << counters.maxTileImbalance << ".");
+    }
+    if (counters.numRefinedPixels > 0)
+    {
+        LogInfo("Anti-aliasing refined " << counters.numRefinedPixels << " pixels with "
+                << counters.numAntiAliasingRays << " extra primary rays.");
+    }
+    if (counters.numCulledShadowRays > 0 || counters.numUnsampledShadowRays > 0)
+    {
+        LogInfo("Light selection saved " << counters.numCulledShadowRays + counters.numUnsampledShadowRays
+                << " shadow rays (" << counters.numCulledShadowRays << " culled, "
+                << counters.numUnsampledShadowRays << " not sampled).");
+    }
+    if (counters.numOccluderCacheLookups > 0)
+    {
+        LogInfo("Occluder cache blocked " << counters.numOccluderCacheHits << " of "
+                << counters.numOccluderCacheLookups << " shadow rays without traversal ("
+                << 100.0 * getOccluderCacheHitRate() << "% hit rate).");
+    }
+    if (counters.numReflectionWaves > 0)
+    {
+        LogInfo("Reflections traced in " << counters.numReflectionWaves << " sorted waves, using at most "
+                << counters.wavefrontPeakBytes / 1024 << " KiB for the queues.");
+    }
+    if (sceneBuildSeconds > 0 || bvhBuildSeconds > 0)
+    {
+        LogInfo("Scene build " << sceneBuildSeconds << " s, BVH build " << bvhBuildSeconds << " s.");
+    }
+}
+
+}// namespace inviwo
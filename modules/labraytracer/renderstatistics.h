@@ -0,0 +1,143 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 08:06:42
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <labraytracer/labraytracermoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <labraytracer/tilescheduler.h>
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace inviwo
+{
+
+/** Counters and stage timings of one render thread.
+    Every thread of a rendering writes to its own instance; they are merged at the end.
+*/
+struct alignas(64) RenderCounters
+{
+    uint64_t numPrimaryRays = 0;
+    uint64_t numShadowRays = 0;
+    uint64_t numReflectionRays = 0;
+    ///Primary and reflection rays that hit an object
+    uint64_t numIntersections = 0;
+    ///Shading computations for lights visible from an intersection
+    uint64_t numShading = 0;
+    ///Extra primary rays of the adaptive anti-aliasing; they are included in numPrimaryRays
+    uint64_t numAntiAliasingRays = 0;
+    ///Pixels refined by the adaptive anti-aliasing
+    uint64_t numRefinedPixels = 0;
+    ///Shadow rays saved by culling weak lights, and by sampling only some of the lights
+    uint64_t numCulledShadowRays = 0;
+    uint64_t numUnsampledShadowRays = 0;
+    ///Shadow rays that tested the cached occluder of their light first, and those it blocked
+    uint64_t numOccluderCacheLookups = 0;
+    uint64_t numOccluderCacheHits = 0;
+    ///Breadth-first waves of reflection rays, and the most memory their queues took at once
+    uint64_t numReflectionWaves = 0;
+    uint64_t wavefrontPeakBytes = 0;
+    ///Image tiles rendered by the scheduler, and those stolen from the range of another thread
+    uint64_t numTiles = 0;
+    uint64_t numStolenTiles = 0;
+
+    ///Wall-clock time the thread spent in the stages, in seconds; only measured with Scene::useStageTimings
+    double primarySeconds = 0;
+    double shadowSeconds = 0;
+    double reflectionSeconds = 0;
+    double imageWriteSeconds = 0;
+
+    ///Summed and longest time of the image tiles, and the first pixel of the longest one
+    double tileSeconds = 0;
+    double maxTileSeconds = 0;
+    size2_t slowestTilePixel = size2_t(0);
+    ///Largest thread imbalance of the scheduler runs; 1 is perfect balance
+    double maxTileImbalance = 0;
+
+    ///Adds the counters and times; the peak memory, the slowest tile and the imbalance are the larger ones
+    RenderCounters& operator+=(const RenderCounters& other);
+
+    /** Adds the statistics of the last run of the scheduler, whose tiles are made of blocks
+        of pixelStep x pixelStep pixels starting at row firstRow.
+    */
+    void addTiles(const TileScheduler::Statistics& tiles, const size_t pixelStep = 1, const size_t firstRow = 0);
+};
+
+/** Adds the time of a render stage to a counter of RenderCounters, if enabled.
+    The stages are timed per ray, where reading the clock costs more than the counting;
+    a disabled timer never reads it.
+*/
+class StageTimer
+{
+public:
+    explicit StageTimer(const bool bEnabled)
+        : bEnabled_(bEnabled)
+    {
+        if (bEnabled_) start_ = std::chrono::steady_clock::now();
+    }
+
+    void reset()
+    {
+        if (bEnabled_) start_ = std::chrono::steady_clock::now();
+    }
+
+    ///Adds the seconds since construction or the last reset
+    void addTo(double& seconds) const
+    {
+        if (bEnabled_) seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+private:
+    bool bEnabled_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+/** \class RenderStatistics
+    \brief Wall-clock timings and counters of a rendering
+
+    Stages that run once (scene build, BVH build, rendering) are given in wall-clock seconds.
+    The ray stages interleave on all threads; they are given as the time summed over the threads.
+*/
+class IVW_MODULE_LABRAYTRACER_API RenderStatistics
+{
+public:
+    size2_t imageSize = size2_t(0);
+    size_t numThreads = 0;
+
+    ///Creating the renderables; 0 if the scene was reused
+    double sceneBuildSeconds = 0;
+    ///Building the hierarchies; 0 if they were reused
+    double bvhBuildSeconds = 0;
+    ///Tracing all passes
+    double renderSeconds = 0;
+
+    RenderCounters counters;
+
+    uint64_t getNumRays() const;
+    ///Rays of any kind per second of rendering
+    double getRaysPerSecond() const;
+    double getMRaysPerSecond() const { return getRaysPerSecond() * 1e-6; }
+    ///Fraction of the occluder cache lookups that found the ray blocked; 0 without lookups
+    double getOccluderCacheHitRate() const;
+
+    ///Writes a single-line JSON object
+    void writeJSON(std::ostream& os) const;
+    std::string toJSON() const;
+
+    ///Appends the statistics as one line of JSON to the file
+    bool appendJSON(const std::string& filename) const;
+
+    void log() const;
+};
+
+}// namespace inviwo
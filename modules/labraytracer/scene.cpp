@@ -13,26 +13,38 @@
 #include <labraytracer/scene.h>
 #include <labraytracer/util.h>
 #include <labraytracer/performancetimer.h>
+#include <labraytracer/primitivegroup.h>
+#include <labraytracer/gbuffer.h>
+
+#include <algorithm>
+#include <bitset>
+#include <cstring>
 
-#ifdef IVW_USE_OPENMP
-#include <omp.h>
-#endif
 
 namespace inviwo
 {
 
 Scene::Scene()
     :backgroundColor(0, 0, 0, 1)
-    ,NumIntersections(0)
-    ,NumShading(0)
+    ,lightIntensity(1)
+    ,useAdaptiveAntiAliasing(false)
+    ,maxSamplesPerPixel(16)
+    ,antiAliasingThreshold(0.1)
+    ,usePacketTracing(true)
+    ,lightCullingThreshold(0)
+    ,numLightSamples(0)
+    ,useOccluderCache(true)
+    ,useWavefrontReflections(false)
+    ,usePrimitiveGroups(true)
+    ,useStageTimings(false)
     ,maxDepth(0)
+    ,bPrepared_(false)
+    ,bGroupedPrimitives_(false)
 {}
 
 void Scene::init(const ivec2& imageSize)
 {
     imageSize_ = imageSize;
-    NumIntersections = 0;
-    NumShading = 0;
 }
 
 void Scene::setCameraProperties(const dvec3& lookFrom, const dvec3& lookTo, const dvec3& lookUp,
@@ -110,61 +122,197 @@ void Scene::drawRenderablesGeometry(std::shared_ptr<BasicMesh> mesh,
 
 void Scene::prepareScene()
 {
+    //Lights are cheap to organize; the tree is cleared whenever they change
+    if (lightTree_.getNumLights() != lights_.size()) lightTree_.build(lights_);
+
+    //Nothing to do if no renderables have been added or removed since the last call
+    if (bPrepared_ && bGroupedPrimitives_ == usePrimitiveGroups) return;
+
+    //Wall-clock time; the hierarchies are built in parallel
+    PerformanceTimer Timer;
+
     for (auto& R : renderables_)
     {
         //R->updateBoundingBox();
         R->initialize();
         //R->updateTransforms();
     }
+
+    //Simple primitives take the place of one object per group of SIMD width
+    groupedRenderables_ = usePrimitiveGroups ? PrimitiveGroup::coalesce(renderables_) : renderables_;
+    bGroupedPrimitives_ = usePrimitiveGroups;
+
+    //Top-level hierarchy over the objects, the meshes have their own hierarchies underneath
+    std::vector<BoundingBox> boxes;
+    boxes.reserve(groupedRenderables_.size());
+    boundedRenderables_.clear();
+    unboundedRenderables_.clear();
+    for (auto& R : groupedRenderables_)
+    {
+        BoundingBox box;
+        const bool bBounded = R->getBoundingBox(box) && box.min()[0] <= box.max()[0] &&
+                              box.min()[1] <= box.max()[1] && box.min()[2] <= box.max()[2];
+        if (bBounded)
+        {
+            boundedRenderables_.push_back(R.get());
+            boxes.push_back(box);
+        }
+        else
+        {
+            unboundedRenderables_.push_back(R.get());
+        }
+    }
+
+    //Small leaves, since every object test is a virtual call
+    BVTree::BuildSettings Settings;
+    Settings.maxLeafSize = 2;
+    topLevelTree_.build(boxes, Settings);
+
+    //Shading dispatches on the material types
+    materialTable_.build(renderables_);
+    bPrepared_ = true;
+
+    LogInfo("Scene prepared in " << Timer.ElapsedTime() << " seconds. Top-level hierarchy over "
+            << boundedRenderables_.size() << " objects with " << topLevelTree_.getNumNodes()
+            << " nodes, " << unboundedRenderables_.size() << " unbounded objects.");
 }
 
 
 bool Scene::closestIntersection(const Ray& ray, RayIntersection& intersection,
                                 const double maxLambda) const
 {
-    //Find the closest renderable that this ray hits
-    double closestLambda = maxLambda;
-    RayIntersection currInter, closestInter;
+    //Find the closest renderable that this ray hits; only small hit records are copied on the way
+    HitRecord currHit, closestHit;
+    closestHit.lambda = maxLambda;
     bool bHit(false);
 
-    for (auto& R : renderables_)
+    const auto intersect = [&](const Renderable* R, double& currentMaxLambda)
     {
-        if (R->closestIntersection(ray, closestLambda, currInter))
+        if (R->closestHit(ray, currentMaxLambda, currHit))
         {
-            if (currInter.getLambda() < closestLambda) //sanity check, should be ok from above, but _some_ code may not check
+            if (currHit.lambda < currentMaxLambda) //sanity check, should be ok from above, but _some_ code may not check
             {
-                closestLambda = currInter.getLambda();
-                closestInter = currInter;
+                currentMaxLambda = currHit.lambda;
+                closestHit = currHit;
                 bHit = true;
             }
         }
-    }
+    };
 
-    if (bHit) intersection = closestInter;
+    double closestLambda = maxLambda;
+    for (const Renderable* R : unboundedRenderables_) intersect(R, closestLambda);
+
+    topLevelTree_.traverse(ray, closestLambda, [&](const int index, double& currentMaxLambda)
+    {
+        intersect(boundedRenderables_[index], currentMaxLambda);
+        return false; //keep looking for closer ones
+    });
+
+    if (bHit) intersection = closestHit.renderable->makeIntersection(ray, closestHit);
     return bHit;
 }
 
 
 bool Scene::anyIntersection(const Ray& ray, const double maxLambda) const
 {
-    //Faster when you write it in one line...
-    for (auto& R : renderables_) if (R->anyIntersection(ray, maxLambda)) return true;
+    for (const Renderable* R : unboundedRenderables_) if (R->anyIntersection(ray, maxLambda)) return true;
+
+    double currentMaxLambda = maxLambda;
+    return topLevelTree_.traverse(ray, currentMaxLambda, [&](const int index, double& lambda)
+    {
+        return boundedRenderables_[index]->anyIntersection(ray, lambda);
+    });
+}
+
+
+bool Scene::anyIntersection(const Ray& ray, const double maxLambda, HitRecord& occluder) const
+{
+    for (const Renderable* R : unboundedRenderables_) if (R->anyHit(ray, maxLambda, occluder)) return true;
+
+    double currentMaxLambda = maxLambda;
+    return topLevelTree_.traverse(ray, currentMaxLambda, [&](const int index, double& lambda)
+    {
+        return boundedRenderables_[index]->anyHit(ray, lambda, occluder);
+    });
+}
+
+
+int Scene::closestIntersection8(const RayPacket8& packet, const int activeMask,
+                                RayIntersection* intersections) const
+{
+    //Each renderable updates the closest distances and hits of the rays it hits
+    HitRecord hits[RayPacket8::Size];
+    double closestLambda[RayPacket8::Size];
+    for (int lane = 0; lane < RayPacket8::Size; lane++) closestLambda[lane] = std::numeric_limits<double>::infinity();
+
+    int hitMask = 0;
+    for (const Renderable* R : unboundedRenderables_)
+    {
+        hitMask |= R->closestHit8(packet, activeMask, closestLambda, hits);
+    }
+
+    topLevelTree_.traversePacket(packet, activeMask, closestLambda, [&](const int index, const int laneMask)
+    {
+        hitMask |= boundedRenderables_[index]->closestHit8(packet, laneMask, closestLambda, hits);
+        return 0; //keep looking for closer ones
+    });
+
+    //Full intersections for the final hits only
+    for (int lane = 0; lane < RayPacket8::Size; lane++)
+    {
+        if (hitMask & (1 << lane)) intersections[lane] = hits[lane].renderable->makeIntersection(packet.rays[lane], hits[lane]);
+    }
+
+    return hitMask;
+}
+
+
+int Scene::anyIntersection8(const RayPacket8& packet, const int activeMask, const double* maxLambda) const
+{
+    int hitMask = 0;
+    for (const Renderable* R : unboundedRenderables_)
+    {
+        hitMask |= R->anyIntersection8(packet, activeMask & ~hitMask, maxLambda);
+    }
+    if ((activeMask & ~hitMask) == 0) return hitMask;
+
+    topLevelTree_.traversePacket(packet, activeMask & ~hitMask, maxLambda, [&](const int index, const int laneMask)
+    {
+        const int occluded = boundedRenderables_[index]->anyIntersection8(packet, laneMask, maxLambda);
+        hitMask |= occluded;
+        return occluded; //these rays are done
+    });
 
-    return false;
+    return hitMask;
 }
 
 
-dvec4 Scene::trace(const Ray& ray, const size_t depth, bool& bIntersectionFound) const
+dvec4 Scene::trace(const Ray& ray, const size_t depth, bool& bIntersectionFound, RenderCounters& counters,
+                   OccluderCache* occluders, ReflectionQueue* reflections, LightScratch* scratch) const
 {
     RayIntersection intersection;
     bIntersectionFound = false;
 
+    //Find the closest object; primary rays and reflections are timed separately
+    const StageTimer Timer(useStageTimings);
+    const bool bHit = closestIntersection(ray, intersection);
+    if (depth == 0)
+    {
+        counters.numPrimaryRays++;
+        Timer.addTo(counters.primarySeconds);
+    }
+    else
+    {
+        counters.numReflectionRays++;
+        Timer.addTo(counters.reflectionSeconds);
+    }
+
     //If we find an intersection, we gotta throw some color at it, recursively.
-    if (closestIntersection(ray, intersection))
+    if (bHit)
     {
-        NumIntersections++;
+        counters.numIntersections++;
         bIntersectionFound = true;
-        return shade(intersection, depth);
+        return shade(intersection, depth, counters, nullptr, nullptr, occluders, reflections, scratch);
     }
 
     //Set to background color, since no intersection was found.
@@ -172,109 +320,921 @@ dvec4 Scene::trace(const Ray& ray, const size_t depth, bool& bIntersectionFound)
 }
 
 
-dvec4 Scene::shade(const RayIntersection& intersection, const size_t depth) const
+void Scene::traceShadowRays(const RayIntersection& intersection, uint8_t* lightVisible, RenderCounters& counters,
+                            const double* lightWeight, OccluderCache* occluders) const
+{
+    const StageTimer Timer(useStageTimings);
+    if (occluders && occluders->size() != lights_.size()) occluders->assign(lights_.size(), HitRecord());
+    for (size_t l(0); l < lights_.size(); l++)
+    {
+        if (lightWeight && lightWeight[l] == 0)
+        {
+            lightVisible[l] = 0;
+            continue;
+        }
+        double shadowLambda;
+        const Ray shadowRay = getShadowRay(intersection, *lights_[l], shadowLambda);
+        counters.numShadowRays++;
+        if (!occluders)
+        {
+            lightVisible[l] = anyIntersection(shadowRay, shadowLambda) ? 0 : 1;
+            continue;
+        }
+
+        //The last occluder towards this light first. An unblocked ray empties the cache,
+        //so that lit regions do not pay for lookups.
+        HitRecord& occluder = (*occluders)[l];
+        if (occluder.renderable)
+        {
+            counters.numOccluderCacheLookups++;
+            if (occluder.renderable->anyPrimitiveIntersection(shadowRay, shadowLambda, occluder.primitive))
+            {
+                counters.numOccluderCacheHits++;
+                lightVisible[l] = 0;
+                continue;
+            }
+        }
+        if (anyIntersection(shadowRay, shadowLambda, occluder))
+        {
+            lightVisible[l] = 0;
+        }
+        else
+        {
+            lightVisible[l] = 1;
+            occluder.renderable = nullptr;
+        }
+    }
+    Timer.addTo(counters.shadowSeconds);
+}
+
+std::vector<Scene::OccluderCache> Scene::makeOccluderCaches(const TileScheduler& scheduler) const
+{
+    if (!useOccluderCache) return {};
+    return std::vector<OccluderCache>(scheduler.getNumThreads(), OccluderCache(lights_.size()));
+}
+
+bool Scene::isSelectingLights() const
+{
+    return (lightCullingThreshold > 0 || (numLightSamples > 0 && numLightSamples < lights_.size()))
+           && lightTree_.getNumLights() == lights_.size();
+}
+
+namespace
+{
+///Random number in [0, 1) that only depends on the hit position and the index of the sample
+double hitRandom(const dvec3& position, const uint32_t sample)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ull * (sample + 1);
+    for (int i(0); i < 3; i++)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &position[i], sizeof(bits));
+        h = (h ^ bits) * 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 31;
+    }
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 29;
+    return (h >> 11) * (1.0 / 9007199254740992.0);
+}
+}
+
+bool Scene::selectLights(const RayIntersection& intersection, double* lightWeight, RenderCounters& counters) const
+{
+    if (!isSelectingLights()) return false;
+
+    const size_t numLights = lights_.size();
+    const dvec3& P = intersection.getPosition();
+    const uint32_t materialId = getMaterialId(intersection);
+    const bool bFalloff = (materialId != MaterialTable::NotFound) && materialTable_.hasFalloff(materialId);
+
+    if (numLightSamples > 0 && numLightSamples < numLights)
+    {
+        //Unbiased: every sample contributes its light divided by its probability
+        std::fill(lightWeight, lightWeight + numLights, 0.0);
+        for (size_t s(0); s < numLightSamples; s++)
+        {
+            double pdf;
+            const uint32_t l = lightTree_.sample(P, bFalloff, hitRandom(P, uint32_t(s)), pdf);
+            lightWeight[l] += 1.0 / (double(numLightSamples) * pdf);
+        }
+        counters.numUnsampledShadowRays += std::count(lightWeight, lightWeight + numLights, 0.0);
+    }
+    else
+    {
+        std::fill(lightWeight, lightWeight + numLights, 1.0);
+    }
+
+    //The bound of the tree holds only for materials with quadratic fall-off
+    if (lightCullingThreshold > 0 && bFalloff)
+    {
+        counters.numCulledShadowRays += lightTree_.cull(P, lightCullingThreshold / lightIntensity, lightWeight);
+    }
+    return true;
+}
+
+Ray Scene::getShadowRay(const RayIntersection& intersection, const Light& light, double& maxLambda) const
 {
     // This offset must be added to intersection points for further
     // traced rays to avoid noise in the image
     const dvec3 offset = Util::scalarMult(Util::epsilon, intersection.getNormal());
     const dvec3 IntersectionSafePoint = intersection.getPosition() + offset;
 
-    //Shortcuts for the intersection point that we are shading
-    std::shared_ptr<const Renderable> renderable = intersection.getRenderable();
-    std::shared_ptr<const Material> material = renderable->getMaterial();
+    //Define the shadow ray from the light to the intersection point.
+    const dvec3 L = IntersectionSafePoint - light.getPosition();
+    maxLambda = length(L);
+    return Ray(light.getPosition(), L);
+}
+
+
+dvec4 Scene::shade(const RayIntersection& intersection, const size_t depth, RenderCounters& counters,
+                   const uint8_t* lightVisible, const double* lightWeight, OccluderCache* occluders,
+                   ReflectionQueue* reflections, LightScratch* scratch) const
+{
+    //Select the lights and trace shadow rays, unless the visibility of the lights is known already
+    uint8_t localVisible[16];
+    double localWeight[16];
+    LightScratch localScratch;
+    if (!lightVisible)
+    {
+        uint8_t* visible = localVisible;
+        double* weight = localWeight;
+        if (lights_.size() > 16)
+        {
+            //Grows once per thread; the reflections below reuse it after the direct light is shaded
+            if (!scratch) scratch = &localScratch;
+            scratch->visible.resize(lights_.size());
+            scratch->weights.resize(lights_.size());
+            visible = scratch->visible.data();
+            weight = scratch->weights.data();
+        }
+        lightWeight = selectLights(intersection, weight, counters) ? weight : nullptr;
+        traceShadowRays(intersection, visible, counters, lightWeight, occluders);
+        lightVisible = visible;
+    }
+
+    const uint32_t materialId = getMaterialId(intersection);
+    const dvec4 retColor = shadeDirect(intersection, materialId, lightVisible, lightWeight, counters);
+    return shadeReflection(intersection, materialId, depth, retColor, counters, reflections, scratch);
+}
+
+uint32_t Scene::getMaterialId(const RayIntersection& intersection) const
+{
+    //Resolved once in prepareScene(). A renderable that is also part of another scene
+    //may carry the id of that scene; then its material is shaded without the table.
+    const Renderable* R = intersection.getRenderable();
+    return materialTable_.isId(R->mMaterialId, R->mMaterial.get()) ? R->mMaterialId : MaterialTable::NotFound;
+}
+
+dvec4 Scene::shadeDirect(const RayIntersection& intersection, const uint32_t materialId, const uint8_t* lightVisible,
+                         const double* lightWeight, RenderCounters& counters) const
+{
+    if (materialId != MaterialTable::NotFound)
+    {
+        return materialTable_.shade({&intersection, lightVisible, materialId, lightWeight}, lights_, counters);
+    }
+
+    //Material set after prepareScene(); shade it virtually
+    const Material* material = intersection.getRenderable()->mMaterial.get();
 
     //Run over all lights and add their contributions. Light is linear.
     dvec4 retColor(0, 0, 0, 1);
-    for (auto& light : lights_)
+    for (size_t l(0); l < lights_.size(); l++)
     {
-        //Shade ambient part, always
-        retColor += material->shadeAmbient(intersection, *light);
+        const Light& light = *lights_[l];
 
-        //Define the shadow ray from the light to the intersection point.
-        const dvec3 L = IntersectionSafePoint - light->getPosition();
-        const Ray shadowRay(light->getPosition(), L);
+        //Shade ambient part, always
+        retColor += material->shadeAmbient(intersection, light);
 
         //Shade diffuse and specular parts only if light is visible from intersection point.
-        if (!anyIntersection(shadowRay, length(L)))
+        if (lightVisible[l])
         {
-            retColor += material->shade(intersection, *light);
-            NumShading++;
+            const dvec4 direct = material->shade(intersection, light);
+            retColor += lightWeight ? dvec4(dvec3(direct) * lightWeight[l], direct[3]) : direct;
+            counters.numShading++;
         }
     }
+    return retColor;
+}
 
+dvec4 Scene::shadeReflection(const RayIntersection& intersection, const uint32_t materialId, const size_t depth,
+                             const dvec4& directColor, RenderCounters& counters, ReflectionQueue* reflections,
+                             LightScratch* scratch) const
+{
     //Recursive Raytracing:
     //We are now bouncing off the intersection point
     //into the direction of the reflection vector.
     //We do this up to a certain number of times and only if the material reflects.
-    if (depth < maxDepth)
+    if (depth >= maxDepth) return directColor;
+
+    //Are we even reflective?
+    const Material* material =
+        (materialId == MaterialTable::NotFound) ? intersection.getRenderable()->mMaterial.get() : nullptr;
+    const double t = material ? material->getReflectance() : materialTable_.getReflectance(materialId);
+    if (t <= 0) return directColor;
+
+    // This offset must be added to intersection points for further
+    // traced rays to avoid noise in the image
+    const dvec3 offset = Util::scalarMult(Util::epsilon, intersection.getNormal());
+    const dvec3 IntersectionSafePoint = intersection.getPosition() + offset;
+
+    //Get out-going viewing direction (reflection direction)
+    // - normal
+    const dvec3& N(intersection.getNormal());
+    // - incident view vector
+    const dvec3& I = intersection.getRay().getDirection();
+    // - reflect the view vector around the normal
+    const dvec3 D = normalize(reflect(I, N));
+    const dvec3 absorption =
+        material ? material->getAbsorptionSpectrum() : materialTable_.getAbsorptionSpectrum(materialId);
+
+    //Wavefront mode: the incident radiance is traced later, together with the other reflections
+    if (reflections)
     {
-        //Are we even reflective?
-        const double t = material->getReflectance();
-        if (t > 0)
-        {
-            //Get out-going viewing direction (reflection direction)
-            // - normal
-            const dvec3& N(intersection.getNormal());
-            // - incident view vector
-            const dvec3& I = intersection.getRay().getDirection();
-            // - reflect the view vector around the normal
-            const dvec3 D = normalize(reflect(I, N));
-
-            // calculate incident radiance by recursive ray tracing
-            const Ray r(IntersectionSafePoint, D);
-            bool bIntersectionFound;
-            dvec4 incident_radiance = trace(r, depth + 1, bIntersectionFound);
-
-            //How much of the incident radiance is reflected toward the viewer?
-            // - do not mix in much of the background color (we did not find an intersection in those cases)
-            if (!bIntersectionFound) incident_radiance /= lightIntensity;
-            retColor = retColor * (1.0 - t) + incident_radiance * dvec4(material->getAbsorptionSpectrum(), 1) * t;
-            retColor[3] = 1.0;
-        }
+        reflections->pending = {IntersectionSafePoint, D, absorption * t, 0, 0};
+        reflections->bPending = true;
+        dvec4 retColor = directColor * (1.0 - t);
+        retColor[3] = 1.0;
+        return retColor;
     }
 
+    // calculate incident radiance by recursive ray tracing
+    const Ray r(IntersectionSafePoint, D);
+    bool bIntersectionFound;
+    dvec4 incident_radiance = trace(r, depth + 1, bIntersectionFound, counters, nullptr, nullptr, scratch);
+
+    //How much of the incident radiance is reflected toward the viewer?
+    // - do not mix in much of the background color (we did not find an intersection in those cases)
+    if (!bIntersectionFound) incident_radiance /= lightIntensity;
+    dvec4 retColor = directColor * (1.0 - t) + incident_radiance * dvec4(absorption, 1) * t;
+    retColor[3] = 1.0;
     return retColor;
 }
 
 
-void Scene::render(LayerRAM* lr, const size_t maxRecursiveDepth) const
+void Scene::render(LayerRAM* lr, const size_t maxRecursiveDepth, TileScheduler& scheduler,
+                   RenderStatistics* statistics) const
 {
     //Statistics!
-    NumIntersections = 0;
-    NumShading = 0;
+    RenderStatistics Stats;
+    Stats.imageSize = size2_t(imageSize_);
+    Stats.numThreads = scheduler.getNumThreads();
+
+    //Measure performance; wall-clock time as we render in parallel
+    PerformanceTimer Timer;
+
+    //For every pixel, raytrace.
+    renderPass(lr, maxRecursiveDepth, scheduler, 1, 0, size_t(imageSize_.y), Stats.counters);
+    if (useAdaptiveAntiAliasing) antiAliasingPass(lr, maxRecursiveDepth, scheduler, Stats.counters);
+
+    Stats.renderSeconds = Timer.ElapsedTime();
+    Stats.log();
+    if (statistics) *statistics = Stats;
+}
+
+bool Scene::renderPass(LayerRAM* lr, const size_t maxRecursiveDepth, TileScheduler& scheduler,
+                       const size_t pixelStep, const size_t firstRow, const size_t lastRow,
+                       RenderCounters& counters, const std::atomic<bool>* cancelled, GBuffer* gBuffer) const
+{
+    //First hits are only recorded at full resolution
+    if (pixelStep != 1) gBuffer = nullptr;
 
     //How deep do we go?
     maxDepth = maxRecursiveDepth;
 
-    //Measure performance
-    PerformanceTimer Timer;
-    int NumThreads(1);
+    //Each thread counts on its own; merged below
+    std::vector<RenderCounters> threadCounters(scheduler.getNumThreads());
+    std::vector<OccluderCache> threadOccluders = makeOccluderCaches(scheduler);
+    std::vector<LightScratch> threadScratch(scheduler.getNumThreads());
 
-    //For every pixel, raytrace.
-    #ifdef IVW_USE_OPENMP
-        omp_set_num_threads(std::thread::hardware_concurrency());
-        NumThreads = omp_get_max_threads();
-        #pragma omp parallel for schedule(dynamic,16)
-    #endif
-    for(int j=0;j<imageSize_[1];j++)
-    {
-        for(int i=0;i<imageSize_[0];i++)
+    //Wavefront mode: the reflections are queued per thread and traced after all primary rays
+    const bool bWavefront = useWavefrontReflections && maxDepth > 0;
+    std::vector<ReflectionQueue> threadReflections(bWavefront ? scheduler.getNumThreads() : 0);
+
+    //The scheduler works on the grid of blocks; tiles are distributed over its threads.
+    const size_t width = size_t(imageSize_.x);
+    const size2_t numBlocks((width + pixelStep - 1) / pixelStep,
+                            (lastRow - firstRow + pixelStep - 1) / pixelStep);
+    const auto writeBlock = [&](const size2_t& P, const dvec4& pixelcolor, RenderCounters& tileCounters)
+    {
+        const StageTimer WriteTimer(useStageTimings);
+        const size2_t blockEnd(std::min(P.x + pixelStep, width), std::min(P.y + pixelStep, lastRow));
+        for (size_t y = P.y; y < blockEnd.y; y++)
         {
-            const size2_t P = size2_t(i, j);
-            Ray ray = getRay(P);
-            bool bIntersectionFound;
-            dvec4 pixelcolor = trace(ray, 0, bIntersectionFound);
-            //Only apply light intensity correction to non-background pixels
-            if (bIntersectionFound) pixelcolor *= lightIntensity;
-            pixelcolor[3] = 1.0;
-            lr->setFromDVec4(P, pixelcolor);
+            for (size_t x = P.x; x < blockEnd.x; x++)
+            {
+                lr->setFromDVec4(size2_t(x, y), pixelcolor);
+            }
+        }
+        WriteTimer.addTo(tileCounters.imageWriteSeconds);
+    };
+
+    bool bCompleted = scheduler.run(numBlocks, [&](const TileScheduler::Tile& tile, const size_t thread)
+    {
+        RenderCounters& tileCounters = threadCounters[thread];
+        ReflectionQueue* reflections = bWavefront ? &threadReflections[thread] : nullptr;
+        LightScratch* scratch = &threadScratch[thread];
+        if (usePacketTracing)
+        {
+            renderTilePackets(tile, pixelStep, firstRow, tileCounters, gBuffer, reflections, scratch, writeBlock);
+            return;
+        }
+
+        OccluderCache* occluders = threadOccluders.empty() ? nullptr : &threadOccluders[thread];
+        std::vector<uint8_t> lightVisible(lights_.size());
+        std::vector<double> lightWeight(lights_.size());
+        for (size_t j = tile.begin.y; j < tile.end.y; j++)
+        {
+            for (size_t i = tile.begin.x; i < tile.end.x; i++)
+            {
+                const size2_t P = size2_t(i * pixelStep, firstRow + j * pixelStep);
+                Ray ray = getRay(P);
+                bool bIntersectionFound;
+                dvec4 pixelcolor;
+                if (gBuffer)
+                {
+                    //Same as trace(), but the hit and the light visibility are kept
+                    const StageTimer Timer(useStageTimings);
+                    RayIntersection intersection;
+                    bIntersectionFound = closestIntersection(ray, intersection);
+                    tileCounters.numPrimaryRays++;
+                    Timer.addTo(tileCounters.primarySeconds);
+                    if (bIntersectionFound)
+                    {
+                        tileCounters.numIntersections++;
+                        const double* weight =
+                            selectLights(intersection, lightWeight.data(), tileCounters) ? lightWeight.data() : nullptr;
+                        traceShadowRays(intersection, lightVisible.data(), tileCounters, weight, occluders);
+                        pixelcolor = shade(intersection, 0, tileCounters, lightVisible.data(), weight, nullptr,
+                                           reflections, scratch);
+                        gBuffer->set(P, intersection, lightVisible.data());
+                    }
+                    else
+                    {
+                        pixelcolor = backgroundColor;
+                        gBuffer->setBackground(P);
+                    }
+                }
+                else
+                {
+                    pixelcolor = trace(ray, 0, bIntersectionFound, tileCounters, occluders, reflections, scratch);
+                }
+                //Only apply light intensity correction to non-background pixels
+                if (bIntersectionFound) pixelcolor *= lightIntensity;
+                pixelcolor[3] = 1.0;
+                if (deferBlock(reflections, P, pixelcolor)) continue;
+                writeBlock(P, pixelcolor, tileCounters);
+            }
+        }
+    }, cancelled);
+    counters.addTiles(scheduler.getStatistics(), pixelStep, firstRow);
+
+    if (bCompleted && bWavefront)
+    {
+        bCompleted = traceReflectionWaves(threadReflections, scheduler, threadCounters, counters, cancelled, writeBlock);
+    }
+
+    for (const RenderCounters& threadCounter : threadCounters) counters += threadCounter;
+    return bCompleted;
+}
+
+bool Scene::deferBlock(ReflectionQueue* reflections, const size2_t& P, const dvec4& pixelcolor) const
+{
+    if (!reflections || !reflections->bPending) return false;
+    reflections->bPending = false;
+
+    //The light intensity applies to everything the primary ray gathers, as it hit something
+    ReflectionQueue::Entry& ray = reflections->pending;
+    ray.pixel = uint32_t(reflections->pixels.size());
+    ray.weight *= lightIntensity;
+    reflections->pixels.push_back({P, dvec3(pixelcolor)});
+    reflections->rays.push_back(ray);
+    return true;
+}
+
+namespace
+{
+///Reflections are binned into 16^3 cells of the bounds of their origins, times the 8 octants of their directions
+constexpr uint32_t WaveCellBits = 4;
+constexpr uint32_t NumWaveBins = 8u << (3 * WaveCellBits);
+///Reflection rays per scheduled block; a tile holds tileSize of them
+constexpr size_t WaveBlockSize = 256;
+
+///Interleaves the bits of the cell coordinates, so that nearby cells get nearby bins
+uint32_t mortonCode(const uint32_t x, const uint32_t y, const uint32_t z)
+{
+    uint32_t code(0);
+    for (uint32_t b(0); b < WaveCellBits; b++)
+    {
+        code |= (((x >> b) & 1) << (3 * b)) | (((y >> b) & 1) << (3 * b + 1)) | (((z >> b) & 1) << (3 * b + 2));
+    }
+    return code;
+}
+
+///Sets the bins of the rays and returns their indices sorted by bin, keeping the order within a bin
+void binReflections(std::vector<Scene::ReflectionQueue::Entry>& rays, std::vector<uint32_t>& order)
+{
+    BoundingBox box;
+    for (const auto& ray : rays) box.expandByPoint(ray.origin);
+    const uint32_t maxCell = (1u << WaveCellBits) - 1;
+    const dvec3 scale = dvec3(double(maxCell + 1)) / glm::max(box.max() - box.min(), dvec3(1e-12));
+
+    std::vector<uint32_t> binStart(NumWaveBins + 1, 0);
+    for (auto& ray : rays)
+    {
+        const dvec3 cell = (ray.origin - box.min()) * scale;
+        const uint32_t octant = (ray.direction.x < 0 ? 1 : 0) | (ray.direction.y < 0 ? 2 : 0) | (ray.direction.z < 0 ? 4 : 0);
+        ray.bin = (octant << (3 * WaveCellBits)) | mortonCode(std::min(maxCell, uint32_t(cell.x)),
+                                                              std::min(maxCell, uint32_t(cell.y)),
+                                                              std::min(maxCell, uint32_t(cell.z)));
+        binStart[ray.bin + 1]++;
+    }
+    for (uint32_t b(0); b < NumWaveBins; b++) binStart[b + 1] += binStart[b];
+
+    order.resize(rays.size());
+    for (uint32_t i(0); i < uint32_t(rays.size()); i++) order[binStart[rays[i].bin]++] = i;
+}
+}
+
+template <typename WriteBlock>
+bool Scene::traceReflectionWaves(std::vector<ReflectionQueue>& queues, TileScheduler& scheduler,
+                                 std::vector<RenderCounters>& threadCounters, RenderCounters& counters,
+                                 const std::atomic<bool>* cancelled, WriteBlock&& writeBlock) const
+{
+    //The deferred blocks and the first wave of all threads
+    size_t numPixels(0);
+    for (const ReflectionQueue& queue : queues) numPixels += queue.pixels.size();
+    std::vector<ReflectionQueue::Pixel> pixels;
+    std::vector<ReflectionQueue::Entry> wave;
+    pixels.reserve(numPixels);
+    wave.reserve(numPixels);
+
+    //While they are gathered, the queues of the threads still hold the same
+    uint64_t gatherBytes = numPixels * (sizeof(ReflectionQueue::Pixel) + sizeof(ReflectionQueue::Entry));
+    for (const ReflectionQueue& queue : queues)
+    {
+        gatherBytes += queue.pixels.capacity() * sizeof(ReflectionQueue::Pixel)
+                       + queue.rays.capacity() * sizeof(ReflectionQueue::Entry);
+    }
+    counters.wavefrontPeakBytes = std::max(counters.wavefrontPeakBytes, gatherBytes);
+
+    for (ReflectionQueue& queue : queues)
+    {
+        const uint32_t offset = uint32_t(pixels.size());
+        pixels.insert(pixels.end(), queue.pixels.begin(), queue.pixels.end());
+        for (ReflectionQueue::Entry& ray : queue.rays)
+        {
+            ray.pixel += offset;
+            wave.push_back(ray);
+        }
+        std::vector<ReflectionQueue::Pixel>().swap(queue.pixels);
+        std::vector<ReflectionQueue::Entry>().swap(queue.rays);
+    }
+
+    //One wave per depth. Every ray adds its light to its pixel and is replaced by its own reflection,
+    //or marked as done; a pixel has at most one ray per wave.
+    const uint32_t Done = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> order;
+    std::vector<LightScratch> threadScratch(scheduler.getNumThreads());
+    for (size_t depth(1); depth <= maxDepth && !wave.empty(); depth++)
+    {
+        binReflections(wave, order);
+        counters.numReflectionWaves++;
+        counters.wavefrontPeakBytes = std::max(counters.wavefrontPeakBytes,
+            uint64_t(pixels.capacity() * sizeof(ReflectionQueue::Pixel) + wave.capacity() * sizeof(ReflectionQueue::Entry)
+                     + order.capacity() * sizeof(uint32_t)));
+
+        const size_t numBlocks = (order.size() + WaveBlockSize - 1) / WaveBlockSize;
+        if (!scheduler.run(size2_t(numBlocks, 1), [&](const TileScheduler::Tile& tile, const size_t thread)
+        {
+            RenderCounters& tileCounters = threadCounters[thread];
+            ReflectionQueue& queue = queues[thread];
+            LightScratch* scratch = &threadScratch[thread];
+
+            //Adds the light along the ray to its pixel, and replaces the ray by its own reflection
+            const auto gather = [&](ReflectionQueue::Entry& entry, const bool bIntersectionFound, const dvec4& incident)
+            {
+                //Do not mix in much of the background color, as in shadeReflection()
+                pixels[entry.pixel].color +=
+                    entry.weight * (bIntersectionFound ? dvec3(incident) : dvec3(incident) / lightIntensity);
+
+                if (!queue.bPending)
+                {
+                    entry.pixel = Done;
+                    return;
+                }
+                queue.bPending = false;
+                const ReflectionQueue::Entry& reflection = queue.pending;
+                entry.origin = reflection.origin;
+                entry.direction = reflection.direction;
+                entry.weight *= reflection.weight;
+            };
+
+            const size_t begin = tile.begin.x * WaveBlockSize;
+            const size_t end = std::min(tile.end.x * WaveBlockSize, order.size());
+            if (!usePacketTracing)
+            {
+                for (size_t i = begin; i < end; i++)
+                {
+                    ReflectionQueue::Entry& entry = wave[order[i]];
+                    bool bIntersectionFound;
+                    const dvec4 incident = trace(Ray(entry.origin, entry.direction), depth, bIntersectionFound,
+                                                 tileCounters, nullptr, &queue, scratch);
+                    gather(entry, bIntersectionFound, incident);
+                }
+                return;
+            }
+
+            //Neighbors in the sorted order are coherent enough to be traced as packets
+            for (size_t i = begin; i < end; i += RayPacket8::Size)
+            {
+                RayPacket8 packet;
+                int activeMask = 0;
+                for (int lane = 0; lane < RayPacket8::Size && i + lane < end; lane++)
+                {
+                    const ReflectionQueue::Entry& entry = wave[order[i + lane]];
+                    packet.setRay(lane, Ray(entry.origin, entry.direction));
+                    activeMask |= (1 << lane);
+                }
+
+                const StageTimer Timer(useStageTimings);
+                RayIntersection intersections[RayPacket8::Size];
+                const int hitMask = closestIntersection8(packet, activeMask, intersections);
+                tileCounters.numReflectionRays += std::bitset<RayPacket8::Size>(activeMask).count();
+                tileCounters.numIntersections += std::bitset<RayPacket8::Size>(hitMask).count();
+                Timer.addTo(tileCounters.reflectionSeconds);
+
+                for (int lane = 0; lane < RayPacket8::Size; lane++)
+                {
+                    if (!(activeMask & (1 << lane))) continue;
+                    const bool bIntersectionFound = (hitMask & (1 << lane)) != 0;
+                    const dvec4 incident = bIntersectionFound ? shade(intersections[lane], depth, tileCounters, nullptr,
+                                                                      nullptr, nullptr, &queue, scratch)
+                                                              : backgroundColor;
+                    gather(wave[order[i + lane]], bIntersectionFound, incident);
+                }
+            }
+        }, cancelled)) return false;
+
+        wave.erase(std::remove_if(wave.begin(), wave.end(),
+                                  [Done](const ReflectionQueue::Entry& ray) { return ray.pixel == Done; }),
+                   wave.end());
+    }
+
+    const size_t numBlocks = (pixels.size() + WaveBlockSize - 1) / WaveBlockSize;
+    return scheduler.run(size2_t(numBlocks, 1), [&](const TileScheduler::Tile& tile, const size_t thread)
+    {
+        const size_t end = std::min(tile.end.x * WaveBlockSize, pixels.size());
+        for (size_t i = tile.begin.x * WaveBlockSize; i < end; i++)
+        {
+            writeBlock(pixels[i].position, dvec4(pixels[i].color, 1.0), threadCounters[thread]);
+        }
+    }, cancelled);
+}
+
+bool Scene::reshade(LayerRAM* lr, const size_t maxRecursiveDepth, TileScheduler& scheduler, const GBuffer& gBuffer,
+                    RenderCounters& counters, const std::atomic<bool>* cancelled) const
+{
+    if (!gBuffer.isValidFor(*this)) return false;
+
+    //How deep do we go?
+    maxDepth = maxRecursiveDepth;
+
+    //Light visibility is only reused if the lights did not move. The selection of lights
+    //depends on their colors and the intensity, so it is made again.
+    const bool bSameLights = gBuffer.hasSameLights(*this) && !isSelectingLights();
+
+    std::vector<RenderCounters> threadCounters(scheduler.getNumThreads());
+    std::vector<OccluderCache> threadOccluders = makeOccluderCaches(scheduler);
+    std::vector<LightScratch> threadScratch(scheduler.getNumThreads());
+    const bool bCompleted = scheduler.run(size2_t(imageSize_), [&](const TileScheduler::Tile& tile, const size_t thread)
+    {
+        RenderCounters& tileCounters = threadCounters[thread];
+        OccluderCache* occluders = threadOccluders.empty() ? nullptr : &threadOccluders[thread];
+        LightScratch* scratch = &threadScratch[thread];
+        for (size_t y = tile.begin.y; y < tile.end.y; y++)
+        {
+            for (size_t x = tile.begin.x; x < tile.end.x; x++)
+            {
+                const size2_t P(x, y);
+                const GBuffer::Sample& sample = gBuffer.get(P);
+                dvec4 pixelcolor = backgroundColor;
+                if (sample.renderable)
+                {
+                    const RayIntersection intersection = gBuffer.getIntersection(sample, getRay(P));
+                    pixelcolor = shade(intersection, 0, tileCounters, bSameLights ? gBuffer.getLightVisible(P) : nullptr,
+                                       nullptr, occluders, nullptr, scratch);
+                    //Only apply light intensity correction to non-background pixels
+                    pixelcolor *= lightIntensity;
+                }
+                pixelcolor[3] = 1.0;
+
+                const StageTimer WriteTimer(useStageTimings);
+                lr->setFromDVec4(P, pixelcolor);
+                WriteTimer.addTo(tileCounters.imageWriteSeconds);
+            }
+        }
+    }, cancelled);
+    counters.addTiles(scheduler.getStatistics());
+
+    for (const RenderCounters& threadCounter : threadCounters) counters += threadCounter;
+    return bCompleted;
+}
+
+namespace
+{
+///Random number in [0, 1) that only depends on the pixel and the index of the sample
+double jitter(const size2_t& pixel, const uint32_t sample)
+{
+    uint32_t h = uint32_t(pixel.x) * 0x8da6b343u ^ uint32_t(pixel.y) * 0xd8163841u ^ sample * 0xcb1ab31fu;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return (h >> 8) * (1.0 / 16777216.0);
+}
+
+///Largest difference of the colors in any channel, clamped to the displayed range
+double contrast(const dvec4& minColor, const dvec4& maxColor)
+{
+    double c(0);
+    for (int i(0); i < 3; i++)
+    {
+        c = std::max(c, glm::clamp(maxColor[i], 0.0, 1.0) - glm::clamp(minColor[i], 0.0, 1.0));
+    }
+    return c;
+}
+}
+
+bool Scene::antiAliasingPass(LayerRAM* lr, const size_t maxRecursiveDepth, TileScheduler& scheduler,
+                             RenderCounters& counters, const std::atomic<bool>* cancelled) const
+{
+    //How deep do we go?
+    maxDepth = maxRecursiveDepth;
+
+    const size2_t size(imageSize_);
+    std::vector<RenderCounters> threadCounters(scheduler.getNumThreads());
+    std::vector<OccluderCache> threadOccluders = makeOccluderCaches(scheduler);
+    std::vector<LightScratch> threadScratch(scheduler.getNumThreads());
+
+    //Flag the pixels at edges first, as the refinement overwrites the colors they are detected from
+    std::vector<uint8_t> refine(size.x * size.y, 0);
+    if (!scheduler.run(size, [&](const TileScheduler::Tile& tile, const size_t)
+    {
+        for (size_t y = tile.begin.y; y < tile.end.y; y++)
+        {
+            for (size_t x = tile.begin.x; x < tile.end.x; x++)
+            {
+                dvec4 minColor(std::numeric_limits<double>::max());
+                dvec4 maxColor(std::numeric_limits<double>::lowest());
+                for (size_t ny = (y > 0 ? y - 1 : 0); ny <= std::min(y + 1, size.y - 1); ny++)
+                {
+                    for (size_t nx = (x > 0 ? x - 1 : 0); nx <= std::min(x + 1, size.x - 1); nx++)
+                    {
+                        const dvec4 color = lr->getAsDVec4(size2_t(nx, ny));
+                        minColor = glm::min(minColor, color);
+                        maxColor = glm::max(maxColor, color);
+                    }
+                }
+                refine[y * size.x + x] = contrast(minColor, maxColor) > antiAliasingThreshold ? 1 : 0;
+            }
+        }
+    }, cancelled)) return false;
+
+    //Mean color of n x n jittered strata of a pixel; strata that are already sampled are skipped
+    const auto sampleStrata = [&](const size2_t& P, const size_t n, std::vector<dvec4>& samples,
+                                  std::vector<dvec2>& positions, RenderCounters& tileCounters,
+                                  OccluderCache* occluders, LightScratch* scratch)
+    {
+        const size_t numBefore = samples.size();
+        for (size_t sy(0); sy < n; sy++)
+        {
+            for (size_t sx(0); sx < n; sx++)
+            {
+                //Stratum [sx, sx+1) x [sy, sy+1) in units of 1/n pixel, relative to the lower left pixel corner
+                bool bSampled = false;
+                for (size_t s(0); s < numBefore; s++)
+                {
+                    bSampled |= (size_t(positions[s].x * n) == sx && size_t(positions[s].y * n) == sy);
+                }
+                if (bSampled) continue;
+
+                const uint32_t index = uint32_t(samples.size());
+                const dvec2 position((sx + jitter(P, 2 * index)) / n, (sy + jitter(P, 2 * index + 1)) / n);
+                bool bIntersectionFound;
+                dvec4 color = trace(getRay(dvec2(P) + position - dvec2(0.5)), 0, bIntersectionFound, tileCounters,
+                                    occluders, nullptr, scratch);
+                if (bIntersectionFound) color *= lightIntensity;
+                color[3] = 1.0;
+                samples.push_back(color);
+                positions.push_back(position);
+            }
+        }
+        tileCounters.numAntiAliasingRays += samples.size() - numBefore;
+    };
+
+    const bool bCompleted = scheduler.run(size, [&](const TileScheduler::Tile& tile, const size_t thread)
+    {
+        RenderCounters& tileCounters = threadCounters[thread];
+        OccluderCache* occluders = threadOccluders.empty() ? nullptr : &threadOccluders[thread];
+        LightScratch* scratch = &threadScratch[thread];
+        std::vector<dvec4> samples;
+        std::vector<dvec2> positions;
+        for (size_t y = tile.begin.y; y < tile.end.y; y++)
+        {
+            for (size_t x = tile.begin.x; x < tile.end.x; x++)
+            {
+                if (!refine[y * size.x + x]) continue;
+
+                const size2_t P(x, y);
+                samples.clear();
+                positions.clear();
+                sampleStrata(P, 2, samples, positions, tileCounters, occluders, scratch);
+
+                //Split the strata further where the subsamples still disagree
+                if (maxSamplesPerPixel >= 16)
+                {
+                    dvec4 minColor(samples[0]), maxColor(samples[0]);
+                    for (const dvec4& color : samples)
+                    {
+                        minColor = glm::min(minColor, color);
+                        maxColor = glm::max(maxColor, color);
+                    }
+                    if (contrast(minColor, maxColor) > antiAliasingThreshold)
+                    {
+                        sampleStrata(P, 4, samples, positions, tileCounters, occluders, scratch);
+                    }
+                }
+
+                dvec4 pixelcolor(0.0);
+                for (const dvec4& color : samples) pixelcolor += color;
+                pixelcolor /= double(samples.size());
+                tileCounters.numRefinedPixels++;
+
+                const StageTimer WriteTimer(useStageTimings);
+                lr->setFromDVec4(P, pixelcolor);
+                WriteTimer.addTo(tileCounters.imageWriteSeconds);
+            }
+        }
+    }, cancelled);
+    counters.addTiles(scheduler.getStatistics());
+
+    for (const RenderCounters& threadCounter : threadCounters) counters += threadCounter;
+    return bCompleted;
+}
+
+template <typename WriteBlock>
+void Scene::renderTilePackets(const TileScheduler::Tile& tile, const size_t pixelStep, const size_t firstRow,
+                              RenderCounters& counters, GBuffer* gBuffer, ReflectionQueue* reflections,
+                              LightScratch* scratch, WriteBlock&& writeBlock) const
+{
+    //The first hits of the whole tile are shaded together, grouped by material type
+    const size_t numLights = lights_.size();
+    const size_t numBlocks = (tile.end.x - tile.begin.x) * (tile.end.y - tile.begin.y);
+    std::vector<size2_t> pixels;
+    pixels.reserve(numBlocks);
+    //Index into hits for each pixel, or -1 for the background
+    std::vector<int> hitIndex;
+    hitIndex.reserve(numBlocks);
+    std::vector<RayIntersection> hits;
+    hits.reserve(numBlocks);
+    std::vector<uint8_t> lightVisible;
+    lightVisible.reserve(numBlocks * numLights);
+    //Weights of the lights per hit, if they are culled or sampled
+    const bool bSelectLights = isSelectingLights();
+    std::vector<double> lightWeight;
+    if (bSelectLights) lightWeight.reserve(numBlocks * numLights);
+
+    //Visibility of each light for each ray of a packet, found with one shadow ray packet per light
+    std::vector<uint8_t> packetVisible(RayPacket8::Size * numLights);
+    std::vector<double> packetWeight(bSelectLights ? RayPacket8::Size * numLights : 0);
+
+    //Packets of 4x2 pixels
+    for (size_t j = tile.begin.y; j < tile.end.y; j += 2)
+    {
+        for (size_t i = tile.begin.x; i < tile.end.x; i += 4)
+        {
+            RayPacket8 packet;
+            size2_t packetPixels[RayPacket8::Size];
+            int activeMask = 0;
+            for (int lane = 0; lane < RayPacket8::Size; lane++)
+            {
+                const size2_t block(i + lane % 4, j + lane / 4);
+                if (block.x >= tile.end.x || block.y >= tile.end.y) continue;
+                packetPixels[lane] = size2_t(block.x * pixelStep, firstRow + block.y * pixelStep);
+                packet.setRay(lane, getRay(packetPixels[lane]));
+                activeMask |= (1 << lane);
+            }
+
+            StageTimer Timer(useStageTimings);
+            RayIntersection intersections[RayPacket8::Size];
+            const int hitMask = closestIntersection8(packet, activeMask, intersections);
+            counters.numPrimaryRays += std::bitset<RayPacket8::Size>(activeMask).count();
+            counters.numIntersections += std::bitset<RayPacket8::Size>(hitMask).count();
+            Timer.addTo(counters.primarySeconds);
+
+            if (bSelectLights)
+            {
+                for (int lane = 0; lane < RayPacket8::Size; lane++)
+                {
+                    if (hitMask & (1 << lane)) selectLights(intersections[lane], &packetWeight[lane * numLights], counters);
+                }
+            }
+
+            for (size_t l(0); l < numLights && hitMask; l++)
+            {
+                Timer.reset();
+                //Only the rays whose hit selected this light
+                int shadowMask = hitMask;
+                for (int lane = 0; lane < RayPacket8::Size && bSelectLights; lane++)
+                {
+                    if (packetWeight[lane * numLights + l] == 0) shadowMask &= ~(1 << lane);
+                }
+                RayPacket8 shadowPacket;
+                double shadowLambda[RayPacket8::Size] = {0};
+                for (int lane = 0; lane < RayPacket8::Size; lane++)
+                {
+                    if (!(shadowMask & (1 << lane))) continue;
+                    shadowPacket.setRay(lane, getShadowRay(intersections[lane], *lights_[l], shadowLambda[lane]));
+                }
+                const int occluded = shadowMask ? anyIntersection8(shadowPacket, shadowMask, shadowLambda) : 0;
+                for (int lane = 0; lane < RayPacket8::Size; lane++)
+                {
+                    packetVisible[lane * numLights + l] = ((shadowMask & ~occluded) & (1 << lane)) ? 1 : 0;
+                }
+                counters.numShadowRays += std::bitset<RayPacket8::Size>(shadowMask).count();
+                Timer.addTo(counters.shadowSeconds);
+            }
+
+            for (int lane = 0; lane < RayPacket8::Size; lane++)
+            {
+                if (!(activeMask & (1 << lane))) continue;
+                pixels.push_back(packetPixels[lane]);
+                if (hitMask & (1 << lane))
+                {
+                    hitIndex.push_back(int(hits.size()));
+                    hits.push_back(intersections[lane]);
+                    lightVisible.insert(lightVisible.end(), packetVisible.begin() + lane * numLights,
+                                        packetVisible.begin() + (lane + 1) * numLights);
+                    if (bSelectLights)
+                    {
+                        lightWeight.insert(lightWeight.end(), packetWeight.begin() + lane * numLights,
+                                           packetWeight.begin() + (lane + 1) * numLights);
+                    }
+                }
+                else
+                {
+                    hitIndex.push_back(-1);
+                }
+            }
         }
     }
 
-    LogInfo("Scene raytraced with " << NumIntersections << " intersections and "
-                                << NumShading << " shading computations."
-                                << " Needed " << Timer.ElapsedTime() << " seconds with "
-                                << NumThreads << " parallel threads.");
+    //Ambient and direct light, one loop per material type; materials missing from the table one by one
+    std::vector<uint32_t> materialIds(hits.size());
+    std::vector<MaterialTable::Hit> batch;
+    std::vector<size_t> batchIndex;
+    batch.reserve(hits.size());
+    batchIndex.reserve(hits.size());
+    std::vector<dvec4> directColors(hits.size());
+    for (size_t h(0); h < hits.size(); h++)
+    {
+        materialIds[h] = getMaterialId(hits[h]);
+        const double* weight = bSelectLights ? lightWeight.data() + h * numLights : nullptr;
+        if (materialIds[h] == MaterialTable::NotFound)
+        {
+            directColors[h] = shadeDirect(hits[h], materialIds[h], lightVisible.data() + h * numLights, weight, counters);
+        }
+        else
+        {
+            batch.push_back({&hits[h], lightVisible.data() + h * numLights, materialIds[h], weight});
+            batchIndex.push_back(h);
+        }
+    }
+    std::vector<dvec4> batchColors(batch.size());
+    materialTable_.shade(batch, lights_, batchColors.data(), counters);
+    for (size_t b(0); b < batch.size(); b++) directColors[batchIndex[b]] = batchColors[b];
+
+    //Reflections per ray
+    for (size_t p(0); p < pixels.size(); p++)
+    {
+        dvec4 pixelcolor = backgroundColor;
+        const int h = hitIndex[p];
+        if (h >= 0)
+        {
+            //Only apply light intensity correction to non-background pixels
+            pixelcolor = shadeReflection(hits[h], materialIds[h], 0, directColors[h], counters, reflections, scratch);
+            pixelcolor *= lightIntensity;
+            if (gBuffer) gBuffer->set(pixels[p], hits[h], lightVisible.data() + h * numLights);
+        }
+        else if (gBuffer)
+        {
+            gBuffer->setBackground(pixels[p]);
+        }
+        pixelcolor[3] = 1.0;
+        if (deferBlock(reflections, pixels[p], pixelcolor)) continue;
+        writeBlock(pixels[p], pixelcolor, counters);
+    }
 }
 
 Ray Scene::getRay(size2_t point) const
@@ -283,23 +1243,46 @@ Ray Scene::getRay(size2_t point) const
     return Ray(camPos_, PixelCenter - camPos_);
 }
 
+Ray Scene::getRay(const dvec2& point) const
+{
+    const dvec3 PointOnPlane = bottomLeftPixelCenter_ + point.x * right_ + point.y * up_;
+    return Ray(camPos_, PointOnPlane - camPos_);
+}
+
 
 
 
 void Scene::addLight(std::shared_ptr<Light> light)
 {
     lights_.push_back(light);
+    lightTree_.clear();
 }
 
 void Scene::addRenderable(std::shared_ptr<Renderable> renderable)
 {
     renderables_.push_back(renderable);
+    bPrepared_ = false;
+}
+
+void Scene::clearLights()
+{
+    lights_.clear();
+    lightTree_.clear();
 }
 
 void Scene::clear()
 {
     renderables_.clear();
     lights_.clear();
+
+    //The top-level hierarchy refers to the renderables without owning them
+    topLevelTree_ = BVTree();
+    materialTable_.clear();
+    lightTree_.clear();
+    boundedRenderables_.clear();
+    unboundedRenderables_.clear();
+    groupedRenderables_.clear();
+    bPrepared_ = false;
 }
 
 }// namespace inviwo
@@ -15,11 +15,18 @@
 #include <labraytracer/ray.h>
 #include <labraytracer/light.h>
 #include <labraytracer/renderable.h>
+#include <labraytracer/bvtree.h>
+#include <labraytracer/lighttree.h>
+#include <labraytracer/materialtable.h>
+#include <labraytracer/tilescheduler.h>
+#include <labraytracer/renderstatistics.h>
 #include <inviwo/core/datastructures/image/layerram.h>
 
 namespace inviwo
 {
 
+class GBuffer;
+
 /** \class Scene
     \brief Scene with a number of renderable objects (e.g. Spheres, Triangles), lights
     and properties of the camera.
@@ -32,6 +39,54 @@ class IVW_MODULE_LABRAYTRACER_API Scene
 //Friends
 //Types
 public:
+    /** Last occluder of the shadow rays towards each light, indexed by the light.
+        Neighboring hits are mostly blocked by the same primitive, which is tested first.
+        Every thread keeps its own cache during a pass; it refers to the renderables without owning them.
+    */
+    using OccluderCache = std::vector<HitRecord>;
+
+    /** Light visibility and weights of shade() for scenes with more lights than fit on its stack.
+        Every thread keeps its own during a pass. shade() needs them only until the direct light is shaded,
+        so the reflections it traces reuse them.
+    */
+    struct LightScratch
+    {
+        std::vector<uint8_t> visible;
+        std::vector<double> weights;
+    };
+
+    /** Reflection rays of a pass in wavefront mode, see useWavefrontReflections. Every thread collects
+        the rays it spawns in its own queue. The light found along a ray is added, times its weight,
+        to the pixel of the primary ray it descends from.
+    */
+    struct ReflectionQueue
+    {
+        struct Entry
+        {
+            dvec3 origin;
+            ///As given to the Ray, which normalizes it
+            dvec3 direction;
+            ///Factor of the light along the ray in the color of the pixel
+            dvec3 weight;
+            ///Index into pixels
+            uint32_t pixel;
+            ///Cell of the origin and octant of the direction; rays of the same bin are traced together
+            uint32_t bin;
+        };
+
+        ///Pixel whose primary ray reflects, with the light gathered so far
+        struct Pixel
+        {
+            size2_t position;
+            dvec3 color;
+        };
+
+        std::vector<Entry> rays;
+        std::vector<Pixel> pixels;
+        ///Reflection of the hit shaded last, until it is assigned to a pixel or a ray
+        Entry pending;
+        bool bPending = false;
+    };
 
 //Construction / Deconstruction
 public:
@@ -60,21 +115,139 @@ public:
     bool anyIntersection(const Ray& ray,
                          const double maxLambda = std::numeric_limits<double>::infinity()) const;
 
+    ///Same as above, but records the renderable and primitive that block the ray in occluder
+    bool anyIntersection(const Ray& ray, const double maxLambda, HitRecord& occluder) const;
+
+    ///Closest intersections of the rays of a packet in activeMask, traversing the scene once.
+    ///Returns the mask of rays with a hit; only their intersections are written.
+    int closestIntersection8(const RayPacket8& packet, const int activeMask,
+                             RayIntersection* intersections) const;
+
+    ///Checks the rays of a packet in activeMask for any intersection within maxLambda.
+    ///Returns the mask of rays with a hit.
+    int anyIntersection8(const RayPacket8& packet, const int activeMask, const double* maxLambda) const;
+
     ///Iterates over all pixels and shoots rays, recursively up to MaxRecursiveDepth levels.
-    void render(LayerRAM* lr, const size_t maxRecursiveDepth) const;
+    ///The pixels are rendered in tiles, distributed over the threads of the scheduler.
+    ///Logs the statistics and returns them in statistics, if given.
+    void render(LayerRAM* lr, const size_t maxRecursiveDepth, TileScheduler& scheduler,
+                RenderStatistics* statistics = nullptr) const;
+
+    /** Renders the image rows [firstRow, lastRow) with one ray per block of pixelStep x pixelStep
+        pixels; its color fills the whole block. A pixelStep of 1 renders at full resolution.
+        The counters of all threads are added to counters.
+        Stops early and returns false once cancelled is set.
+        At full resolution, the first hits are recorded in gBuffer, if given; see GBuffer::begin().
+    */
+    bool renderPass(LayerRAM* lr, const size_t maxRecursiveDepth, TileScheduler& scheduler,
+                    const size_t pixelStep, const size_t firstRow, const size_t lastRow,
+                    RenderCounters& counters, const std::atomic<bool>* cancelled = nullptr,
+                    GBuffer* gBuffer = nullptr) const;
+
+    /** Shades the image again from the first hits in gBuffer, without tracing primary rays.
+        Shadow rays are traced only if the lights have moved; reflections are traced as usual.
+        Returns false if the buffer does not fit the scene, or once cancelled is set.
+    */
+    bool reshade(LayerRAM* lr, const size_t maxRecursiveDepth, TileScheduler& scheduler, const GBuffer& gBuffer,
+                 RenderCounters& counters, const std::atomic<bool>* cancelled = nullptr) const;
+
+    /** Adaptive anti-aliasing of a full-resolution image. Pixels whose 3x3 neighborhood has a contrast
+        above antiAliasingThreshold get 2x2 jittered, stratified subsamples. If these still differ by more
+        than the threshold and maxSamplesPerPixel allows, the strata are split into 4x4.
+        The pixel gets the mean of its subsamples. Returns false once cancelled is set.
+    */
+    bool antiAliasingPass(LayerRAM* lr, const size_t maxRecursiveDepth, TileScheduler& scheduler,
+                          RenderCounters& counters, const std::atomic<bool>* cancelled = nullptr) const;
 
     //Traces a ray. Used for recursive raytracing.
-    dvec4 trace(const Ray& ray, const size_t depth, bool& bIntersectionFound) const;
+    //Counters, occluders and scratch are those of the calling thread; reflections do not use the occluder cache.
+    //With reflections, the reflection of the hit is left pending there instead of being traced.
+    dvec4 trace(const Ray& ray, const size_t depth, bool& bIntersectionFound, RenderCounters& counters,
+                OccluderCache* occluders = nullptr, ReflectionQueue* reflections = nullptr,
+                LightScratch* scratch = nullptr) const;
 
     //Computes shading color for a ray. Used for recursive raytracing.
-    dvec4 shade(const RayIntersection& intersection, const size_t depth) const;
+    //lightVisible holds the visibility of each light if it is known already, e.g. from shadow ray packets,
+    //and lightWeight the weights from selectLights(), if any.
+    //Otherwise, the lights are selected and shadow rays are traced, using the occluders if given.
+    //With reflections, the reflection is left pending there, and only the direct part of the color is returned.
+    //Without scratch, more than 16 lights are selected in arrays allocated per call.
+    dvec4 shade(const RayIntersection& intersection, const size_t depth, RenderCounters& counters,
+                const uint8_t* lightVisible = nullptr, const double* lightWeight = nullptr,
+                OccluderCache* occluders = nullptr, ReflectionQueue* reflections = nullptr,
+                LightScratch* scratch = nullptr) const;
+
+    ///Ray from the light towards the intersection point; the point is visible if nothing is hit within maxLambda.
+    Ray getShadowRay(const RayIntersection& intersection, const Light& light, double& maxLambda) const;
+
+    ///Traces a shadow ray to every light and sets lightVisible[l] to whether light l is visible.
+    ///Lights with a lightWeight of 0 get no shadow ray and count as not visible.
+    ///With occluders, the last occluder of each light is tested before the scene is traversed.
+    void traceShadowRays(const RayIntersection& intersection, uint8_t* lightVisible, RenderCounters& counters,
+                         const double* lightWeight = nullptr, OccluderCache* occluders = nullptr) const;
 
+    /** Chooses the lights that shade a hit, according to lightCullingThreshold and numLightSamples.
+        Sets lightWeight[l] to the factor for the direct light of light l; 0 means that it gets no shadow ray.
+        Returns false if all lights are used as they are; lightWeight is not written then.
+    */
+    bool selectLights(const RayIntersection& intersection, double* lightWeight, RenderCounters& counters) const;
+
+    ///Whether selectLights() may skip or weight lights
+    bool isSelectingLights() const;
+
+    ///One empty occluder cache per thread of the scheduler, or none if useOccluderCache is off
+    std::vector<OccluderCache> makeOccluderCaches(const TileScheduler& scheduler) const;
+
+    ///Initializes the renderables and builds the top-level hierarchy over their bounds.
+    ///Needs to be called after adding renderables or lights and before rendering.
+    ///Returns immediately if neither the renderables nor the lights have changed since the last call.
     void prepareScene();
+    bool isPrepared() const { return bPrepared_; }
+    const ivec2& getImageSize() const { return imageSize_; }
+    const std::vector<std::shared_ptr<Light>>& getLights() const { return lights_; }
+    const std::vector<std::shared_ptr<Renderable>>& getRenderables() const { return renderables_; }
     Ray getRay(size2_t point) const;
+    ///Ray through a point of the image plane given in pixels; integer coordinates are the pixel centers
+    Ray getRay(const dvec2& point) const;
 
     void addLight(std::shared_ptr<Light> light);
     void addRenderable(std::shared_ptr<Renderable> renderable);
     void clear();
+    ///Removes the lights only; the renderables and their hierarchies are kept
+    void clearLights();
+
+private:
+    ///Ambient and direct light at a hit; lightVisible as in shade(), but must be given
+    dvec4 shadeDirect(const RayIntersection& intersection, const uint32_t materialId, const uint8_t* lightVisible,
+                      const double* lightWeight, RenderCounters& counters) const;
+
+    ///Mixes the reflection into the directColor of a hit, if the material reflects and depth allows.
+    ///With reflections, the reflection ray is left pending there instead.
+    dvec4 shadeReflection(const RayIntersection& intersection, const uint32_t materialId, const size_t depth,
+                          const dvec4& directColor, RenderCounters& counters,
+                          ReflectionQueue* reflections = nullptr, LightScratch* scratch = nullptr) const;
+
+    ///Moves a pending reflection of the primary ray of block P to the queue, with the color of the block
+    ///so far. Returns false if there is none; the block can be written then.
+    bool deferBlock(ReflectionQueue* reflections, const size2_t& P, const dvec4& pixelcolor) const;
+
+    /** Traces the reflections in the queues of the threads breadth-first, one wave per depth.
+        The rays of a wave are binned by the cell of their origin and the octant of their direction.
+        Writes the deferred blocks at the end. Returns false once cancelled is set.
+    */
+    template <typename WriteBlock>
+    bool traceReflectionWaves(std::vector<ReflectionQueue>& queues, TileScheduler& scheduler,
+                              std::vector<RenderCounters>& threadCounters, RenderCounters& counters,
+                              const std::atomic<bool>* cancelled, WriteBlock&& writeBlock) const;
+
+    ///Id of the material of the hit in materialTable_, or MaterialTable::NotFound
+    uint32_t getMaterialId(const RayIntersection& intersection) const;
+
+    ///Renders a tile of renderPass() with packets of primary and shadow rays
+    template <typename WriteBlock>
+    void renderTilePackets(const TileScheduler::Tile& tile, const size_t pixelStep, const size_t firstRow,
+                           RenderCounters& counters, GBuffer* gBuffer, ReflectionQueue* reflections,
+                           LightScratch* scratch, WriteBlock&& writeBlock) const;
 
 //Attributes
 public:
@@ -89,13 +262,39 @@ public:
     ///Whether to use adaptive anti-aliasing during rendering
     bool useAdaptiveAntiAliasing;
 
-private:
-    ///Counts number of intersections
-    mutable long NumIntersections;
+    ///Largest number of subsamples for a pixel of the adaptive anti-aliasing; 4 or 16
+    size_t maxSamplesPerPixel;
+
+    ///Color difference (per channel, clamped to [0, 1]) above which the anti-aliasing refines a pixel
+    double antiAliasingThreshold;
 
-    ///Counts number of shading computations
-    mutable long NumShading;
+    ///Whether to trace primary and shadow rays in packets of eight; reflections are always traced one by one
+    bool usePacketTracing;
 
+    ///Lights whose direct light at a hit is certainly below this value get no shadow ray; 0 disables culling.
+    ///Applies to materials whose light falls off with the squared distance.
+    double lightCullingThreshold;
+
+    ///Number of lights sampled by importance for every hit; 0 uses all lights
+    size_t numLightSamples;
+
+    ///Whether shadow rays of primary hits first test the last occluder towards their light.
+    ///Applies to single rays; shadow ray packets already share their traversal.
+    bool useOccluderCache;
+
+    ///Whether renderPass() traces the reflections breadth-first, in sorted waves over the whole pass,
+    ///instead of recursively per pixel
+    bool useWavefrontReflections;
+
+    ///Whether prepareScene() puts plain spheres, planes and triangles into groups that are
+    ///intersected with SIMD, see PrimitiveGroup
+    bool usePrimitiveGroups;
+
+    ///Whether the rays measure the time spent in the stages of RenderCounters.
+    ///Off by default, as it reads the clock twice per ray.
+    bool useStageTimings;
+
+private:
     ///Maximum depth for recursive raytracing
     mutable size_t maxDepth;
 
@@ -111,6 +310,22 @@ private:
     ivec2 imageSize_;
     std::vector<std::shared_ptr<Light>> lights_;
     std::vector<std::shared_ptr<Renderable>> renderables_;
+    ///The renderables as intersected: with their simple primitives in groups, if usePrimitiveGroups is set
+    std::vector<std::shared_ptr<Renderable>> groupedRenderables_;
+
+    ///Top-level hierarchy over the bounds of boundedRenderables_; built in prepareScene()
+    BVTree topLevelTree_;
+    std::vector<const Renderable*> boundedRenderables_;
+    ///Objects without bounds, e.g. planes; tested with every ray
+    std::vector<const Renderable*> unboundedRenderables_;
+    ///Hierarchy over the lights for culling and sampling; rebuilt in prepareScene() after the lights changed
+    LightTree lightTree_;
+    ///Parameters of the materials of the renderables; built in prepareScene()
+    MaterialTable materialTable_;
+    ///Whether the renderables are initialized and the top-level hierarchy is up to date
+    bool bPrepared_;
+    ///Whether groupedRenderables_ has groups
+    bool bGroupedPrimitives_;
 };
 
 }// namespace inviwo
@@ -25,27 +25,16 @@ Sphere::Sphere(const dvec3& center, const double& radius)
 bool Sphere::closestIntersection(const Ray& ray, double maxLambda,
                                  RayIntersection& intersection) const
 {
-    /*
-    TODO: implement this method
-    Your code should compute the intersection between a ray and a sphere.
-
-    Return false, if there is no intersection.
-
-    If you detect an intersection,
-    you return true and fill-in the information in the RayIntersection object:
-    if(rayIntersectsSphere)
+    double lambda;
+    if (!Util::intersectRaySphere(ray.getOrigin(), ray.getDirection(), center_, radius_ * radius_,
+                                  maxLambda, lambda))
     {
-        intersection = RayIntersection(ray, shared_from_this(), lambda, normal, dvec3(0, 0, 0));
-        return true;
+        return false;
     }
-    
-    Hints :
-      Ray origin p_r : ray.getOrigin()
-      Ray direction t_r : ray.getDirection()
-      Compute the intersection point using ray.pointOnRay(lambda)
-    */
 
-    return false;
+    const dvec3 normal = (ray.pointOnRay(lambda) - center_) / radius_;
+    intersection = RayIntersection(ray, this, lambda, normal, dvec3(0, 0, 0));
+    return true;
 }
 
 
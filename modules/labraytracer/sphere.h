@@ -40,6 +40,12 @@ public:
 
     bool anyIntersection(const Ray& ray, double maxLambda) const override;
 
+    bool getBoundingBox(BoundingBox& box) const override
+    {
+        box = BoundingBox(center_ - dvec3(radius_), center_ + dvec3(radius_));
+        return true;
+    }
+
     void drawGeometry(std::shared_ptr<BasicMesh> mesh,
                       std::vector<BasicMesh::Vertex>& vertices) const override
     {
@@ -0,0 +1,152 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 09:33:16
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include "benchmarkmeshes.h"
+#include <labraytracer/util.h>
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+namespace inviwo
+{
+
+namespace
+{
+///Mesh with vertex normals averaged from the face normals
+std::shared_ptr<BVHIndexedTriangleMesh> makeMesh(const std::vector<dvec3>& positions, const std::vector<ivec3>& faces)
+{
+    std::vector<dvec3> normals(positions.size(), dvec3(0));
+    for (const auto& f : faces)
+    {
+        const dvec3 fn = cross(positions[f.y] - positions[f.x], positions[f.z] - positions[f.x]);
+        for (int j(0); j < 3; j++) normals[f[j]] += fn;
+    }
+
+    auto mesh = std::make_shared<BVHIndexedTriangleMesh>();
+    mesh->reserveVertices(positions.size());
+    for (size_t i(0); i < positions.size(); i++) mesh->addVertex(positions[i], Util::normalize(normals[i]));
+    mesh->reserveTriangleIndices(3 * faces.size());
+    for (const auto& f : faces) mesh->addTriangle(f.x, f.y, f.z);
+    return mesh;
+}
+}
+
+std::shared_ptr<BVHIndexedTriangleMesh> loadOFF(const std::string& fileName)
+{
+    std::ifstream in(fileName);
+    std::string header;
+    size_t numVertices(0), numFaces(0), numEdges(0);
+    in >> header >> numVertices >> numFaces >> numEdges;
+
+    std::vector<dvec3> positions(numVertices);
+    for (auto& p : positions) in >> p.x >> p.y >> p.z;
+
+    std::vector<ivec3> faces;
+    faces.reserve(numFaces);
+    for (size_t i(0); i < numFaces; i++)
+    {
+        int n;
+        ivec3 f;
+        in >> n >> f.x >> f.y >> f.z;
+        if (n != 3) continue; //triangles only
+        faces.push_back(f);
+    }
+    return makeMesh(positions, faces);
+}
+
+std::shared_ptr<BVHIndexedTriangleMesh> loadOBJ(const std::string& fileName)
+{
+    std::ifstream in(fileName);
+    std::vector<dvec3> positions;
+    std::vector<ivec3> faces;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream tokens(line);
+        std::string type;
+        tokens >> type;
+        if (type == "v")
+        {
+            dvec3 p;
+            tokens >> p.x >> p.y >> p.z;
+            positions.push_back(p);
+        }
+        else if (type == "f")
+        {
+            //Corners look like v, v/vt, v//vn or v/vt/vn; negative indices count from the end
+            std::vector<int> corners;
+            std::string corner;
+            while (tokens >> corner)
+            {
+                const int index = std::stoi(corner.substr(0, corner.find('/')));
+                corners.push_back(index < 0 ? int(positions.size()) + index : index - 1);
+            }
+            for (size_t j(2); j < corners.size(); j++) faces.emplace_back(corners[0], corners[j - 1], corners[j]);
+        }
+    }
+    return makeMesh(positions, faces);
+}
+
+std::shared_ptr<BVHIndexedTriangleMesh> makeSphereMesh(const size_t numTriangles)
+{
+    //Two triangles per cell of a rings x (2 * rings) grid in spherical coordinates
+    const int rings = std::max(2, int(std::sqrt(double(numTriangles) / 4.0)));
+    const int segments = 2 * rings;
+    const double pi = 3.14159265358979323846;
+
+    std::vector<dvec3> positions;
+    positions.reserve(size_t(rings + 1) * (segments + 1));
+    for (int i(0); i <= rings; i++)
+    {
+        const double theta = pi * i / rings;
+        for (int j(0); j <= segments; j++)
+        {
+            const double phi = 2 * pi * j / segments;
+            positions.emplace_back(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta));
+        }
+    }
+
+    std::vector<ivec3> faces;
+    faces.reserve(size_t(2) * rings * segments);
+    for (int i(0); i < rings; i++)
+    {
+        for (int j(0); j < segments; j++)
+        {
+            const int a = i * (segments + 1) + j;
+            const int b = a + segments + 1;
+            faces.emplace_back(a, b, a + 1);
+            faces.emplace_back(a + 1, b, b + 1);
+        }
+    }
+    return makeMesh(positions, faces);
+}
+
+std::vector<Ray> makeFrontRays(const BoundingBox& box, const int resolution)
+{
+    const dvec3 center = 0.5 * (box.min() + box.max());
+    const dvec3 extent = box.max() - box.min();
+    const dvec3 eye = center + dvec3(0, 0, 2 * extent.z + extent.x);
+
+    std::vector<Ray> rays;
+    rays.reserve(size_t(resolution) * resolution);
+    for (int j(0); j < resolution; j++)
+    {
+        for (int i(0); i < resolution; i++)
+        {
+            const dvec3 target = center + dvec3(((i + 0.5) / resolution - 0.5) * extent.x,
+                                                ((j + 0.5) / resolution - 0.5) * extent.y, 0);
+            rays.emplace_back(eye, target - eye);
+        }
+    }
+    return rays;
+}
+
+}// namespace inviwo
@@ -0,0 +1,37 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 09:33:16
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <inviwo/core/common/inviwo.h>
+#include <labraytracer/bvhindexedtrianglemesh.h>
+#include <labraytracer/ray.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace inviwo
+{
+
+///Reads an OFF file into a mesh. Vertex normals are averaged from the face normals.
+std::shared_ptr<BVHIndexedTriangleMesh> loadOFF(const std::string& fileName);
+
+///Reads the vertices and faces of an OBJ file into a mesh; polygons are split into fans.
+///Vertex normals are averaged from the face normals.
+std::shared_ptr<BVHIndexedTriangleMesh> loadOBJ(const std::string& fileName);
+
+///Unit sphere tessellated into about numTriangles triangles
+std::shared_ptr<BVHIndexedTriangleMesh> makeSphereMesh(const size_t numTriangles);
+
+///A resolution x resolution grid of rays looking at the box from the front
+std::vector<Ray> makeFrontRays(const BoundingBox& box, const int resolution);
+
+}// namespace inviwo
@@ -0,0 +1,298 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 09:33:16
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include <inviwo/core/common/inviwo.h>
+#include <inviwo/core/datastructures/image/image.h>
+#include <inviwo/core/datastructures/image/layerram.h>
+#include <labraytracer/bvhindexedtrianglemesh.h>
+#include <labraytracer/bvtree.h>
+#include <labraytracer/raytracer.h>
+#include <labraytracer/scene.h>
+#include <labraytracer/tilescheduler.h>
+#include <labraytracer/util.h>
+
+#include "benchmarkmeshes.h"
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <string>
+
+#include <warn/push>
+#include <warn/ignore/unused-function>
+
+using namespace inviwo;
+
+namespace
+{
+
+///Meshes of the benchmarks, selected by the benchmark argument
+enum MeshId
+{
+    Bunny,
+    Die,
+    ///Tessellated sphere with a million triangles
+    Sphere,
+    NumMeshes
+};
+
+std::shared_ptr<BVHIndexedTriangleMesh> loadMesh(const int id)
+{
+    switch (id)
+    {
+        case Bunny:
+            return loadOFF(std::string(BM_RAYTRACER_MESH_DIR) + "/bunny.off");
+        case Die:
+            return loadOBJ(std::string(BM_RAYTRACER_MESH_DIR) + "/die.obj");
+        default:
+            return makeSphereMesh(size_t(1) << 20);
+    }
+}
+
+///Corners of triangle i of the mesh, as callback for BVTree::build()
+std::function<void(size_t, dvec3&, dvec3&, dvec3&)> triangleCorners(const IndexedTriangleMesh& mesh)
+{
+    return [&mesh](size_t i, dvec3& v0, dvec3& v1, dvec3& v2)
+    {
+        const std::vector<int>& indices = mesh.triangleIndices();
+        v0 = mesh.getVertexPosition(indices[3 * i + 0]);
+        v1 = mesh.getVertexPosition(indices[3 * i + 1]);
+        v2 = mesh.getVertexPosition(indices[3 * i + 2]);
+    };
+}
+
+///Average work per ray in the binary hierarchy
+struct TraversalCounts
+{
+    double nodesPerRay = 0;
+    double trianglesPerRay = 0;
+};
+
+/** A mesh with its hierarchy, a 512x512 grid of primary rays looking at it, and a shadow ray
+    from the light to each of their hits. The binary hierarchy over the same triangles is used
+    to count visited nodes and tested triangles; the timed traversals use the mesh itself.
+*/
+struct MeshData
+{
+    explicit MeshData(const int id)
+    {
+        mesh = loadMesh(id);
+        mesh->initialize();
+        tree.build(mesh->triangleIndices().size() / 3, triangleCorners(*mesh));
+
+        BoundingBox box;
+        mesh->getBoundingBox(box);
+        primaryRays = makeFrontRays(box, 512);
+
+        const dvec3 extent = box.max() - box.min();
+        const dvec3 light = 0.5 * (box.min() + box.max()) + dvec3(extent.x, 2 * extent.y, extent.z);
+        RayIntersection intersection;
+        for (const auto& ray : primaryRays)
+        {
+            if (!mesh->closestIntersection(ray, std::numeric_limits<double>::infinity(), intersection)) continue;
+
+            //As in Scene::getShadowRay()
+            const dvec3 target = intersection.getPosition() + Util::epsilon * intersection.getNormal();
+            shadowRays.emplace_back(light, target - light);
+            shadowLambdas.push_back(length(target - light));
+        }
+
+        primaryCounts = countTraversal(primaryRays, nullptr, false);
+        shadowCounts = countTraversal(shadowRays, shadowLambdas.data(), true);
+    }
+
+    ///Traverses the binary hierarchy for the rays, up to the closest hit or up to any hit
+    TraversalCounts countTraversal(const std::vector<Ray>& rays, const double* maxLambdas, const bool bAnyHit) const
+    {
+        const std::vector<int>& indices = mesh->triangleIndices();
+        size_t numNodes(0), numTriangles(0);
+        for (size_t r(0); r < rays.size(); r++)
+        {
+            const Ray& ray = rays[r];
+            double maxLambda = maxLambdas ? maxLambdas[r] : std::numeric_limits<double>::infinity();
+            tree.traverse(ray, maxLambda, [&](int triangle, double& maxLambdaNow)
+            {
+                numTriangles++;
+                double lambda, u, v;
+                if (!Util::intersectRayTriangle(ray.getOrigin(), ray.getDirection(),
+                                                mesh->getVertexPosition(indices[3 * triangle + 0]),
+                                                mesh->getVertexPosition(indices[3 * triangle + 1]),
+                                                mesh->getVertexPosition(indices[3 * triangle + 2]),
+                                                maxLambdaNow, lambda, u, v))
+                {
+                    return false;
+                }
+                maxLambdaNow = lambda;
+                return bAnyHit;
+            }, [&](int) { numNodes++; });
+        }
+
+        TraversalCounts counts;
+        if (!rays.empty())
+        {
+            counts.nodesPerRay = double(numNodes) / rays.size();
+            counts.trianglesPerRay = double(numTriangles) / rays.size();
+        }
+        return counts;
+    }
+
+    std::shared_ptr<BVHIndexedTriangleMesh> mesh;
+    BVTree tree;
+    std::vector<Ray> primaryRays;
+    std::vector<Ray> shadowRays;
+    std::vector<double> shadowLambdas;
+    TraversalCounts primaryCounts;
+    TraversalCounts shadowCounts;
+};
+
+const MeshData& meshData(const int id)
+{
+    static std::unique_ptr<MeshData> data[NumMeshes];
+    if (!data[id]) data[id] = std::make_unique<MeshData>(id);
+    return *data[id];
+}
+
+void setRayCounters(benchmark::State& state, const size_t numRays, const TraversalCounts& counts)
+{
+    state.counters["Mrays/s"] = benchmark::Counter(numRays / 1e6, benchmark::Counter::kIsIterationInvariantRate);
+    state.counters["NodesPerRay"] = counts.nodesPerRay;
+    state.counters["TrianglesPerRay"] = counts.trianglesPerRay;
+}
+
+///The processor provides the scenes; one instance for all benchmarks
+Raytracer& raytracer()
+{
+    static Raytracer processor;
+    return processor;
+}
+
+}
+
+//Building each scene of the processor, including its hierarchies; the argument is the SceneCreationMethod
+static void SceneBuild(benchmark::State& state)
+{
+    const auto method = Raytracer::SceneCreationMethod(state.range(0));
+    size_t numRenderables(0);
+    for (auto _ : state)
+    {
+        Scene scene = raytracer().buildScene(method, ivec2(512, 512));
+        scene.prepareScene();
+        numRenderables = scene.getRenderables().size();
+    }
+    state.counters["Renderables"] = double(numRenderables);
+}
+
+//Full renders; the arguments are the SceneCreationMethod, the image width and height, the recursion depth,
+//and whether reflections are traced in waves
+static void SceneRender(benchmark::State& state)
+{
+    const auto method = Raytracer::SceneCreationMethod(state.range(0));
+    const int resolution = int(state.range(1));
+    const size_t depth = size_t(state.range(2));
+    Scene scene = raytracer().buildScene(method, ivec2(resolution, resolution));
+    scene.useWavefrontReflections = state.range(3) != 0;
+    scene.prepareScene();
+
+    auto image = std::make_shared<Image>(size2_t(resolution, resolution), DataVec4Float32::get());
+    auto lr = image->getColorLayer()->getEditableRepresentation<LayerRAM>();
+    TileScheduler scheduler;
+    RenderCounters counters;
+    for (auto _ : state)
+    {
+        scene.renderPass(lr, depth, scheduler, 1, 0, resolution, counters);
+    }
+    const double numRays = double(counters.numPrimaryRays + counters.numShadowRays + counters.numReflectionRays);
+    state.counters["Mrays/s"] = benchmark::Counter(numRays / 1e6, benchmark::Counter::kIsRate);
+    state.counters["RaysPerPixel"] = numRays / (double(state.iterations()) * resolution * resolution);
+    state.counters["PeakMiB"] = double(counters.wavefrontPeakBytes) / (1 << 20);
+}
+
+static void SceneRenderArguments(benchmark::internal::Benchmark* b)
+{
+    const Raytracer::SceneCreationMethod scenes[] = {Raytracer::SceneCreationMethod::Illumination,
+                                                     Raytracer::SceneCreationMethod::PhongTest,
+                                                     Raytracer::SceneCreationMethod::PrettySpheres};
+    for (const auto method : scenes)
+    {
+        for (const int resolution : {128, 512})
+        {
+            b->Args({int(method), resolution, 0, 0});
+            for (const int wavefront : {0, 1}) b->Args({int(method), resolution, 3, wavefront});
+        }
+    }
+}
+
+//Reading the shipped meshes; the argument is the MeshId
+static void MeshLoad(benchmark::State& state)
+{
+    size_t numTriangles(0);
+    for (auto _ : state)
+    {
+        auto mesh = loadMesh(int(state.range(0)));
+        numTriangles = mesh->triangleIndices().size() / 3;
+    }
+    state.counters["Triangles"] = double(numTriangles);
+}
+
+//Building the binary hierarchy alone; the argument is the MeshId
+static void MeshBVHBuild(benchmark::State& state)
+{
+    const auto& data = meshData(int(state.range(0)));
+    const size_t numTriangles = data.mesh->triangleIndices().size() / 3;
+    for (auto _ : state)
+    {
+        BVTree tree;
+        tree.build(numTriangles, triangleCorners(*data.mesh));
+        benchmark::DoNotOptimize(tree.getNumNodes());
+    }
+    state.counters["Mtriangles/s"] = benchmark::Counter(numTriangles / 1e6, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+//Closest hits of the primary rays; the argument is the MeshId
+static void MeshPrimaryRays(benchmark::State& state)
+{
+    const auto& data = meshData(int(state.range(0)));
+    for (auto _ : state)
+    {
+        size_t numHits(0);
+        HitRecord hit;
+        for (const auto& ray : data.primaryRays)
+        {
+            if (data.mesh->closestHit(ray, std::numeric_limits<double>::infinity(), hit)) numHits++;
+        }
+        benchmark::DoNotOptimize(numHits);
+    }
+    setRayCounters(state, data.primaryRays.size(), data.primaryCounts);
+}
+
+//Any hits of the shadow rays towards the primary hits; the argument is the MeshId
+static void MeshShadowRays(benchmark::State& state)
+{
+    const auto& data = meshData(int(state.range(0)));
+    for (auto _ : state)
+    {
+        size_t numBlocked(0);
+        for (size_t i(0); i < data.shadowRays.size(); i++)
+        {
+            if (data.mesh->anyIntersection(data.shadowRays[i], data.shadowLambdas[i])) numBlocked++;
+        }
+        benchmark::DoNotOptimize(numBlocked);
+    }
+    setRayCounters(state, data.shadowRays.size(), data.shadowCounts);
+}
+
+BENCHMARK(SceneBuild)->DenseRange(0, int(Raytracer::SceneCreationMethod::InputMesh))->Unit(benchmark::kMillisecond);
+BENCHMARK(SceneRender)->Apply(SceneRenderArguments)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(MeshLoad)->DenseRange(Bunny, Die)->Unit(benchmark::kMillisecond);
+BENCHMARK(MeshBVHBuild)->DenseRange(Bunny, Sphere)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(MeshPrimaryRays)->DenseRange(Bunny, Sphere)->Unit(benchmark::kMillisecond);
+BENCHMARK(MeshShadowRays)->DenseRange(Bunny, Sphere)->Unit(benchmark::kMillisecond);
+
+#include <warn/pop>
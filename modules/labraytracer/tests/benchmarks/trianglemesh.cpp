@@ -0,0 +1,403 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 07:29:49
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#ifdef _MSC_VER
+#pragma comment(linker, "/SUBSYSTEM:CONSOLE")
+#endif
+
+#include <inviwo/core/common/coremodulesharedlibrary.h>
+#include <inviwo/core/common/inviwo.h>
+#include <inviwo/core/common/inviwoapplication.h>
+#include <inviwo/core/util/logcentral.h>
+#include <labraytracer/bvhindexedtrianglemesh.h>
+#include <labraytracer/bvtree.h>
+#include <labraytracer/phongmaterial.h>
+#include <labraytracer/scene.h>
+#include <labraytracer/triangle.h>
+#include <labraytracer/util.h>
+
+#include "benchmarkmeshes.h"
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <string>
+
+#include <warn/push>
+#include <warn/ignore/unused-function>
+
+using namespace inviwo;
+
+namespace
+{
+
+struct BunnyData
+{
+    BunnyData()
+    {
+        mesh = loadOFF(std::string(BM_RAYTRACER_MESH_DIR) + "/bunny.off");
+        mesh->initialize();
+        positions.resize(mesh->getNumVertices());
+        for (size_t i(0); i < positions.size(); i++) positions[i] = mesh->getVertexPosition(i);
+        tree.build(positions, *((const std::vector<ivec3>*)(&mesh->triangleIndices())));
+
+        //The same mesh with each node width
+        const BVHIndexedTriangleMesh::NodeWidth widths[] = {BVHIndexedTriangleMesh::NodeWidth::Binary,
+                                                            BVHIndexedTriangleMesh::NodeWidth::Four,
+                                                            BVHIndexedTriangleMesh::NodeWidth::Eight};
+        for (int i(0); i < 3; i++)
+        {
+            meshByWidth[i] = std::make_shared<BVHIndexedTriangleMesh>(*mesh);
+            meshByWidth[i]->setNodeWidth(widths[i]);
+            meshByWidth[i]->initialize();
+        }
+
+        //The same mesh with each vertex storage
+        const IndexedTriangleMesh::VertexStorage storages[] = {IndexedTriangleMesh::VertexStorage::Double,
+                                                               IndexedTriangleMesh::VertexStorage::Float,
+                                                               IndexedTriangleMesh::VertexStorage::Quantized};
+        for (int i(0); i < 3; i++)
+        {
+            meshByStorage[i] = std::make_shared<BVHIndexedTriangleMesh>(*mesh);
+            meshByStorage[i]->setVertexStorage(storages[i]);
+            meshByStorage[i]->initialize();
+        }
+
+        //A 256x256 grid of rays looking at the bunny from the front
+        dvec3 bmin(std::numeric_limits<double>::max()), bmax(-std::numeric_limits<double>::max());
+        for (const auto& p : positions)
+        {
+            bmin = glm::min(bmin, p);
+            bmax = glm::max(bmax, p);
+        }
+        const dvec3 center = 0.5 * (bmin + bmax);
+        const dvec3 extent = bmax - bmin;
+        const dvec3 eye = center + dvec3(0, 0, 2 * extent.z + extent.x);
+        const int Res = 256;
+        for (int j(0); j < Res; j++)
+        {
+            for (int i(0); i < Res; i++)
+            {
+                const dvec3 target = center + dvec3(((i + 0.5) / Res - 0.5) * extent.x,
+                                                    ((j + 0.5) / Res - 0.5) * extent.y, 0);
+                rays.emplace_back(eye, target - eye);
+            }
+        }
+    }
+
+    std::shared_ptr<BVHIndexedTriangleMesh> mesh;
+    ///Binary, 4-wide and 8-wide hierarchy
+    std::shared_ptr<BVHIndexedTriangleMesh> meshByWidth[3];
+    ///Double, float and quantized vertex storage
+    std::shared_ptr<BVHIndexedTriangleMesh> meshByStorage[3];
+    std::vector<dvec3> positions;
+    BVTree tree;
+    std::vector<Ray> rays;
+};
+
+const BunnyData& bunny()
+{
+    static BunnyData data;
+    return data;
+}
+
+///Scene with one bunny, shared by all threads of a benchmark
+const Scene& bunnyScene()
+{
+    static Scene scene = []()
+    {
+        Scene s;
+        auto mesh = std::make_shared<BVHIndexedTriangleMesh>(*bunny().mesh);
+        mesh->setMaterial(std::make_shared<PhongMaterial>());
+        s.addRenderable(mesh);
+        s.prepareScene();
+        return s;
+    }();
+    return scene;
+}
+
+}
+
+//The way BVHIndexedTriangleMesh used to intersect: a heap-allocated Triangle per BVH candidate
+static void BunnyClosestAllocatePerCandidate(benchmark::State& state)
+{
+    const auto& data = bunny();
+    const auto& P = data.positions;
+    const auto& I = data.mesh->triangleIndices();
+
+    for (auto _ : state)
+    {
+        size_t numHits(0);
+        for (const auto& ray : data.rays)
+        {
+            double closestLambda = std::numeric_limits<double>::infinity();
+            bool bHit(false);
+            data.tree.traverse(ray, closestLambda, [&](const int t, double& maxLambda)
+            {
+                auto T = std::make_shared<Triangle>(P[I[3 * t]], P[I[3 * t + 1]], P[I[3 * t + 2]]);
+                RayIntersection currIntersection;
+                double lambda, u, v;
+                if (Util::intersectRayTriangle(ray.getOrigin(), ray.getDirection(), P[I[3 * t]],
+                                               P[I[3 * t + 1]], P[I[3 * t + 2]], maxLambda, lambda, u, v))
+                {
+                    currIntersection = RayIntersection(ray, T.get(), lambda, dvec3(0, 0, 1), dvec3(1 - u - v, u, v));
+                    maxLambda = currIntersection.getLambda();
+                    bHit = true;
+                }
+                return false;
+            });
+            if (bHit) numHits++;
+        }
+        benchmark::DoNotOptimize(numHits);
+    }
+    state.counters["Rays"] = benchmark::Counter(double(data.rays.size()), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+static void BunnyClosest(benchmark::State& state)
+{
+    const auto& data = bunny();
+
+    for (auto _ : state)
+    {
+        size_t numHits(0);
+        RayIntersection intersection;
+        for (const auto& ray : data.rays)
+        {
+            if (data.mesh->closestIntersection(ray, std::numeric_limits<double>::infinity(), intersection)) numHits++;
+        }
+        benchmark::DoNotOptimize(numHits);
+    }
+    state.counters["Rays"] = benchmark::Counter(double(data.rays.size()), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+static void BunnyAnyAllocatePerCandidate(benchmark::State& state)
+{
+    const auto& data = bunny();
+    const auto& P = data.positions;
+    const auto& I = data.mesh->triangleIndices();
+
+    for (auto _ : state)
+    {
+        size_t numHits(0);
+        for (const auto& ray : data.rays)
+        {
+            double maxLambda = std::numeric_limits<double>::infinity();
+            const bool bHit = data.tree.traverse(ray, maxLambda, [&](const int t, double& currentMaxLambda)
+            {
+                auto T = std::make_shared<Triangle>(P[I[3 * t]], P[I[3 * t + 1]], P[I[3 * t + 2]]);
+                double lambda, u, v;
+                return Util::intersectRayTriangle(ray.getOrigin(), ray.getDirection(), P[I[3 * t]],
+                                                  P[I[3 * t + 1]], P[I[3 * t + 2]], currentMaxLambda, lambda, u, v);
+            });
+            if (bHit) numHits++;
+        }
+        benchmark::DoNotOptimize(numHits);
+    }
+    state.counters["Rays"] = benchmark::Counter(double(data.rays.size()), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+static void BunnyAny(benchmark::State& state)
+{
+    const auto& data = bunny();
+
+    for (auto _ : state)
+    {
+        size_t numHits(0);
+        for (const auto& ray : data.rays)
+        {
+            if (data.mesh->anyIntersection(ray, std::numeric_limits<double>::infinity())) numHits++;
+        }
+        benchmark::DoNotOptimize(numHits);
+    }
+    state.counters["Rays"] = benchmark::Counter(double(data.rays.size()), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+//Traversal of the binary, 4-wide and 8-wide hierarchy; the argument is the index into meshByWidth
+static void BunnyClosestNodeWidth(benchmark::State& state)
+{
+    const auto& data = bunny();
+    const auto& mesh = data.meshByWidth[state.range(0)];
+
+    for (auto _ : state)
+    {
+        size_t numHits(0);
+        RayIntersection intersection;
+        for (const auto& ray : data.rays)
+        {
+            if (mesh->closestIntersection(ray, std::numeric_limits<double>::infinity(), intersection)) numHits++;
+        }
+        benchmark::DoNotOptimize(numHits);
+    }
+    state.counters["Rays"] = benchmark::Counter(double(data.rays.size()), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+static void BunnyAnyNodeWidth(benchmark::State& state)
+{
+    const auto& data = bunny();
+    const auto& mesh = data.meshByWidth[state.range(0)];
+
+    for (auto _ : state)
+    {
+        size_t numHits(0);
+        for (const auto& ray : data.rays)
+        {
+            if (mesh->anyIntersection(ray, std::numeric_limits<double>::infinity())) numHits++;
+        }
+        benchmark::DoNotOptimize(numHits);
+    }
+    state.counters["Rays"] = benchmark::Counter(double(data.rays.size()), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+//Closest hits with double, float and quantized vertices; the argument is the index into meshByStorage
+static void BunnyClosestStorage(benchmark::State& state)
+{
+    const auto& mesh = *bunny().meshByStorage[state.range(0)];
+    const auto& rays = bunny().rays;
+
+    for (auto _ : state)
+    {
+        size_t numHits(0);
+        RayIntersection intersection;
+        for (const auto& ray : rays)
+        {
+            if (mesh.closestIntersection(ray, std::numeric_limits<double>::infinity(), intersection)) numHits++;
+        }
+        benchmark::DoNotOptimize(numHits);
+    }
+    state.counters["Rays"] = benchmark::Counter(double(rays.size()), benchmark::Counter::kIsIterationInvariantRate);
+    state.counters["VertexBytes"] = double(mesh.getMemoryUsage());
+}
+
+//Copying one million float vertices and triangles into a mesh with a transformation;
+//argument 0 adds them one by one, 1 in bulk with setVertices() and addTriangles()
+static void MeshIngest(benchmark::State& state)
+{
+    static const size_t NumVertices = 1 << 20;
+    static std::vector<vec3> positions, normals;
+    static std::vector<uint32_t> indices;
+    if (positions.empty())
+    {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+        positions.resize(NumVertices);
+        normals.resize(NumVertices);
+        indices.resize(3 * NumVertices);
+        for (size_t i(0); i < NumVertices; i++)
+        {
+            positions[i] = vec3(dist(rng), dist(rng), dist(rng));
+            normals[i] = vec3(dist(rng), dist(rng), dist(rng));
+        }
+        for (auto& index : indices) index = uint32_t(rng() % NumVertices);
+    }
+
+    dmat4 trafo(1.0);
+    trafo[3] = dvec4(1, 2, 3, 1);
+    const dmat3 normalTrafo(trafo);
+    for (auto _ : state)
+    {
+        BVHIndexedTriangleMesh mesh;
+        if (state.range(0) == 0)
+        {
+            mesh.reserveVertices(NumVertices);
+            for (size_t i(0); i < NumVertices; i++)
+            {
+                const dvec4 p = trafo * dvec4(dvec3(positions[i]), 1.0);
+                mesh.addVertex(dvec3(p) / p.w, glm::normalize(normalTrafo * dvec3(normals[i])));
+            }
+            mesh.reserveTriangleIndices(indices.size());
+            for (size_t i(0); i < indices.size(); i += 3) mesh.addTriangle(indices[i], indices[i + 1], indices[i + 2]);
+        }
+        else
+        {
+            mesh.setVertices(positions.data(), normals.data(), NumVertices, trafo);
+            mesh.addTriangles(indices.data(), indices.size());
+        }
+        benchmark::DoNotOptimize(mesh.getNumVertices());
+    }
+    state.counters["Vertices"] = benchmark::Counter(double(NumVertices), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+//The way RayIntersection used to refer to the renderable: one shared_ptr copy per candidate and one per result.
+//All threads count the references of the same object.
+static void SceneClosestSharedOwnerThreads(benchmark::State& state)
+{
+    const auto& data = bunny();
+    const Scene& scene = bunnyScene();
+
+    for (auto _ : state)
+    {
+        size_t numHits(0);
+        RayIntersection intersection;
+        for (const auto& ray : data.rays)
+        {
+            if (scene.closestIntersection(ray, intersection))
+            {
+                std::shared_ptr<const Renderable> candidate = intersection.getRenderable()->shared_from_this();
+                std::shared_ptr<const Renderable> closest = candidate;
+                benchmark::DoNotOptimize(closest);
+                numHits++;
+            }
+        }
+        benchmark::DoNotOptimize(numHits);
+    }
+    state.counters["Rays"] = benchmark::Counter(double(data.rays.size()), benchmark::Counter::kIsRate);
+}
+
+//Through the scene with hit records, as rendered; the rays of all threads are counted
+static void SceneClosestThreads(benchmark::State& state)
+{
+    const auto& data = bunny();
+    const Scene& scene = bunnyScene();
+
+    for (auto _ : state)
+    {
+        size_t numHits(0);
+        RayIntersection intersection;
+        for (const auto& ray : data.rays)
+        {
+            if (scene.closestIntersection(ray, intersection)) numHits++;
+        }
+        benchmark::DoNotOptimize(numHits);
+    }
+    state.counters["Rays"] = benchmark::Counter(double(data.rays.size()), benchmark::Counter::kIsRate);
+}
+
+BENCHMARK(BunnyClosestAllocatePerCandidate)->Unit(benchmark::kMillisecond);
+BENCHMARK(BunnyClosest)->Unit(benchmark::kMillisecond);
+BENCHMARK(BunnyAnyAllocatePerCandidate)->Unit(benchmark::kMillisecond);
+BENCHMARK(BunnyAny)->Unit(benchmark::kMillisecond);
+BENCHMARK(BunnyClosestNodeWidth)->DenseRange(0, 2)->Unit(benchmark::kMillisecond);
+BENCHMARK(BunnyAnyNodeWidth)->DenseRange(0, 2)->Unit(benchmark::kMillisecond);
+BENCHMARK(BunnyClosestStorage)->DenseRange(0, 2)->Unit(benchmark::kMillisecond);
+BENCHMARK(MeshIngest)->DenseRange(0, 1)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(SceneClosestSharedOwnerThreads)->ThreadRange(1, 32)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(SceneClosestThreads)->ThreadRange(1, 32)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+int main(int argc, char** argv)
+{
+    //The mesh logs its BVH statistics
+    LogCentral logger;
+    LogCentral::init(&logger);
+
+    //The raytracer processor of the scene benchmarks needs the camera factory of the core module
+    InviwoApplication app(argc, argv, "bm-raytracer");
+    {
+        std::vector<std::unique_ptr<InviwoModuleFactoryObject>> modules;
+        modules.emplace_back(createInviwoCore());
+        app.registerModules(std::move(modules));
+    }
+
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+
+    return 0;
+}
+
+#include <warn/pop>
@@ -0,0 +1,219 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 07:52:42
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include <labraytracer/tilescheduler.h>
+#include <labraytracer/performancetimer.h>
+#include <labraytracer/util.h>
+#include <inviwo/core/common/inviwoapplication.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace inviwo
+{
+
+namespace
+{
+///Interleaves the bits of x and y
+uint64_t mortonCode(uint32_t x, uint32_t y)
+{
+    const auto spread = [](uint64_t v)
+    {
+        v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+        v = (v | (v << 8)) & 0x00FF00FF00FF00FFull;
+        v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0Full;
+        v = (v | (v << 2)) & 0x3333333333333333ull;
+        v = (v | (v << 1)) & 0x5555555555555555ull;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+/** Range [begin, end) of tile indices owned by one thread, packed into one atomic word.
+    The owner takes tiles from the front, other threads steal from the back.
+*/
+class alignas(64) TileRange
+{
+public:
+    void set(uint32_t begin, uint32_t end) { range_.store(pack(begin, end)); }
+
+    bool popFront(uint32_t& tile)
+    {
+        uint64_t current = range_.load();
+        while (true)
+        {
+            const uint32_t begin = uint32_t(current >> 32);
+            const uint32_t end = uint32_t(current);
+            if (begin >= end) return false;
+            if (range_.compare_exchange_weak(current, pack(begin + 1, end)))
+            {
+                tile = begin;
+                return true;
+            }
+        }
+    }
+
+    bool popBack(uint32_t& tile)
+    {
+        uint64_t current = range_.load();
+        while (true)
+        {
+            const uint32_t begin = uint32_t(current >> 32);
+            const uint32_t end = uint32_t(current);
+            if (begin >= end) return false;
+            if (range_.compare_exchange_weak(current, pack(begin, end - 1)))
+            {
+                tile = end - 1;
+                return true;
+            }
+        }
+    }
+
+private:
+    static uint64_t pack(uint32_t begin, uint32_t end) { return (uint64_t(begin) << 32) | end; }
+
+    std::atomic<uint64_t> range_;
+};
+}
+
+
+TileScheduler::TileScheduler()
+    : numThreads_(0)
+    , tileSize_(16)
+    , numSteals_(0)
+    , numThreadsUsed_(0)
+{
+}
+
+void TileScheduler::setNumThreads(size_t numThreads)
+{
+    numThreads_ = numThreads;
+}
+
+size_t TileScheduler::getNumThreads() const
+{
+    //Workers of the application's pool and the calling thread
+    const size_t numAvailable =
+        InviwoApplication::isInitialized() ? InviwoApplication::getPtr()->getPoolSize() + 1 : 1;
+    if (numThreads_ > 0) return std::min(numThreads_, numAvailable);
+    return numAvailable;
+}
+
+void TileScheduler::setTileSize(size_t tileSize)
+{
+    tileSize_ = std::max(size_t(1), tileSize);
+}
+
+std::vector<TileScheduler::Tile> TileScheduler::makeTiles(const size2_t& imageSize, const size_t tileSize)
+{
+    const size2_t numTiles((imageSize.x + tileSize - 1) / tileSize, (imageSize.y + tileSize - 1) / tileSize);
+
+    std::vector<std::pair<uint64_t, Tile>> ordered;
+    ordered.reserve(numTiles.x * numTiles.y);
+    for (size_t ty(0); ty < numTiles.y; ty++)
+    {
+        for (size_t tx(0); tx < numTiles.x; tx++)
+        {
+            Tile tile;
+            tile.begin = size2_t(tx * tileSize, ty * tileSize);
+            tile.end = size2_t(std::min(imageSize.x, (tx + 1) * tileSize),
+                               std::min(imageSize.y, (ty + 1) * tileSize));
+            ordered.emplace_back(mortonCode(uint32_t(tx), uint32_t(ty)), tile);
+        }
+    }
+    std::sort(ordered.begin(), ordered.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::vector<Tile> tiles;
+    tiles.reserve(ordered.size());
+    for (const auto& entry : ordered) tiles.push_back(entry.second);
+    return tiles;
+}
+
+bool TileScheduler::run(const size2_t& imageSize, const std::function<void(const Tile&, size_t)>& renderTile,
+                        const std::atomic<bool>* cancelled)
+{
+    const std::vector<Tile> tiles = makeTiles(imageSize, tileSize_);
+    const size_t numThreads = std::max(size_t(1), std::min(getNumThreads(), tiles.size()));
+
+    //Every thread starts with a contiguous part of the Morton order
+    std::unique_ptr<TileRange[]> ranges(new TileRange[numThreads]);
+    for (size_t t(0); t < numThreads; t++)
+    {
+        ranges[t].set(uint32_t(t * tiles.size() / numThreads), uint32_t((t + 1) * tiles.size() / numThreads));
+    }
+
+    std::vector<std::vector<TileTiming>> timings(numThreads);
+    std::atomic<size_t> numSteals(0);
+
+    const auto work = [&](const size_t thread)
+    {
+        auto& threadTimings = timings[thread];
+        threadTimings.reserve(2 * tiles.size() / numThreads + 1);
+        while (!(cancelled && *cancelled))
+        {
+            uint32_t tile;
+            bool bFound = ranges[thread].popFront(tile);
+            for (size_t k(1); !bFound && k < numThreads; k++)
+            {
+                bFound = ranges[(thread + k) % numThreads].popBack(tile);
+                if (bFound) numSteals++;
+            }
+            //Nothing left anywhere; tiles are never added during a run
+            if (!bFound) return;
+
+            PerformanceTimer timer;
+            renderTile(tiles[tile], thread);
+            threadTimings.push_back({tiles[tile], timer.ElapsedTime(), int(thread)});
+        }
+    };
+
+    //The calling thread steals the tiles of threads that do not start
+    Util::runOnPool(numThreads, work);
+
+    tileTimings_.clear();
+    tileTimings_.reserve(tiles.size());
+    for (const auto& threadTimings : timings)
+    {
+        tileTimings_.insert(tileTimings_.end(), threadTimings.begin(), threadTimings.end());
+    }
+    numSteals_ = numSteals;
+    numThreadsUsed_ = numThreads;
+    return tileTimings_.size() == tiles.size();
+}
+
+TileScheduler::Statistics TileScheduler::getStatistics() const
+{
+    Statistics stats;
+    stats.numTiles = tileTimings_.size();
+    stats.numSteals = numSteals_;
+    if (tileTimings_.empty()) return stats;
+
+    std::vector<double> busy(numThreadsUsed_, 0.0);
+    double total(0);
+    for (const auto& timing : tileTimings_)
+    {
+        total += timing.seconds;
+        if (timing.seconds > stats.maxTileSeconds)
+        {
+            stats.maxTileSeconds = timing.seconds;
+            stats.slowestTile = timing.tile;
+        }
+        busy[timing.thread] += timing.seconds;
+    }
+    stats.meanTileSeconds = total / double(tileTimings_.size());
+
+    const double meanBusy = total / double(busy.size());
+    if (meanBusy > 0) stats.imbalance = *std::max_element(busy.begin(), busy.end()) / meanBusy;
+    return stats;
+}
+
+}// namespace inviwo
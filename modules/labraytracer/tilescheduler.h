@@ -0,0 +1,104 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 07:52:42
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <labraytracer/labraytracermoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+namespace inviwo
+{
+
+/** \class TileScheduler
+    \brief Distributes the tiles of an image over a thread pool
+
+    The image is cut into square tiles which are ordered along a Morton curve, so that
+    consecutive tiles are close to each other in the image. Every thread starts with a
+    contiguous range of that order and steals single tiles from the end of other ranges
+    once its own range is done. This balances scenes where some regions (e.g. reflective
+    objects) are much more expensive than others.
+
+    The threads are tasks on the application's ThreadPool; the calling thread takes part in the work
+    and also renders the tiles of tasks that the pool has not started yet. run() therefore never waits
+    for queued tasks and may be called from a pool task itself.
+*/
+class IVW_MODULE_LABRAYTRACER_API TileScheduler
+{
+public:
+    ///Pixel range [begin, end) of a tile
+    struct Tile
+    {
+        size2_t begin;
+        size2_t end;
+    };
+
+    struct TileTiming
+    {
+        Tile tile;
+        double seconds;
+        ///Index of the thread that rendered the tile, 0 is the calling thread
+        int thread;
+    };
+
+    struct Statistics
+    {
+        size_t numTiles = 0;
+        size_t numSteals = 0;
+        double meanTileSeconds = 0;
+        double maxTileSeconds = 0;
+        ///The most expensive tile
+        Tile slowestTile = {size2_t(0), size2_t(0)};
+        ///Busy time of the busiest thread relative to the average busy time; 1 is perfect balance
+        double imbalance = 1;
+    };
+
+    TileScheduler();
+
+    ///Number of threads including the calling one; 0 uses all threads of the application's pool
+    void setNumThreads(size_t numThreads);
+    size_t getNumThreads() const;
+
+    ///Edge length of the tiles in pixels
+    void setTileSize(size_t tileSize);
+    size_t getTileSize() const { return tileSize_; }
+
+    /**
+     * Calls renderTile(tile, thread) for every tile of the image and returns once all are done.
+     * renderTile is called concurrently from several threads; thread is the index of the calling
+     * one, below getNumThreads(), e.g. for per-thread data. Exceptions are passed on.
+     * If cancelled is given and gets set, no further tiles are started; returns whether all
+     * tiles have been rendered.
+     */
+    bool run(const size2_t& imageSize, const std::function<void(const Tile&, size_t)>& renderTile,
+             const std::atomic<bool>* cancelled = nullptr);
+
+    ///Timings of the tiles of the last run, in the order they were finished per thread
+    const std::vector<TileTiming>& getTileTimings() const { return tileTimings_; }
+
+    ///Summary of the last run
+    Statistics getStatistics() const;
+
+    ///Tiles covering the image, ordered along a Morton curve
+    static std::vector<Tile> makeTiles(const size2_t& imageSize, const size_t tileSize);
+
+private:
+    size_t numThreads_;
+    size_t tileSize_;
+    std::vector<TileTiming> tileTimings_;
+    size_t numSteals_;
+    ///Number of threads of the last run
+    size_t numThreadsUsed_;
+};
+
+}// namespace inviwo
@@ -33,28 +33,19 @@ Triangle::Triangle(const dvec3& v0, const dvec3& v1, const dvec3& v2, const dvec
 bool Triangle::closestIntersection(const Ray& ray, double maxLambda,
                                    RayIntersection& intersection) const
 {
-    /*
-    TODO: Implement this method
-    Your code should compute the intersection between a ray and a triangle.
-    You should accept the intersection only in the interval 0 < lambda < maxLambda.
-
-    Return false, if there is no intersection.
-
-    If you detect an intersection,
-    you return true and fill-in the information in the RayIntersection object:
-    if(rayIntersectsTriangle)
+    const dvec3 e1 = mVertices[1] - mVertices[0];
+    const dvec3 e2 = mVertices[2] - mVertices[0];
+    const dvec3 n = cross(e1, e2);
+    double lambda, u, v;
+    if (!Util::intersectRayTriangle(ray.getOrigin(), ray.getDirection(), mVertices[0], e1, e2, n,
+                                    maxLambda, lambda, u, v))
     {
-        intersection = RayIntersection(ray, shared_from_this(), lambda, normal, dvec3(0, 0, 0));
-        return true;
+        return false;
     }
-    
-    Hints:
-      Ray origin p_r : ray.getOrigin()
-      Ray direction t_r : ray.getDirection()
-      Compute the intersection point using ray.pointOnRay(lambda)
-    */
 
-    return false;
+    const dvec3 uvw = mUVW[0] * (1.0 - u - v) + mUVW[1] * u + mUVW[2] * v;
+    intersection = RayIntersection(ray, this, lambda, normalize(n), uvw);
+    return true;
 }
 
 
@@ -64,6 +55,13 @@ bool Triangle::anyIntersection(const Ray& ray, double maxLambda) const
     return closestIntersection(ray, maxLambda, temp);
 }
 
+bool Triangle::getBoundingBox(BoundingBox& box) const
+{
+    box = BoundingBox(glm::min(mVertices[0], glm::min(mVertices[1], mVertices[2])),
+                      glm::max(mVertices[0], glm::max(mVertices[1], mVertices[2])));
+    return true;
+}
+
 void Triangle::drawGeometry(std::shared_ptr<BasicMesh> mesh,
                             std::vector<BasicMesh::Vertex>& vertices) const
 {
@@ -40,9 +40,13 @@ public:
     bool closestIntersection(const Ray& ray, double maxLambda,
                              RayIntersection& intersection) const override;
     bool anyIntersection(const Ray& ray, double maxLambda) const override;
+    bool getBoundingBox(BoundingBox& box) const override;
     void drawGeometry(std::shared_ptr<BasicMesh> mesh,
                       std::vector<BasicMesh::Vertex>& vertices) const override;
 
+    const dvec3& getVertex(const int i) const { return mVertices[i]; }
+    const dvec3& getTextureCoordinate(const int i) const { return mUVW[i]; }
+
 //Attributes
 private:
     dvec3 mVertices[3];
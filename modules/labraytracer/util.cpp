@@ -9,10 +9,32 @@
  */
 
 #include <labraytracer/util.h>
+#include <inviwo/core/common/inviwoapplication.h>
+
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
 
 namespace inviwo
 {
 
+namespace
+{
+///Shared by the calling thread and the pool tasks of one Util::runOnPool()
+struct PoolTasks
+{
+    std::mutex mutex;
+    std::condition_variable done;
+    ///Set once the calling thread waits; tasks starting afterwards do nothing
+    bool bClosed = false;
+    size_t numRunning = 0;
+    std::exception_ptr exception;
+};
+}
+
 Util::Util() {}
 
 const double Util::epsilon = 0.000000001; //when working with double precision floats
@@ -36,6 +58,46 @@ dvec3 Util::scalarMult(const double& s, const dvec3& v)
     return dvec3(s * v.x, s * v.y, s * v.z);
 }
 
+namespace
+{
+double signNotZero(const double x) { return (x < 0) ? -1.0 : 1.0; }
+
+uint32_t toFixed16(const double x)
+{
+    return uint32_t(std::lround((glm::clamp(x, -1.0, 1.0) * 0.5 + 0.5) * 65535.0));
+}
+
+double fromFixed16(const uint32_t x)
+{
+    return double(x) / 65535.0 * 2.0 - 1.0;
+}
+}
+
+uint32_t Util::encodeOctahedral(const dvec3& n)
+{
+    const double l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (l1 == 0) return toFixed16(0) | (toFixed16(0) << 16);
+
+    dvec2 p(n.x / l1, n.y / l1);
+    if (n.z < 0)
+    {
+        p = dvec2((1.0 - std::abs(p.y)) * signNotZero(p.x), (1.0 - std::abs(p.x)) * signNotZero(p.y));
+    }
+    return toFixed16(p.x) | (toFixed16(p.y) << 16);
+}
+
+dvec3 Util::decodeOctahedral(const uint32_t code)
+{
+    const dvec2 p(fromFixed16(code & 0xffff), fromFixed16(code >> 16));
+    dvec3 n(p.x, p.y, 1.0 - std::abs(p.x) - std::abs(p.y));
+    if (n.z < 0)
+    {
+        n.x = (1.0 - std::abs(p.y)) * signNotZero(p.x);
+        n.y = (1.0 - std::abs(p.x)) * signNotZero(p.y);
+    }
+    return glm::normalize(n);
+}
+
 void Util::drawLineSegment(const dvec3& v1, const dvec3& v2, const dvec4& color,
                            IndexBufferRAM* indexBuffer, std::vector<BasicMesh::Vertex>& vertices)
 {
@@ -45,4 +107,79 @@ void Util::drawLineSegment(const dvec3& v1, const dvec3& v2, const dvec4& color,
     vertices.push_back({v2, dvec3(0, 0, 0), v2, color});
 }
 
+size_t Util::getNumPoolThreads()
+{
+    if (!InviwoApplication::isInitialized()) return 0;
+    return InviwoApplication::getPtr()->getPoolSize();
+}
+
+void Util::runOnPool(const size_t numThreads, const std::function<void(size_t)>& work)
+{
+    //A task may start after this function has returned, so it only holds on to the shared state
+    auto tasks = std::make_shared<PoolTasks>();
+    for (size_t t(1); t < numThreads; t++)
+    {
+        dispatchPool([tasks, &work, t]()
+        {
+            {
+                std::lock_guard<std::mutex> lock(tasks->mutex);
+                if (tasks->bClosed) return;
+                tasks->numRunning++;
+            }
+            std::exception_ptr exception;
+            try
+            {
+                work(t);
+            }
+            catch (...)
+            {
+                exception = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(tasks->mutex);
+            if (exception && !tasks->exception) tasks->exception = exception;
+            tasks->numRunning--;
+            tasks->done.notify_all();
+        });
+    }
+
+    std::exception_ptr exception;
+    try
+    {
+        work(0);
+    }
+    catch (...)
+    {
+        exception = std::current_exception();
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(tasks->mutex);
+        tasks->bClosed = true;
+        tasks->done.wait(lock, [&]() { return tasks->numRunning == 0; });
+        if (!exception) exception = tasks->exception;
+    }
+    if (exception) std::rethrow_exception(exception);
+}
+
+void Util::forEachChunk(const size_t n, const size_t minChunkSize,
+                        const std::function<void(size_t, size_t)>& f)
+{
+    const size_t numThreads = getNumPoolThreads();
+    const size_t numChunks = std::min(4 * numThreads, n / std::max(minChunkSize, size_t(1)));
+    if (numChunks < 2)
+    {
+        f(size_t(0), n);
+        return;
+    }
+
+    std::atomic<size_t> nextChunk(0);
+    runOnPool(std::min(numThreads + 1, numChunks), [&](size_t)
+    {
+        for (size_t c = nextChunk++; c < numChunks; c = nextChunk++)
+        {
+            f(c * n / numChunks, (c + 1) * n / numChunks);
+        }
+    });
+}
+
 }// namespace inviwo
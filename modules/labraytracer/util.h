@@ -14,6 +14,9 @@
 #include <inviwo/core/common/inviwo.h>
 #include <inviwo/core/datastructures/geometry/basicmesh.h>
 
+#include <cmath>
+#include <functional>
+
 namespace inviwo
 {
 
@@ -39,9 +42,140 @@ public:
     static void drawLineSegment(const dvec3& v1, const dvec3& v2, const dvec4& color,
                                 IndexBufferRAM* indexBuffer,
                                 std::vector<BasicMesh::Vertex>& vertices);
+
+    /** Parameters where the ray enters and leaves the sphere with the given center
+        and squared radius. The direction must be normalized. Returns false if the ray misses it.
+    */
+    static bool intersectRaySphereSpan(const dvec3& origin, const dvec3& direction,
+                                       const dvec3& center, const double radius2,
+                                       double& enter, double& leave);
+
+    /** Ray-sphere intersection accepting hits with 0 < lambda < maxLambda.
+        The hit is where the ray enters the sphere, or where it leaves if it starts inside.
+    */
+    static bool intersectRaySphere(const dvec3& origin, const dvec3& direction,
+                                   const dvec3& center, const double radius2,
+                                   const double maxLambda, double& lambda);
+
+    /** Ray-plane intersection accepting hits with 0 <= lambda <= maxLambda - epsilon.
+        Rays within epsilon of being parallel to the plane miss it.
+    */
+    static bool intersectRayPlane(const dvec3& origin, const dvec3& direction,
+                                  const dvec3& normal, const dvec3& point,
+                                  const double maxLambda, double& lambda);
+
+    /** Ray-triangle intersection for a triangle given by its first vertex p0,
+        its edges e1 = p1 - p0, e2 = p2 - p0, and the (unnormalized) normal n = cross(e1, e2).
+        Accepts hits with 0 < lambda < maxLambda. On a hit, (u, v) are the barycentric
+        coordinates w.r.t. p1 and p2, the weight of p0 is 1 - u - v.
+    */
+    static bool intersectRayTriangle(const dvec3& origin, const dvec3& direction,
+                                     const dvec3& p0, const dvec3& e1, const dvec3& e2,
+                                     const dvec3& n, const double maxLambda,
+                                     double& lambda, double& u, double& v);
+
+    ///Ray-triangle intersection for a triangle given by its three vertices.
+    static bool intersectRayTriangle(const dvec3& origin, const dvec3& direction,
+                                     const dvec3& p0, const dvec3& p1, const dvec3& p2,
+                                     const double maxLambda, double& lambda, double& u, double& v)
+    {
+        const dvec3 e1 = p1 - p0;
+        const dvec3 e2 = p2 - p0;
+        return intersectRayTriangle(origin, direction, p0, e1, e2, cross(e1, e2), maxLambda,
+                                    lambda, u, v);
+    }
+
+    /** Octahedral encoding of a direction into two 16-bit fixed-point values. The direction is
+        projected onto the octahedron |x| + |y| + |z| = 1, whose lower half is folded over the upper one.
+        The decoded direction is normalized and off by less than 1e-4 radians.
+    */
+    static uint32_t encodeOctahedral(const dvec3& n);
+    static dvec3 decodeOctahedral(const uint32_t code);
+
+    ///Number of worker threads in the Inviwo pool; zero means working on the calling thread.
+    static size_t getNumPoolThreads();
+
+    /** Calls work(0) on the calling thread and work(1) ... work(numThreads - 1) as tasks on the
+        application's pool. Returns once the calling thread and all tasks that have started are done;
+        tasks that start later do nothing. work must therefore take its items from a queue that the
+        calling thread drains as well. Never waits for queued tasks, so it may be nested in pool tasks.
+        Exceptions are passed on.
+    */
+    static void runOnPool(const size_t numThreads, const std::function<void(size_t)>& work);
+
+    /** Calls f(begin, end) for consecutive chunks of [0, n), in parallel on the thread pool
+        if there are workers and at least two chunks of minChunkSize. Returns when all are done.
+        The calling thread takes chunks as well, see runOnPool().
+    */
+    static void forEachChunk(const size_t n, const size_t minChunkSize,
+                             const std::function<void(size_t, size_t)>& f);
+
     //Attributes
 public:
     static const double epsilon;
 };
 
+
+//Inlined, since it is called for every triangle candidate.
+inline bool Util::intersectRayTriangle(const dvec3& origin, const dvec3& direction,
+                                       const dvec3& p0, const dvec3& e1, const dvec3& e2,
+                                       const dvec3& n, const double maxLambda,
+                                       double& lambda, double& u, double& v)
+{
+    //Solve origin + lambda * direction = p0 + u * e1 + v * e2 with Cramer's rule
+    const double det = dot(direction, n);
+    if (det == 0) return false; //parallel
+
+    const double invDet = 1.0 / det;
+    const dvec3 C = p0 - origin;
+    const dvec3 R = cross(direction, C);
+
+    u = -dot(R, e2) * invDet;
+    if (u < 0 || u > 1) return false;
+
+    v = dot(R, e1) * invDet;
+    if (v < 0 || u + v > 1) return false;
+
+    lambda = dot(C, n) * invDet;
+    return (lambda > 0 && lambda < maxLambda);
+}
+
+inline bool Util::intersectRaySphereSpan(const dvec3& origin, const dvec3& direction,
+                                         const dvec3& center, const double radius2,
+                                         double& enter, double& leave)
+{
+    const dvec3 OC = origin - center;
+    const double b = dot(OC, direction);
+    const double c = dot(OC, OC) - radius2;
+    const double Discriminant = b * b - c;
+    if (Discriminant < 0) return false;
+
+    const double Root = std::sqrt(Discriminant);
+    enter = -b - Root;
+    leave = -b + Root;
+    return true;
+}
+
+inline bool Util::intersectRaySphere(const dvec3& origin, const dvec3& direction,
+                                     const dvec3& center, const double radius2,
+                                     const double maxLambda, double& lambda)
+{
+    double Enter, Leave;
+    if (!intersectRaySphereSpan(origin, direction, center, radius2, Enter, Leave)) return false;
+
+    lambda = Enter > 0 ? Enter : Leave;
+    return (lambda > 0 && lambda < maxLambda);
+}
+
+inline bool Util::intersectRayPlane(const dvec3& origin, const dvec3& direction,
+                                    const dvec3& normal, const dvec3& point,
+                                    const double maxLambda, double& lambda)
+{
+    const double d = dot(direction, normal);
+    if (std::abs(d) < epsilon) return false;
+
+    lambda = dot(point - origin, normal) / d;
+    return !(lambda < 0 || lambda + epsilon > maxLambda);
+}
+
 }// namespace inviwo
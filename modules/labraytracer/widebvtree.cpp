@@ -0,0 +1,289 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 07:45:40
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#include <labraytracer/widebvtree.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IVW_LABRAYTRACER_SSE
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace inviwo
+{
+
+WideBVHRay::WideBVHRay(const Ray& ray)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        origin[i] = float(ray.getOrigin()[i]);
+        invDirection[i] = float(1.0 / ray.getDirection()[i]);
+        //Sign of the inverse, so that a direction of -0 counts as negative
+        bNegative[i] = invDirection[i] < 0;
+    }
+}
+
+namespace widebvh
+{
+//Defined in widebvtree_avx.cpp, which is compiled for AVX
+bool isAVXCompiled();
+int intersectChildrenAVX(const float (*bboxMin)[8], const float (*bboxMax)[8], const float* origin,
+                         const float* invDirection, const bool* bNegative, const float maxLambda,
+                         float* tEntry);
+}
+
+namespace
+{
+//The near plane is selected by the direction sign, so unused slots with inverted boxes are never hit.
+//Zero direction components yield NaNs, which are dropped by the comparison order below.
+template <int Width>
+int intersectChildrenScalar(const WideBVHNode<Width>& node, const WideBVHRay& ray, const float maxLambda, float* tEntry)
+{
+    int hitMask = 0;
+    for (int c = 0; c < Width; c++)
+    {
+        float tNear = 0.0f;
+        float tFar = maxLambda;
+        for (int i = 0; i < 3; i++)
+        {
+            const float nearPlane = ray.bNegative[i] ? node.bboxMax[i][c] : node.bboxMin[i][c];
+            const float farPlane = ray.bNegative[i] ? node.bboxMin[i][c] : node.bboxMax[i][c];
+            const float t0 = (nearPlane - ray.origin[i]) * ray.invDirection[i];
+            const float t1 = (farPlane - ray.origin[i]) * ray.invDirection[i];
+            tNear = (t0 > tNear) ? t0 : tNear;
+            tFar = (t1 < tFar) ? t1 : tFar;
+        }
+        tEntry[c] = tNear;
+        if (tNear <= tFar) hitMask |= (1 << c);
+    }
+    return hitMask;
+}
+
+#ifdef IVW_LABRAYTRACER_SSE
+///Tests four children starting at the given slot
+inline int intersectChildrenSSE4(const float (&bboxMin)[3][4], const float (&bboxMax)[3][4],
+                                 const WideBVHRay& ray, const float maxLambda, float* tEntry)
+{
+    __m128 tNear = _mm_setzero_ps();
+    __m128 tFar = _mm_set1_ps(maxLambda);
+    for (int i = 0; i < 3; i++)
+    {
+        const float* nearPlane = ray.bNegative[i] ? bboxMax[i] : bboxMin[i];
+        const float* farPlane = ray.bNegative[i] ? bboxMin[i] : bboxMax[i];
+        const __m128 origin = _mm_set1_ps(ray.origin[i]);
+        const __m128 invDirection = _mm_set1_ps(ray.invDirection[i]);
+        //max/min return the second operand for NaN, so those keep the current interval
+        tNear = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearPlane), origin), invDirection), tNear);
+        tFar = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farPlane), origin), invDirection), tFar);
+    }
+    _mm_storeu_ps(tEntry, tNear);
+    return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+}
+
+int intersectChildrenSSE(const WideBVHNode<4>& node, const WideBVHRay& ray, const float maxLambda, float* tEntry)
+{
+    return intersectChildrenSSE4(node.bboxMin, node.bboxMax, ray, maxLambda, tEntry);
+}
+
+///Two SSE tests for processors without AVX
+int intersectChildrenSSE(const WideBVHNode<8>& node, const WideBVHRay& ray, const float maxLambda, float* tEntry)
+{
+    float bboxMin[2][3][4];
+    float bboxMax[2][3][4];
+    for (int i = 0; i < 3; i++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            bboxMin[0][i][c] = node.bboxMin[i][c];
+            bboxMin[1][i][c] = node.bboxMin[i][c + 4];
+            bboxMax[0][i][c] = node.bboxMax[i][c];
+            bboxMax[1][i][c] = node.bboxMax[i][c + 4];
+        }
+    }
+    const int low = intersectChildrenSSE4(bboxMin[0], bboxMax[0], ray, maxLambda, tEntry);
+    const int high = intersectChildrenSSE4(bboxMin[1], bboxMax[1], ray, maxLambda, tEntry + 4);
+    return low | (high << 4);
+}
+#endif
+
+int intersectChildrenAVX(const WideBVHNode<8>& node, const WideBVHRay& ray, const float maxLambda, float* tEntry)
+{
+    return widebvh::intersectChildrenAVX(node.bboxMin, node.bboxMax, ray.origin, ray.invDirection,
+                                         ray.bNegative, maxLambda, tEntry);
+}
+
+bool cpuSupportsAVX()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 1);
+    const bool bOSXSave = (info[2] & (1 << 27)) != 0;
+    const bool bAVX = (info[2] & (1 << 28)) != 0;
+    if (!bOSXSave || !bAVX) return false;
+    //The operating system needs to preserve the YMM registers
+    return (_xgetbv(0) & 0x6) == 0x6;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_cpu_supports("avx");
+#else
+    return false;
+#endif
+}
+
+float computeArea(const BVTree::Node& node)
+{
+    const vec3 d = node.bboxMax - node.bboxMin;
+    return 2 * (d[0] * d[1] + d[0] * d[2] + d[1] * d[2]);
+}
+
+template <int Width>
+void selectNodeTest(widebvh::IntersectChildren<Width>& intersectChildren, const char*& instructionSet);
+
+template <>
+void selectNodeTest<4>(widebvh::IntersectChildren<4>& intersectChildren, const char*& instructionSet)
+{
+#ifdef IVW_LABRAYTRACER_SSE
+    intersectChildren = &intersectChildrenSSE;
+    instructionSet = "SSE";
+#else
+    intersectChildren = &intersectChildrenScalar<4>;
+    instructionSet = "scalar";
+#endif
+}
+
+template <>
+void selectNodeTest<8>(widebvh::IntersectChildren<8>& intersectChildren, const char*& instructionSet)
+{
+    if (widebvh::hasAVX())
+    {
+        intersectChildren = &intersectChildrenAVX;
+        instructionSet = "AVX";
+        return;
+    }
+#ifdef IVW_LABRAYTRACER_SSE
+    intersectChildren = &intersectChildrenSSE;
+    instructionSet = "SSE";
+#else
+    intersectChildren = &intersectChildrenScalar<8>;
+    instructionSet = "scalar";
+#endif
+}
+}
+
+bool widebvh::hasAVX()
+{
+    static const bool bHasAVX = isAVXCompiled() && cpuSupportsAVX();
+    return bHasAVX;
+}
+
+
+template <int Width>
+WideBVTree<Width>::WideBVTree()
+{
+    selectNodeTest<Width>(mIntersectChildren, mInstructionSet);
+}
+
+template <int Width>
+void WideBVTree<Width>::build(const BVTree& binaryTree)
+{
+    mNodes.clear();
+    mPrimitiveIndices = binaryTree.getPrimitiveIndices();
+    if (binaryTree.getNodes().empty()) return;
+
+    mNodes.reserve(binaryTree.getNodes().size() / (Width - 1) + 1);
+    collapse(binaryTree.getNodes(), 0);
+}
+
+template <int Width>
+int WideBVTree<Width>::collapse(const std::vector<BVTree::Node>& binaryNodes, const int binaryIndex)
+{
+    //Gather the children by opening the inner child with the largest area until the node is full
+    int children[Width];
+    int numChildren = 0;
+    const BVTree::Node& binaryNode = binaryNodes[binaryIndex];
+    if (binaryNode.isLeaf())
+    {
+        children[numChildren++] = binaryIndex;
+    }
+    else
+    {
+        children[numChildren++] = binaryIndex + 1;
+        children[numChildren++] = binaryNode.rightOrFirst;
+        while (numChildren < Width)
+        {
+            int largest = -1;
+            float largestArea = -1;
+            for (int c = 0; c < numChildren; c++)
+            {
+                const BVTree::Node& candidate = binaryNodes[children[c]];
+                if (candidate.isLeaf()) continue;
+                const float area = computeArea(candidate);
+                if (area > largestArea)
+                {
+                    largestArea = area;
+                    largest = c;
+                }
+            }
+            if (largest < 0) break;
+
+            const int opened = children[largest];
+            children[largest] = opened + 1;
+            children[numChildren++] = binaryNodes[opened].rightOrFirst;
+        }
+    }
+
+    const int nodeIndex = int(mNodes.size());
+    mNodes.emplace_back();
+    for (int c = 0; c < Width; c++)
+    {
+        Node& node = mNodes[nodeIndex];
+        if (c >= numChildren)
+        {
+            //Inverted box, never hit
+            for (int i = 0; i < 3; i++)
+            {
+                node.bboxMin[i][c] = std::numeric_limits<float>::infinity();
+                node.bboxMax[i][c] = -std::numeric_limits<float>::infinity();
+            }
+            node.child[c] = 0;
+            node.numPrimitives[c] = -1;
+            continue;
+        }
+
+        const BVTree::Node& child = binaryNodes[children[c]];
+        for (int i = 0; i < 3; i++)
+        {
+            node.bboxMin[i][c] = child.bboxMin[i];
+            node.bboxMax[i][c] = child.bboxMax[i];
+        }
+        if (child.isLeaf())
+        {
+            node.child[c] = child.rightOrFirst;
+            node.numPrimitives[c] = child.numPrimitives;
+        }
+        else
+        {
+            //Recursion may reallocate mNodes
+            const int childIndex = collapse(binaryNodes, children[c]);
+            mNodes[nodeIndex].child[c] = childIndex;
+            mNodes[nodeIndex].numPrimitives[c] = 0;
+        }
+    }
+
+    return nodeIndex;
+}
+
+template class WideBVTree<4>;
+template class WideBVTree<8>;
+
+}
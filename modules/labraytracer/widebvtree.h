@@ -0,0 +1,171 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 07:45:40
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+#pragma once
+
+#include <labraytracer/labraytracermoduledefine.h>
+#include <inviwo/core/common/inviwo.h>
+#include <labraytracer/bvtree.h>
+
+#include <vector>
+#include <cstdint>
+
+namespace inviwo
+{
+
+/** Node of a WideBVTree. The boxes of all children are stored in single precision as a
+    structure of arrays, so that a single SIMD slab test covers all children at once.
+*/
+template <int Width>
+struct alignas(64) WideBVHNode
+{
+    ///Child boxes, indexed as [axis][child]
+    float bboxMin[3][Width];
+    float bboxMax[3][Width];
+    ///Inner child: index of the child node. Leaf child: offset into the primitive index list.
+    int32_t child[Width];
+    ///Leaf child: number of triangles. Inner child: 0. Unused slot: -1.
+    int32_t numPrimitives[Width];
+};
+
+///Ray in the form needed by the node tests of a WideBVTree
+struct WideBVHRay
+{
+    explicit WideBVHRay(const Ray& ray);
+
+    float origin[3];
+    float invDirection[3];
+    ///Whether the ray travels in negative direction along an axis; selects the near plane.
+    bool bNegative[3];
+};
+
+namespace widebvh
+{
+///Slab test of a ray against all children of a node. Returns a bit mask of the children hit
+///within maxLambda and writes their entry distances to tEntry.
+template <int Width>
+using IntersectChildren = int (*)(const WideBVHNode<Width>& node, const WideBVHRay& ray,
+                                  const float maxLambda, float* tEntry);
+
+///Whether the processor and the build support the 8-wide AVX node test
+IVW_MODULE_LABRAYTRACER_API bool hasAVX();
+}
+
+
+/** Bounding volume hierarchy with 4 or 8 children per node.
+
+    It is obtained by collapsing a binary BVTree: the inner child with the largest surface
+    area is opened until a node has Width children. The node test is picked at construction
+    from the widest instruction set available (AVX, SSE, or a portable fallback).
+*/
+template <int Width>
+class IVW_MODULE_LABRAYTRACER_API WideBVTree
+{
+public:
+    static_assert(Width == 4 || Width == 8, "WideBVTree supports 4 or 8 children per node");
+
+    using Node = WideBVHNode<Width>;
+
+    WideBVTree();
+
+    ///Collapses the given binary tree. It is not referenced afterwards.
+    void build(const BVTree& binaryTree);
+
+    /**
+     * Traverses the tree front to back, with the same callback contract as BVTree::traverse:
+     * intersectTriangle(triangleIndex, maxLambda) may shrink maxLambda and stops the traversal
+     * by returning true.
+     */
+    template <typename IntersectTriangle>
+    bool traverse(const Ray& ray, double& maxLambda, IntersectTriangle&& intersectTriangle) const;
+
+    size_t getNumNodes() const { return mNodes.size(); }
+    static constexpr size_t getBytesPerNode() { return sizeof(Node); }
+    ///Memory used by the nodes and the primitive index list in bytes
+    size_t getMemoryUsage() const
+    {
+        return mNodes.size() * sizeof(Node) + mPrimitiveIndices.size() * sizeof(int);
+    }
+    ///Name of the instruction set used for the node test
+    const char* getInstructionSet() const { return mInstructionSet; }
+
+private:
+    int collapse(const std::vector<BVTree::Node>& binaryNodes, const int binaryIndex);
+
+    std::vector<Node> mNodes;
+    std::vector<int> mPrimitiveIndices;
+    widebvh::IntersectChildren<Width> mIntersectChildren;
+    const char* mInstructionSet;
+};
+
+
+template <int Width>
+template <typename IntersectTriangle>
+bool WideBVTree<Width>::traverse(const Ray& ray, double& maxLambda, IntersectTriangle&& intersectTriangle) const
+{
+    if (mNodes.empty()) return false;
+
+    const WideBVHRay nodeRay(ray);
+
+    //Fixed-size stack. Each level of the tree leaves at most Width-1 siblings behind.
+    struct StackEntry
+    {
+        int32_t child;
+        int32_t numPrimitives;
+        float tEntry;
+    };
+    StackEntry stack[BVTree::MaxDepth * Width];
+    int stackSize = 0;
+    stack[stackSize++] = {0, 0, 0.0f};
+
+    alignas(32) float tEntry[Width];
+    while (stackSize > 0)
+    {
+        //Skip entries that start behind the closest hit found so far
+        const StackEntry entry = stack[--stackSize];
+        if (entry.tEntry > maxLambda) continue;
+
+        if (entry.numPrimitives > 0)
+        {
+            const int last = entry.child + entry.numPrimitives;
+            for (int i = entry.child; i < last; i++)
+            {
+                if (intersectTriangle(mPrimitiveIndices[i], maxLambda)) return true;
+            }
+            continue;
+        }
+
+        const Node& node = mNodes[entry.child];
+        const int hitMask = mIntersectChildren(node, nodeRay, float(maxLambda), tEntry);
+
+        //Push the hit children sorted far to near, so that the nearest one is popped next
+        const int firstPushed = stackSize;
+        for (int c = 0; c < Width; c++)
+        {
+            if (!(hitMask & (1 << c))) continue;
+
+            const StackEntry childEntry = {node.child[c], node.numPrimitives[c], tEntry[c]};
+            int k = stackSize++;
+            while (k > firstPushed && stack[k - 1].tEntry < childEntry.tEntry)
+            {
+                stack[k] = stack[k - 1];
+                k--;
+            }
+            stack[k] = childEntry;
+        }
+    }
+
+    return false;
+}
+
+extern template class WideBVTree<4>;
+extern template class WideBVTree<8>;
+
+}
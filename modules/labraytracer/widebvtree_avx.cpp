@@ -0,0 +1,64 @@
+/*********************************************************************
+ *  Author  : agent
+ *  Init    : Saturday, October 17, 2026 - 07:45:40
+ *
+ *  Project : KTH Inviwo Modules
+ *
+ *  License : Follows the Inviwo BSD license model
+ *********************************************************************
+ */
+
+//This file is compiled with AVX enabled (see CMakeLists.txt) and is only called after
+//widebvh::hasAVX() has confirmed processor support. It deliberately includes no other
+//headers: inline functions instantiated here could otherwise be picked by the linker
+//for the whole module and execute AVX instructions on processors without it.
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+namespace inviwo
+{
+
+namespace widebvh
+{
+
+bool isAVXCompiled()
+{
+#ifdef __AVX__
+    return true;
+#else
+    return false;
+#endif
+}
+
+///Slab test of all 8 children of a WideBVHNode<8>, see intersectChildrenSSE in widebvtree.cpp
+int intersectChildrenAVX(const float (*bboxMin)[8], const float (*bboxMax)[8], const float* origin,
+                         const float* invDirection, const bool* bNegative, const float maxLambda,
+                         float* tEntry)
+{
+#ifdef __AVX__
+    __m256 tNear = _mm256_setzero_ps();
+    __m256 tFar = _mm256_set1_ps(maxLambda);
+    for (int i = 0; i < 3; i++)
+    {
+        const float* nearPlane = bNegative[i] ? bboxMax[i] : bboxMin[i];
+        const float* farPlane = bNegative[i] ? bboxMin[i] : bboxMax[i];
+        const __m256 o = _mm256_set1_ps(origin[i]);
+        const __m256 inv = _mm256_set1_ps(invDirection[i]);
+        //max/min return the second operand for NaN, so those keep the current interval
+        tNear = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(nearPlane), o), inv), tNear);
+        tFar = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(farPlane), o), inv), tFar);
+    }
+    _mm256_storeu_ps(tEntry, tNear);
+    return _mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+#else
+    (void)bboxMin; (void)bboxMax; (void)origin; (void)invDirection; (void)bNegative;
+    (void)maxLambda; (void)tEntry;
+    return 0;
+#endif
+}
+
+}
+
+}